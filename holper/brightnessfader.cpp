@@ -0,0 +1,108 @@
+#include "brightnessfader.h"
+#include "context.h"
+#include "logger.h"
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+BrightnessFader::BrightnessFader(Context* context)
+    : ThreadBase("BrightnessFader", context) {
+  int r = pthread_mutex_init(&mutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", St::errorString(r).c_str());
+  }
+  if (sem_init(&wake_, 0, 0) != 0) {
+    THROW("Semaphore init failed: %s", St::errorString().c_str());
+  }
+}
+
+void BrightnessFader::fade(const SysfsDevices::Device* device, int target,
+    TimeDelta duration, DoneFunction done, const TimePoint& now) {
+  target = std::clamp(target, 0, device->max());
+  {
+    LockMutex lock(&mutex_);
+    std::erase_if(transitions_, [&](const Transition& transition) {
+      return transition.device == device;
+    });
+    // value() is whatever the last frame wrote, so a retarget is seamless
+    transitions_.push_back(Transition{device, device->value(), target, now,
+        duration, std::move(done)});
+  }
+  sem_post(&wake_);
+}
+
+void BrightnessFader::cancel(const SysfsDevices::Device* device) {
+  LockMutex lock(&mutex_);
+  std::erase_if(transitions_, [&](const Transition& transition) {
+    return transition.device == device;
+  });
+}
+
+std::optional<int> BrightnessFader::target(
+    const SysfsDevices::Device* device) {
+  LockMutex lock(&mutex_);
+  for (const auto& transition : transitions_) {
+    if (transition.device == device) {
+      return transition.to;
+    }
+  }
+  return std::nullopt;
+}
+
+size_t BrightnessFader::step(const TimePoint& now) {
+  std::vector<DoneFunction> finished;
+  size_t running;
+  {
+    LockMutex lock(&mutex_);
+    for (auto it = transitions_.begin(); it != transitions_.end();) {
+      double t = it->duration.ns() <= 0 ? 1.0 :
+        (double)(now - it->start).ns() / it->duration.ns();
+      t = std::clamp(t, 0.0, 1.0);
+      // smoothstep, eases in and out of the change
+      double eased = t * t * (3 - 2 * t);
+      int value = (int)std::lround(it->from + (it->to - it->from) * eased);
+      try {
+        if (value != it->device->value()) {
+          it->device->write(value);
+        }
+      } catch (std::exception& e) {
+        context_->logger->error("Fading %s: %s",
+            it->device->name().c_str(), e.what());
+        t = 1.0;
+      }
+      if (t >= 1.0) {
+        if (it->done) {
+          finished.push_back(std::move(it->done));
+        }
+        it = transitions_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    running = transitions_.size();
+  }
+  // outside the lock, these may start new fades
+  for (auto& done : finished) {
+    done();
+  }
+  return running;
+}
+
+void BrightnessFader::run() {
+  const int64_t kFrameNs = 1000000000 / kFrameRate;
+  while (true) {
+    while (sem_wait(&wake_) != 0 && errno == EINTR) {}
+    TimePoint frame;
+    while (step(frame)) {
+      frame += TimeDelta::fromNs(kFrameNs);
+      TimePoint now;
+      if (frame < now) {
+        // fell behind, skip the frames instead of rushing through them
+        frame = now;
+      }
+      struct timespec deadline = frame.timespec();
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+            nullptr) == EINTR) {}
+    }
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include "thread.h"
+#include "time.h"
+#include "sysfs.h"
+#include <functional>
+#include <optional>
+#include <vector>
+
+// Animates brightness changes on its own thread so that no worker waits
+// through a fade. Values are written at kFrameRate through the devices'
+// cached fds, and only when the raw value actually changes. Starting a
+// new fade on a device retargets the one in flight from wherever it got.
+class BrightnessFader : public ThreadBase
+{
+public:
+  static const int kFrameRate = 60;
+  typedef std::function<void()> DoneFunction;
+private:
+  struct Transition {
+    const SysfsDevices::Device* device;
+    int from;
+    int to;
+    TimePoint start;
+    TimeDelta duration;
+    DoneFunction done;
+  };
+  pthread_mutex_t mutex_;
+  sem_t wake_;
+  std::vector<Transition> transitions_;
+protected:
+  void run() override;
+public:
+  BrightnessFader(Context* context);
+  void fade(const SysfsDevices::Device* device, int target,
+      TimeDelta duration, DoneFunction done = {},
+      const TimePoint& now = TimePoint());
+  // Stops a fade where it is, done is not called
+  void cancel(const SysfsDevices::Device* device);
+  // Where the device is heading, if it is fading
+  std::optional<int> target(const SysfsDevices::Device* device);
+  // Writes every fade's value for now and finishes the ones that are
+  // over. Returns how many are still running.
+  size_t step(const TimePoint& now);
+};
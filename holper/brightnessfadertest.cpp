@@ -0,0 +1,76 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "brightnessfader.h"
+#include "filesystem.h"
+#include "context.h"
+#include "logger.h"
+
+namespace {
+  // A fake /sys/class with one backlight going from 0 to 1000
+  class FakeBacklight {
+  public:
+    std::string root;
+    FakeBacklight() {
+      char dir[] = "/tmp/holperfaderXXXXXX";
+      root = mkdtemp(dir);
+      std::string device = root + "/backlight/intel_backlight";
+      mkdir((root + "/backlight").c_str(), 0755);
+      mkdir(device.c_str(), 0755);
+      Fs::write(device + "/max_brightness", "1000\n");
+      Fs::write(device + "/brightness", "0\n");
+    }
+    ~FakeBacklight() {
+      std::string cmd = "rm -rf " + root;
+      EXPECT_EQ(system(cmd.c_str()), 0);
+    }
+  };
+}
+
+TEST(BrightnessFaderTest, fade) {
+  Context context;
+  context.logger = std::make_shared<Logger>(Logger::MUSTFIX);
+  FakeBacklight fake;
+  SysfsDevices sysfs(fake.root);
+  const auto* device = sysfs.backlight();
+  BrightnessFader fader(&context);
+  TimePoint start;
+  int done = 0;
+  fader.fade(device, 1000, 1.0, [&]() { done += 1; }, start);
+  EXPECT_EQ(fader.target(device), 1000);
+  EXPECT_EQ(fader.step(start), 1u);
+  EXPECT_EQ(device->read(), 0);
+  EXPECT_EQ(fader.step(start + 0.5), 1u);
+  EXPECT_EQ(device->read(), 500);
+  // eases in and out, so a quarter of the way is less than a quarter
+  fader.fade(device, 0, 1.0, {}, start + 0.5);
+  EXPECT_EQ(fader.step(start + 0.75), 1u);
+  EXPECT_EQ(device->read(), 500 - 78);
+  EXPECT_EQ(fader.step(start + 2.0), 0u);
+  EXPECT_EQ(device->read(), 0);
+  // retargeted, so the first fade never finished
+  EXPECT_EQ(done, 0);
+  EXPECT_FALSE(fader.target(device));
+}
+
+TEST(BrightnessFaderTest, doneAndCancel) {
+  Context context;
+  context.logger = std::make_shared<Logger>(Logger::MUSTFIX);
+  FakeBacklight fake;
+  SysfsDevices sysfs(fake.root);
+  const auto* device = sysfs.backlight();
+  BrightnessFader fader(&context);
+  TimePoint start;
+  int done = 0;
+  fader.fade(device, 2000, 0.0, [&]() { done += 1; }, start);
+  EXPECT_EQ(fader.target(device), 1000);
+  EXPECT_EQ(fader.step(start), 0u);
+  EXPECT_EQ(device->read(), 1000);
+  EXPECT_EQ(done, 1);
+  fader.fade(device, 0, 1.0, [&]() { done += 1; }, start);
+  EXPECT_EQ(fader.step(start + 0.5), 1u);
+  fader.cancel(device);
+  EXPECT_EQ(fader.step(start + 2.0), 0u);
+  EXPECT_EQ(device->read(), 500);
+  EXPECT_EQ(done, 1);
+}
@@ -68,7 +68,7 @@ int main(int argc, char** argv) {
     return res;
   }
 
-  profiler.event("Read program options");
+  profiler.event(Profiler::READ_OPTIONS);
   rapidjson::Document document;
   auto& alloc = document.GetAllocator();
   rapidjson::Value root(rapidjson::kObjectType);
@@ -109,13 +109,13 @@ int main(int argc, char** argv) {
         buf.GetString(),
         Consts::TerminalColors::DEFAULT,
         socket_path.c_str());
-  profiler.event("Constructed payload");
+  profiler.event(Profiler::CONSTRUCTED_PAYLOAD);
   UnixSocket sock(&context, socket_path);
   sock.connect();
   sock.write(std::string(buf.GetString(), buf.GetSize()));
-  profiler.event("Sent data");
+  profiler.event(Profiler::SENT_DATA);
   auto response = sock.read();
-  profiler.event("Received data");
+  profiler.event(Profiler::RECEIVED_DATA);
   context.logger->info("Received response: %s%s%s",
         Consts::TerminalColors::YELLOW,
         response.c_str(),
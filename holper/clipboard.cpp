@@ -3,14 +3,174 @@
 #include "command.h"
 #include "context.h"
 #include "request.h"
-#include "filesystem.h"
+#include "passwords.h"
 #include "workpool.h"
 #include "subprocess.h"
+#include "subprocessmanager.h"
 #include "logger.h"
+#include "xclipboard.h"
 #include <X11/Xlib.h>
 #include <X11/Xatom.h>
 
-class GeneratePasswordAction : public Action
+namespace {
+  XClipboard::Selection selectionParam(const Parameters& params,
+      const char* name, XClipboard::Selection fallback) {
+    auto value = params.get<std::string_view>(name);
+    if (!value) {
+      return fallback;
+    }
+    auto selection = XClipboard::selectionFromName(*value);
+    if (!selection) {
+      THROW("%.*s is not a valid selection (primary or clipboard)",
+          (int)value->size(), value->data());
+    }
+    return *selection;
+  }
+
+  XClipboard& clipboard(Context* context) {
+    if (!context->clipboard) {
+      THROW("No X display to reach the clipboard through");
+    }
+    return *context->clipboard;
+  }
+}
+
+class ClipboardGetAction : public Action
+{
+public:
+  ClipboardGetAction(Context* context) : Action(context) {}
+  void spec(ParamSpec& spec) const override {
+    spec.param<std::string>("selection", "",
+        "primary (default) or clipboard");
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    auto selection = selectionParam(work->parameters(), "selection",
+        XClipboard::PRIMARY);
+    std::string data = clipboard(context_).get(selection);
+    return rapidjson::Value(data.c_str(), data.size(), work->allocator());
+  }
+};
+
+class ClipboardSetAction : public Action
+{
+public:
+  ClipboardSetAction(Context* context) : Action(context) {}
+  void spec(ParamSpec& spec) const override {
+    spec
+      .param<std::string>("data", "data", "text to store")
+      .param<std::string>("selection", "",
+          "primary (default) or clipboard")
+      .key("data", 1, 1);
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    auto& params = work->parameters();
+    auto selection = selectionParam(params, "selection", XClipboard::PRIMARY);
+    clipboard(context_).set(selection,
+        std::string(*params.get<std::string_view>("data")));
+    return rapidjson::Value("success");
+  }
+};
+
+class ClipboardSyncAction : public Action
+{
+public:
+  ClipboardSyncAction(Context* context) : Action(context) {}
+  void spec(ParamSpec& spec) const override {
+    spec
+      .param<std::string>("data", "source", "text to store in both")
+      .param<std::string>("from", "source",
+          "copy this one (primary by default) to the other")
+      .key("source", 0, 1);
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    auto& params = work->parameters();
+    XClipboard& clip = clipboard(context_);
+    if (auto data = params.get<std::string_view>("data")) {
+      clip.set(XClipboard::PRIMARY, std::string(*data));
+      clip.set(XClipboard::CLIPBOARD, std::string(*data));
+      return rapidjson::Value("success");
+    }
+    auto from = selectionParam(params, "from", XClipboard::PRIMARY);
+    auto to = from == XClipboard::PRIMARY ? XClipboard::CLIPBOARD :
+      XClipboard::PRIMARY;
+    clip.set(to, clip.get(from));
+    return rapidjson::Value("success");
+  }
+};
+
+// Shared by the password and passphrase generators: one result goes to the
+// clipboard as before, many (or print) are returned with their entropy.
+class SecretAction : public Action
+{
+  const TimeDelta kXselTimeout = 5.0;
+  static const int kMaxCount = 100000;
+protected:
+  void outputSpec(ParamSpec& spec) const {
+    spec
+      .param<int>("count", "",
+          St::fmt("how many to generate and print (default 1, max %d)",
+            kMaxCount))
+      .param<std::nullptr_t>("print", "",
+          "print instead of storing in the clipboard");
+  }
+  rapidjson::Value deliver(Work* work, double entropyBits,
+      const std::function<void(std::string&)>& generate) const {
+    auto& params = work->parameters();
+    int count = params.get<int>("count").value_or(1);
+    if (count < 1 || count > kMaxCount) {
+      THROW("count must be between 1 and %d", kMaxCount);
+    }
+    if (count == 1 && !params.get<std::nullptr_t>("print")) {
+      std::string secret;
+      generate(secret);
+      return toClipboard(work, std::move(secret));
+    }
+    // one buffer for all of them, the response copies each out of it
+    std::string buffer;
+    std::vector<size_t> ends;
+    ends.reserve(count);
+    for (int i = 0; i < count; ++i) {
+      generate(buffer);
+      ends.push_back(buffer.size());
+    }
+    auto& alloc = work->allocator();
+    rapidjson::Value list(rapidjson::kArrayType);
+    list.Reserve(count, alloc);
+    size_t start = 0;
+    for (size_t end : ends) {
+      list.PushBack(rapidjson::Value(buffer.data() + start, end - start,
+            alloc), alloc);
+      start = end;
+    }
+    rapidjson::Value val(rapidjson::kObjectType);
+    val.AddMember("entropy_bits", rapidjson::Value(entropyBits), alloc);
+    val.AddMember("results", list, alloc);
+    return val;
+  }
+  rapidjson::Value toClipboard(Work* work, std::string secret) const {
+    if (context_->clipboard) {
+      context_->clipboard->set(XClipboard::CLIPBOARD, std::move(secret));
+      return rapidjson::Value("success");
+    }
+    // the clipboard thread failed to start, xsel may still work
+    auto sp = std::make_shared<Subprocess>(
+        std::vector<std::string>{"/usr/bin/xsel", "--input", "--clipboard"});
+    sp->setInput(std::move(secret));
+    sp->setTimeout(kXselTimeout);
+    context_->subprocesses->watch(work, sp,
+        [](Work*, int status, std::string&, std::string& err) {
+          if (status != 0) {
+            THROW("xsel failed (%d): %s", status, err.c_str());
+          }
+          return std::make_pair(rapidjson::Value("success"), 0);
+        });
+    return rapidjson::Value();
+  }
+public:
+  SecretAction(Context* context) : Action(context) {}
+};
+
+class GeneratePasswordAction : public SecretAction
 {
   const std::string kLower = "abcdefghijklmnopqrstuvwxyz";
   const std::string kUpper = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
@@ -18,7 +178,7 @@ class GeneratePasswordAction : public Action
   const std::string kSpecial = "!@#$%^&*()_+-=";
 public:
   GeneratePasswordAction(Context* context)
-      : Action(context) {}
+      : SecretAction(context) {}
   void spec(ParamSpec& spec) const override {
     auto minmaxspec = [&](const char* name) {
       spec.param<int>(St::fmt("min_%s", name), "", 
@@ -30,107 +190,60 @@ public:
     minmaxspec("upper");
     minmaxspec("numeric");
     minmaxspec("special");
+    outputSpec(spec);
     spec
       .param<int>("length", "length", "password length")
       .key("length", 1, 1);
   }
   rapidjson::Value actOn(Work* work) const override {
     auto& params = work->parameters();
-    auto getordefault = [&](const char* name, int mindef, int maxdef) {
-      std::pair<int,int> vals;
-      auto val = params.get<int>(St::fmt("min_%s", name));
-      if (!val) {
-        vals.first = mindef;
-      } else {
-        vals.first = *val;
-      }
-      val = params.get<int>(St::fmt("max_%s", name));
-      if (!val) {
-        vals.second = maxdef;
-      } else {
-        vals.second = *val;
-      }
-      if (vals.second < vals.first) {
-        vals.first = vals.second;
-      }
-      // since we don't decrement max when we pick from min pool
-      vals.second -= vals.first;
-      return vals;
-    };
     int len = *params.get<int>("length");
-    auto lower = getordefault("lower", 1, len);
-    auto upper = getordefault("upper", 1, len);
-    auto numeric = getordefault("numeric", 1, len);
-    auto special = getordefault("special", 1, len);
-    std::vector<char> result;
-    result.reserve(len);
-
-    std::vector<std::pair<std::pair<int,int>, std::string>> limit_alpha_pairs{
-      {lower, kLower},
-      {upper, kUpper},
-      {numeric, kNumeric},
-      {special, kSpecial}
-    };
-
-    auto getmin = [](auto& limit) -> int& { return limit.first; };
-    auto getmax = [](auto& limit) -> int& { return limit.second; };
-    auto calc_size_for = []
-      (const auto& getter, auto& limit, const auto& alpha) -> int {
-        if (getter(limit)) {
-          return alpha.size();
-        }
-        return 0;
-    };
-    auto process_if_match = [&result]
-      (int& pick, auto& getter, auto& limit, const auto& alpha) {
-        if(pick >= 0 && getter(limit)) {
-          if (pick < (int)alpha.size()) {
-            result.push_back(alpha[pick]);
-            getter(limit)--;
-          }
-          pick -= alpha.size();
-        }
-    };
-    auto iterate = [&](auto& getter) {
-      int len = 0;
-      for (auto& [limit, alpha] : limit_alpha_pairs) {
-        len += calc_size_for(getter, limit, alpha);
-      }
-      unsigned rand;
-      Fs::urandom(4, &rand);
-      int pick = rand % len;
-      for (auto& [limit, alpha] : limit_alpha_pairs) {
-        process_if_match(pick, getter, limit, alpha);
-      }
+    auto charClass = [&](const char* name, const std::string& alphabet) {
+      return PasswordPolicy::CharClass{alphabet,
+        params.get<int>(St::fmt("min_%s", name)).value_or(1),
+        params.get<int>(St::fmt("max_%s", name)).value_or(len)};
     };
+    PasswordPolicy policy(len, {
+      charClass("lower", kLower),
+      charClass("upper", kUpper),
+      charClass("numeric", kNumeric),
+      charClass("special", kSpecial),
+    });
+    return deliver(work, policy.entropyBits(),
+        [&](std::string& out) { policy.generate(out); });
+  }
+};
 
-    int minlens = lower.first + upper.first + numeric.first + special.first;
-    if (minlens > len) {
-      context_->logger->warn("Given min lengths exceed password length");
-    }
-    for (int i=0; i<len; ++i) {
-      if (i < minlens) {
-        // first add min amount of everything
-        iterate(getmin);
-      } else {
-        iterate(getmax);
-      }
-    }
-    std::string password(len, '\0');
-    for (int i=0; i<len; ++i) {
-      unsigned rand;
-      Fs::urandom(4, &rand);
-      int pick = rand % result.size();
-      password[i] = result[pick];
-      result.erase(result.begin() + pick);
-    }
-    Subprocess sp({"/usr/bin/xsel", "--input", "--clipboard"});
-    sp.write(password);
-    {
-      std::string o, e;
-      sp.finish(o,e);
+class GeneratePassphraseAction : public SecretAction
+{
+  const std::string kWordList = "/usr/share/dict/words";
+  const int kDefaultWords = 6;
+public:
+  GeneratePassphraseAction(Context* context)
+      : SecretAction(context) {}
+  void spec(ParamSpec& spec) const override {
+    spec
+      .param<int>("words", "",
+          St::fmt("number of words (default %d)", kDefaultWords))
+      .param<std::string>("separator", "", "between words (default space)")
+      .param<std::string>("wordlist", "",
+          St::fmt("one word per line, e.g. the EFF diceware list (default %s)",
+            kWordList.c_str()));
+    outputSpec(spec);
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    auto& params = work->parameters();
+    int words = params.get<int>("words").value_or(kDefaultWords);
+    if (words < 1 || words > 64) {
+      THROW("words must be between 1 and 64");
     }
-    return rapidjson::Value("success");
+    std::string_view separator =
+      params.get<std::string_view>("separator").value_or(" ");
+    auto list = WordList::load(
+        std::string(params.get<std::string_view>("wordlist")
+          .value_or(kWordList)));
+    return deliver(work, list->entropyBits(words),
+        [&](std::string& out) { list->generate(out, words, separator); });
   }
 };
 
@@ -143,4 +256,20 @@ void ClipboardCommandGroup::initializeCommand(Context* context,
     .setName("genpwd").setName("password")
     .setDescription("Generates a password and stores in clipboard")
     .makeAction<GeneratePasswordAction>(context);
+  (*command->addChild())
+    .setName("passphrase").setName("diceware")
+    .setDescription("Generates a passphrase from a word list")
+    .makeAction<GeneratePassphraseAction>(context);
+  (*command->addChild())
+    .setName("get")
+    .setDescription("Prints the primary selection or the clipboard")
+    .makeAction<ClipboardGetAction>(context);
+  (*command->addChild())
+    .setName("set")
+    .setDescription("Stores text in the primary selection or the clipboard")
+    .makeAction<ClipboardSetAction>(context);
+  (*command->addChild())
+    .setName("sync")
+    .setDescription("Copies one selection to the other, or data to both")
+    .makeAction<ClipboardSyncAction>(context);
 }
@@ -3,6 +3,7 @@
 #include "request.h"
 #include "exception.h"
 #include <set>
+#include <sstream>
 
 Command::Command(Command* parent) : parent_(parent) {}
 
@@ -24,6 +25,11 @@ void Command::validate() {
         children_.empty() ? "nor" : "and"
       );
   }
+  if (action_) {
+    ParamSpec ps;
+    action_->spec(ps);
+    validator_ = std::make_unique<ParamValidator>(ps);
+  }
   for ( auto& child : children_ ) {
     child->validate();
   }
@@ -64,11 +70,37 @@ const Action* Command::action() const {
   return action_.get();
 }
 
-std::string Command::name() const {
+const ParamValidator* Command::validator() const {
+  return validator_.get();
+}
+
+const std::string& Command::name() const {
   return primaryName_;
 }
 
-std::string Command::help() const {
+std::string Command::path() const {
+  if (parent_ == nullptr) {
+    return "";
+  }
+  std::string parentPath = parent_->path();
+  if (parentPath.empty()) {
+    return primaryName_;
+  }
+  return parentPath + " " + primaryName_;
+}
+
+void Command::freeze() {
+  help_ = renderHelp();
+  for ( auto& child : children_ ) {
+    child->freeze();
+  }
+}
+
+const std::string& Command::help() const {
+  return help_;
+}
+
+std::string Command::renderHelp() const {
   std::stringstream ss;
   ss << primaryName_ << ": " << description_ << "\n";
   if (names_.size() > 1) {
@@ -88,9 +120,7 @@ std::string Command::help() const {
     ss << "\n";
   }
   if (action_) {
-    ParamSpec ps(Parameters({}, {}), false);
-    action_->spec(ps);
-    ss << ps.help();
+    ss << validator_->help();
     return ss.str();
   }
   ss << "Subcommands:\n";
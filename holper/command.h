@@ -13,6 +13,7 @@ class Response;
 class Parameters;
 class Work;
 class ParamSpec;
+class ParamValidator;
 
 class Action
 {
@@ -26,12 +27,18 @@ public:
 
 class Command final
 {
+  friend class CommandManager;
   std::list<std::string> names_;
   std::string primaryName_;
   std::string description_;
   std::unique_ptr<Action> action_;
+  std::unique_ptr<ParamValidator> validator_;
   std::list<std::unique_ptr<Command>> children_;
   Command* parent_;
+  std::string help_;
+  uint32_t index_ = 0;
+  std::string renderHelp() const;
+  void freeze();
 public:
   Command(Command* parent);
   void validate();
@@ -45,6 +52,15 @@ public:
   Command* addChild();
   Command* getChild(std::string name);
   const Action* action() const;
-  std::string help() const;
-  std::string name() const;
+  // Only available after validate()
+  const ParamValidator* validator() const;
+  // Rendered once when the command tree is frozen
+  const std::string& help() const;
+  const std::string& name() const;
+  // Names from the root down, e.g. "display brightness"
+  std::string path() const;
+  // Position in the frozen command table
+  uint32_t index() const {
+    return index_;
+  }
 };
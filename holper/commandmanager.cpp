@@ -8,10 +8,14 @@
 #include "music.h"
 #include "display.h"
 #include "request.h"
+#include "exception.h"
 
 void CommandManager::initializeCommand(
     std::function<void(Context*,Command*)> initializer
 ) {
+  if (frozen_) {
+    THROW("Cannot register command groups after freeze");
+  }
   Command* cmd = root_->addChild();
   initializer(context_, cmd);
   cmd->validate();
@@ -23,15 +27,42 @@ CommandManager::CommandManager(Context* context)
     .setDescription("Root command");
 }
 
+void CommandManager::addNode(Command* command) {
+  uint32_t index = nodes_.size();
+  command->index_ = index;
+  nodes_.push_back(command);
+  for ( auto& child : command->children_ ) {
+    for ( const auto& name : child->names_ ) {
+      if (!edges_.insert(std::make_pair(Edge{index, name},
+            (uint32_t)nodes_.size())).second) {
+        THROW("Name %s reused in %s", name.c_str(), command->name().c_str());
+      }
+    }
+    addNode(child.get());
+  }
+}
+
+void CommandManager::freeze() {
+  if (frozen_) {
+    THROW("Command manager is already frozen");
+  }
+  root_->freeze();
+  addNode(root_.get());
+  frozen_ = true;
+}
+
 Command* CommandManager::resolveCommand(
-    const std::vector<std::string> command_tokens) {
-  Command* node = root_.get();
+    const std::vector<std::string_view>& command_tokens) {
+  if (!frozen_) {
+    THROW("Command manager is not frozen yet");
+  }
+  uint32_t node = 0;
   for ( const auto& token : command_tokens ) {
-    Command* child = node->getChild(token);
-    if (!child) {
-      return node;
+    auto it = edges_.find(Edge{node, token});
+    if (it == edges_.end()) {
+      break;
     }
-    node = child;
+    node = it->second;
   }
-  return node;
+  return nodes_[node];
 }
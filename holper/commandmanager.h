@@ -1,6 +1,10 @@
 #pragma once
 #include <functional>
 #include <memory>
+#include <vector>
+#include <string_view>
+#include <unordered_map>
+#include <cstdint>
 
 class Context;
 class Command;
@@ -12,9 +16,27 @@ concept CommandGroup = requires (T) {
 
 class CommandManager
 {
+  // (parent node index, alias) -> child node index
+  struct Edge {
+    uint32_t parent;
+    std::string_view name;
+    bool operator==(const Edge& rhs) const {
+      return parent == rhs.parent && name == rhs.name;
+    }
+  };
+  struct EdgeHash {
+    size_t operator()(const Edge& edge) const {
+      return std::hash<std::string_view>()(edge.name) * 31 + edge.parent;
+    }
+  };
   std::unique_ptr<Command> root_;
   Context* context_;
+  // Built by freeze(), nodes_[0] is root_
+  std::vector<Command*> nodes_;
+  std::unordered_map<Edge, uint32_t, EdgeHash> edges_;
+  bool frozen_ = false;
   void initializeCommand(std::function<void(Context*,Command*)> initializer);
+  void addNode(Command* command);
 public:
   CommandManager(Context* context);
   ~CommandManager() {}
@@ -22,8 +44,18 @@ public:
   void registerCommandGroup() {
     initializeCommand(T::initializeCommand);
   }
-  Command* resolveCommand(const std::vector<std::string> command_tokens);
+  // Called once all command groups are registered, renders help texts and
+  // builds the lookup table used by resolveCommand
+  void freeze();
+  Command* resolveCommand(const std::vector<std::string_view>& command_tokens);
   const Command* root() {
     return root_.get();
   }
+  // Frozen command table, indexed by Command::index()
+  size_t size() const {
+    return nodes_.size();
+  }
+  const Command* node(uint32_t index) const {
+    return nodes_.at(index);
+  }
 };
@@ -0,0 +1,62 @@
+#include <gtest/gtest.h>
+#include "commandmanager.h"
+#include "command.h"
+#include "request.h"
+
+namespace {
+  class NoopAction : public Action
+  {
+  public:
+    NoopAction() : Action(nullptr) {}
+    void spec(ParamSpec& spec) const override {
+      spec.param<int>("set", "", "sets value");
+    }
+    rapidjson::Value actOn(Work*) const override {
+      return rapidjson::Value();
+    }
+  };
+
+  struct TestCommandGroup {
+    static void initializeCommand(Context* UNUSED(context), Command* command) {
+      (*command)
+        .setName("group").setName("grp")
+        .setDescription("Test group");
+      (*command->addChild())
+        .setName("first").setName("1")
+        .setDescription("First command")
+        .makeAction<NoopAction>();
+      (*command->addChild())
+        .setName("second")
+        .setDescription("Second command")
+        .makeAction<NoopAction>();
+    }
+  };
+}
+
+TEST(CommandManagerTest, resolve) {
+  CommandManager manager(nullptr);
+  manager.registerCommandGroup<TestCommandGroup>();
+  EXPECT_ANY_THROW(manager.resolveCommand({"group"}));
+  manager.freeze();
+  EXPECT_ANY_THROW(manager.registerCommandGroup<TestCommandGroup>());
+  EXPECT_EQ(manager.resolveCommand({}), manager.root());
+  EXPECT_EQ(manager.resolveCommand({"nope"}), manager.root());
+  Command* group = manager.resolveCommand({"grp"});
+  EXPECT_EQ(group->name(), "group");
+  EXPECT_EQ(manager.resolveCommand({"group", "nope", "first"}), group);
+  Command* first = manager.resolveCommand({"group", "1"});
+  EXPECT_EQ(first->name(), "first");
+  EXPECT_EQ(manager.resolveCommand({"grp", "first", "extra"}), first);
+  EXPECT_EQ(manager.resolveCommand({"group", "second"})->name(), "second");
+}
+
+TEST(CommandManagerTest, help) {
+  CommandManager manager(nullptr);
+  manager.registerCommandGroup<TestCommandGroup>();
+  manager.freeze();
+  const std::string& help = manager.resolveCommand({"group"})->help();
+  EXPECT_NE(help.find("first: First command"), std::string::npos);
+  EXPECT_EQ(&help, &manager.resolveCommand({"grp"})->help());
+  EXPECT_NE(manager.resolveCommand({"group", "first"})->help().find(
+        "set:VALUE(number)"), std::string::npos);
+}
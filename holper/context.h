@@ -6,6 +6,18 @@ class Logger;
 class Server;
 class WorkPool;
 class CommandManager;
+class FlightRecorder;
+class LatencyStats;
+class TraceRecorder;
+class SamplingProfiler;
+class Metrics;
+class SlowRequests;
+class SubprocessManager;
+class XClipboard;
+class SysfsDevices;
+class SysfsWatcher;
+class BrightnessFader;
+class PulseClient;
 class Resolver;
 class Responder;
 
@@ -21,6 +33,18 @@ struct Context {
   std::shared_ptr<Server> server;
   std::shared_ptr<WorkPool> workPool;
   std::shared_ptr<CommandManager> commandManager;
+  std::shared_ptr<FlightRecorder> flightRecorder;
+  std::shared_ptr<LatencyStats> latency;
+  std::shared_ptr<TraceRecorder> trace;
+  std::shared_ptr<SamplingProfiler> sampler;
+  std::shared_ptr<Metrics> metrics;
+  std::shared_ptr<SlowRequests> slowRequests;
+  std::shared_ptr<SubprocessManager> subprocesses;
+  std::shared_ptr<XClipboard> clipboard;
+  std::shared_ptr<SysfsDevices> sysfs;
+  std::shared_ptr<SysfsWatcher> sysfsWatcher;
+  std::shared_ptr<BrightnessFader> fader;
+  std::shared_ptr<PulseClient> pulse;
   Stats stats;
   Context() {}
 };
@@ -7,7 +7,8 @@
 #include "request.h"
 #include "exception.h"
 #include "workpool.h"
-#include "filesystem.h"
+#include "sysfs.h"
+#include "brightnessfader.h"
 #include <algorithm>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
@@ -15,8 +16,34 @@
 #include <X11/extensions/dpms.h>
 #include <typeinfo>
 
+namespace {
+  // The device named by the device parameter, or fallback
+  const SysfsDevices::Device& device(Context* context,
+      const Parameters& params, const char* what,
+      const SysfsDevices::Device* (SysfsDevices::*fallback)() const) {
+    if (!context->sysfs) {
+      THROW("Sysfs devices were not scanned");
+    }
+    const SysfsDevices::Device* device;
+    if (auto name = params.get<std::string_view>("device")) {
+      device = context->sysfs->find(*name);
+      if (!device) {
+        THROW("No brightness device named %.*s", (int)name->size(),
+            name->data());
+      }
+    } else {
+      device = (context->sysfs.get()->*fallback)();
+      if (!device) {
+        THROW("No %s found", what);
+      }
+    }
+    return *device;
+  }
+
+  const char* kDeviceHelp = "sysfs device name (see display devices)";
+}
+
 class BrightnessChangeAction : public Action {
-  const std::string kBrightnessPath = "/sys/class/backlight/amdgpu_bl1";
   void setScreenPower(bool val) const {
     context_->logger->info("Turning display %s", val ? "on" : "off");
     Display *dpy = XOpenDisplay(NULL);
@@ -42,26 +69,54 @@ public:
   BrightnessChangeAction(Context* context) : Action(context) {}
   rapidjson::Value actOn(Work* work) const override {
     auto& params = work->parameters();
-    // TODO: helpers for reading sys files
-    int max_raw_brightness, raw_brightness;
-    Fs::parse(kBrightnessPath + "/max_brightness", "%d", &max_raw_brightness);
-    Fs::parse(kBrightnessPath + "/brightness", "%d", &raw_brightness);
+    const auto& backlight = device(context_, params, "backlight",
+        &SysfsDevices::backlight);
+    int max_raw_brightness = backlight.max();
+    int raw_brightness = backlight.value();
     float brightness = raw_brightness * 1.0f / max_raw_brightness;
+    if (!params.get<int>("incr") && !params.get<int>("set")) {
+      rapidjson::Value val(rapidjson::kObjectType);
+      val.AddMember("brightness", rapidjson::Value(brightness),
+          work->allocator());
+      return val;
+    }
+    auto& fader = context_->fader;
+    int duration_ms = std::max(params.get<int>("duration").value_or(0), 0);
     float new_brightness = brightness;
     if (auto incr = params.get<int>("incr")) {
+      // steps during a fade count from where it is heading
+      if (auto target = fader ? fader->target(&backlight) : std::nullopt) {
+        new_brightness = *target * 1.0f / max_raw_brightness;
+      }
       new_brightness += *incr * 0.01f;
     } else if (auto set = params.get<int>("set")) {
       new_brightness = *set * 0.01f;
     }
     new_brightness = std::clamp(new_brightness, 0.0f, 1.0f);
+    bool power_off = false;
     if (brightness < 0.001f && new_brightness > brightness) {
       setScreenPower(true);
     } else if (new_brightness < .001f && new_brightness < (brightness + 0.001f)) {
       new_brightness = 0.0f;
-      setScreenPower(false);
+      power_off = true;
+    }
+    int new_raw_brightness = new_brightness * max_raw_brightness;
+    if (fader && duration_ms > 0) {
+      BrightnessFader::DoneFunction done;
+      if (power_off) {
+        done = [this]() { setScreenPower(false); };
+      }
+      fader->fade(&backlight, new_raw_brightness,
+          TimeDelta::fromNs(duration_ms * 1000000ll), std::move(done));
+    } else {
+      if (fader) {
+        fader->cancel(&backlight);
+      }
+      if (power_off) {
+        setScreenPower(false);
+      }
+      backlight.write(new_raw_brightness);
     }
-    raw_brightness = new_brightness * max_raw_brightness;
-    Fs::dump(kBrightnessPath + "/brightness", "%d", raw_brightness);
     rapidjson::Value val(rapidjson::kObjectType);
     val.AddMember("old_brightness",
         rapidjson::Value(brightness),
@@ -76,12 +131,13 @@ public:
     spec
       .param<int>("set", "operations", "sets brightness to value")
       .param<int>("incr", "operations", "increments brightness by value")
-      .key("operations", 1, 1);
+      .param<int>("duration", "", "fades over this many milliseconds")
+      .param<std::string>("device", "", kDeviceHelp)
+      .key("operations", 0, 1);
   }
 };
 
 class KeyboardBacklightAction : public Action {
-  const std::string kPath = "/sys/class/leds/tpacpi::kbd_backlight";
 public:
   KeyboardBacklightAction(Context* context) : Action(context) {}
   void spec(ParamSpec& spec) const override {
@@ -97,15 +153,26 @@ public:
       .param<std::nullptr_t>("toggle", "operations", help("toggles", ""))
       .param<int>("set", "operations", help("sets", "to value"))
       .param<int>("incr", "operations", help("increments ", "by value"))
-      .key("operations", 1, 1);
+      .param<std::string>("device", "", kDeviceHelp)
+      .key("operations", 0, 1);
   }
 
   rapidjson::Value actOn(Work* work) const override {
     auto& params = work->parameters();
-    int max_brightness, brightness;
-    Fs::parse(kPath + "/max_brightness", "%d", &max_brightness);
-    Fs::parse(kPath + "/brightness", "%d", &brightness);
+    const auto& led = device(context_, params, "keyboard backlight",
+        &SysfsDevices::keyboardBacklight);
+    int max_brightness = led.max();
+    int brightness = led.value();
     rapidjson::Value val(rapidjson::kObjectType);
+    bool change = params.get<std::nullptr_t>("on") ||
+      params.get<std::nullptr_t>("off") ||
+      params.get<std::nullptr_t>("toggle") ||
+      params.get<int>("set") || params.get<int>("incr");
+    if (!change) {
+      val.AddMember("brightness", rapidjson::Value(brightness),
+          work->allocator());
+      return val;
+    }
     val.AddMember("old_brightness",
         rapidjson::Value(brightness),
         work->allocator());
@@ -121,7 +188,7 @@ public:
       brightness += *val;
       brightness = std::clamp(brightness, 0, max_brightness);
     }
-    Fs::dump(kPath + "/brightness", "%d", brightness);
+    led.write(brightness);
     val.AddMember("new_brightness",
         rapidjson::Value(brightness),
         work->allocator());
@@ -129,6 +196,32 @@ public:
   }
 };
 
+class DevicesAction : public Action {
+public:
+  DevicesAction(Context* context) : Action(context) {}
+  void spec(ParamSpec& UNUSED(spec)) const override {}
+  rapidjson::Value actOn(Work* work) const override {
+    if (!context_->sysfs) {
+      THROW("Sysfs devices were not scanned");
+    }
+    auto& alloc = work->allocator();
+    rapidjson::Value val(rapidjson::kArrayType);
+    for (const auto& device : context_->sysfs->devices()) {
+      rapidjson::Value entry(rapidjson::kObjectType);
+      entry.AddMember("name", rapidjson::Value(device->name().c_str(),
+            device->name().size(), alloc), alloc);
+      entry.AddMember("kind", rapidjson::StringRef(
+            device->kind() == SysfsDevices::BACKLIGHT ? "backlight" : "led"),
+          alloc);
+      entry.AddMember("brightness", rapidjson::Value(device->value()), alloc);
+      entry.AddMember("max_brightness", rapidjson::Value(device->max()),
+          alloc);
+      val.PushBack(entry, alloc);
+    }
+    return val;
+  }
+};
+
 void DisplayCommandGroup::initializeCommand(Context* context,
     Command* command) {
   (*command)
@@ -142,4 +235,8 @@ void DisplayCommandGroup::initializeCommand(Context* context,
     .setName("keyboard_backlight").setName("kbl")
     .setDescription("Keyboard backlight operations")
     .makeAction<KeyboardBacklightAction>(context);
+  (*command->addChild())
+    .setName("devices")
+    .setDescription("Lists backlights and LEDs with their brightness")
+    .makeAction<DevicesAction>(context);
 }
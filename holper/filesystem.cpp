@@ -8,20 +8,11 @@
 #include <fcntl.h>
 #include <unistd.h>
 
-void Filesystem::urandom(int len, void* data) {
-  int fd = open("/dev/urandom", O_RDONLY);
-  ssize_t readlen = ::read(fd, data, len);
-  if(readlen < len) {
-    if(readlen < 0) {
-      THROW("Could not read /dev/urandom: %s", St::errorString().c_str());
-    }
-    THROW("Could not read enough data (%ld/%ld)", readlen, len);
-  }
-  close(fd);
-}
-
 std::string Filesystem::read(const std::string& path) {
   FILE* f = fopen(path.c_str(), "re");
+  if (!f) {
+    THROW("Could not open %s: %s", path.c_str(), St::errorString().c_str());
+  }
   fseek(f, 0, SEEK_END);
   long size = ftell(f);
   std::string buf(size, '\0');
@@ -33,6 +24,9 @@ std::string Filesystem::read(const std::string& path) {
 
 int Filesystem::parse(const std::string& path, const char* format, ...) {
   FILE* f = fopen(path.c_str(), "re");
+  if (!f) {
+    THROW("Could not open %s: %s", path.c_str(), St::errorString().c_str());
+  }
   va_list args;
   va_start(args, format);
   int res = vfscanf(f, format, args);
@@ -43,6 +37,9 @@ int Filesystem::parse(const std::string& path, const char* format, ...) {
 
 int Filesystem::dump(const std::string& path, const char* format, ...) {
   FILE* f = fopen(path.c_str(), "we");
+  if (!f) {
+    THROW("Could not open %s: %s", path.c_str(), St::errorString().c_str());
+  }
   va_list args;
   va_start(args, format);
   int res = vfprintf(f, format, args);
@@ -50,3 +47,22 @@ int Filesystem::dump(const std::string& path, const char* format, ...) {
   fclose(f);
   return res;
 }
+
+void Filesystem::write(const std::string& path, const std::string& data) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    THROW("Could not open %s: %s", path.c_str(), St::errorString().c_str());
+  }
+  size_t written = 0;
+  while (written < data.size()) {
+    ssize_t r = ::write(fd, data.data() + written, data.size() - written);
+    if (r < 0) {
+      int err = errno;
+      close(fd);
+      THROW("Could not write %s: %s", path.c_str(),
+          St::errorString(err).c_str());
+    }
+    written += r;
+  }
+  close(fd);
+}
@@ -3,9 +3,10 @@
 
 namespace Filesystem {
   std::string read(const std::string& path);
-  void urandom(int len, void* data);
   int parse(const std::string& path, const char* format, ...);
   int dump(const std::string& path, const char* format, ...);
+  // Replaces the file's contents, throws on failure
+  void write(const std::string& path, const std::string& data);
 }
 
 namespace Fs = Filesystem;
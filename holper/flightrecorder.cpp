@@ -0,0 +1,124 @@
+#include "flightrecorder.h"
+#include <algorithm>
+#include <unistd.h>
+
+namespace {
+  thread_local int currentRequestId = 0;
+  struct ThreadInfo {
+    pid_t tid = 0;
+    char name[16];
+  };
+  const ThreadInfo& threadInfo() {
+    thread_local ThreadInfo info;
+    if (!info.tid) {
+      info.tid = gettid();
+      pthread_getname_np(pthread_self(), info.name, sizeof(info.name));
+    }
+    return info;
+  }
+}
+
+FlightRecorder::RequestScope::RequestScope(int requestId)
+    : previous_(currentRequestId) {
+  currentRequestId = requestId;
+}
+
+FlightRecorder::RequestScope::~RequestScope() {
+  currentRequestId = previous_;
+}
+
+int FlightRecorder::requestId() {
+  return currentRequestId;
+}
+
+FlightRecorder::FlightRecorder(size_t size, int level)
+    : head_(0), level_(level) {
+  size_t capacity = 1;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+  entries_ = std::vector<Entry>(capacity);
+  for (auto& entry : entries_) {
+    entry.seq.store(0, std::memory_order_relaxed);
+  }
+  mask_ = capacity - 1;
+}
+
+FlightRecorder::Entry& FlightRecorder::begin(u64& index) {
+  index = head_.fetch_add(1, std::memory_order_relaxed);
+  Entry& entry = entries_[index & mask_];
+  // odd while being written
+  entry.seq.store(2 * index + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  const ThreadInfo& info = threadInfo();
+  entry.requestId = currentRequestId;
+  entry.tid = info.tid;
+  memcpy(entry.threadName, info.name, sizeof(entry.threadName));
+  clock_gettime(CLOCK_REALTIME, &entry.record.time);
+  return entry;
+}
+
+void FlightRecorder::end(Entry& entry, u64 index) {
+  entry.seq.store(2 * index + 2, std::memory_order_release);
+}
+
+void FlightRecorder::record(int level, const char* message, size_t length) {
+  u64 index;
+  Entry& entry = begin(index);
+  entry.record.level = level;
+  LogArgs::setText(entry.record, message, length);
+  end(entry, index);
+}
+
+void FlightRecorder::recordEvent(int requestId, const TimePoint& time,
+    const char* prefix, const char* name) {
+  u64 index;
+  Entry& entry = begin(index);
+  entry.requestId = requestId;
+  entry.record.time = (RealTimePoint() + (time - TimePoint())).timespec();
+  entry.record.level = kProfilerEvent;
+  int len = snprintf(entry.record.message, LogRecord::kMessageSize, "%s%s",
+      prefix, name);
+  entry.record.format = nullptr;
+  entry.record.length = std::clamp(len, 0, (int)LogRecord::kMessageSize - 1);
+  end(entry, index);
+}
+
+std::vector<FlightRecorder::Line> FlightRecorder::query(
+    const Filter& filter) const {
+  std::vector<Line> lines;
+  std::vector<char> scratch;
+  u64 head = head_.load(std::memory_order_acquire);
+  u64 first = head > entries_.size() ? head - entries_.size() : 0;
+  // newest first so that limit keeps the latest lines
+  for (u64 index = head; index > first && lines.size() < filter.limit;) {
+    --index;
+    const Entry& entry = entries_[index & mask_];
+    u64 seq = entry.seq.load(std::memory_order_acquire);
+    if (seq != 2 * index + 2) {
+      continue;
+    }
+    int requestId = entry.requestId;
+    pid_t tid = entry.tid;
+    char threadName[sizeof(entry.threadName)];
+    memcpy(threadName, entry.threadName, sizeof(threadName));
+    LogRecord record;
+    memcpy((void*)&record, (const void*)&entry.record, sizeof(record));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (entry.seq.load(std::memory_order_relaxed) != seq) {
+      continue;
+    }
+    threadName[sizeof(threadName) - 1] = '\0';
+    if ((filter.requestId && *filter.requestId != requestId) ||
+        (filter.minLevel && *filter.minLevel > record.level) ||
+        (filter.thread && *filter.thread != threadName)) {
+      continue;
+    }
+    size_t length;
+    const char* text = LogArgs::text(record, scratch, length);
+    lines.push_back(Line{record.time, record.level, requestId, tid,
+        threadName, std::string(text, length)});
+  }
+  std::reverse(lines.begin(), lines.end());
+  return lines;
+}
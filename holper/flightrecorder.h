@@ -0,0 +1,73 @@
+#pragma once
+#include <atomic>
+#include <optional>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "holper.h"
+#include "logrecord.h"
+#include "time.h"
+
+// Keeps the last N log records and profiler events in fixed memory so they
+// can be queried from the daemon after the fact. Writers claim slots with a
+// single atomic increment and publish them with a sequence number; readers
+// skip slots that are being rewritten while they copy them.
+class FlightRecorder
+{
+public:
+  static constexpr int kProfilerEvent = -1;
+  struct Entry {
+    std::atomic<u64> seq;
+    int requestId;
+    pid_t tid;
+    char threadName[16];
+    LogRecord record;
+  };
+  struct Filter {
+    std::optional<int> requestId;
+    std::optional<int> minLevel;
+    std::optional<std::string> thread;
+    size_t limit = 100;
+  };
+  struct Line {
+    struct timespec time;
+    int level;
+    int requestId;
+    pid_t tid;
+    std::string thread;
+    std::string message;
+  };
+  // Attributes everything logged by this thread to a request while alive
+  class RequestScope {
+    int previous_;
+  public:
+    explicit RequestScope(int requestId);
+    ~RequestScope();
+  };
+private:
+  std::vector<Entry> entries_;
+  size_t mask_;
+  std::atomic<u64> head_;
+  int level_;
+  Entry& begin(u64& index);
+  void end(Entry& entry, u64 index);
+public:
+  FlightRecorder(size_t size, int level);
+  bool accepts(int level) const {
+    return level >= level_;
+  }
+  template <typename... Args>
+  void capture(int level, const char* fmt, Args... args) {
+    u64 index;
+    Entry& entry = begin(index);
+    entry.record.level = level;
+    LogArgs::capture(entry.record, fmt, args...);
+    end(entry, index);
+  }
+  void record(int level, const char* message, size_t length);
+  void recordEvent(int requestId, const TimePoint& time, const char* prefix,
+      const char* name);
+  // Oldest first, at most filter.limit of the newest matching lines
+  std::vector<Line> query(const Filter& filter) const;
+  static int requestId();
+};
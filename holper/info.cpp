@@ -6,7 +6,20 @@
 #include "context.h"
 #include "exception.h"
 #include "workpool.h"
+#include "logger.h"
+#include "flightrecorder.h"
+#include "latency.h"
+#include "trace.h"
+#include "sampler.h"
+#include "openmetrics.h"
+#include "slowrequests.h"
+#include "thread.h"
+#include "filesystem.h"
+#include <cstdlib>
+#include <unistd.h>
+#include "commandmanager.h"
 #include <rapidjson/document.h>
+#include <map>
 
 class StatsAction : public Action
 {
@@ -24,11 +37,309 @@ public:
     st = context_->stats.startTime.str();
     val.AddMember("uptime",
         rapidjson::Value(st.c_str(), st.size(), alloc), alloc);
+    val.AddMember("log_drops",
+        rapidjson::Value((uint64_t)context_->logger->dropped()), alloc);
     return val;
   }
   StatsAction(Context* context) : Action(context) {}
 };
 
+class LogsAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec
+      .param<int>("request", "", "only lines logged while serving this request")
+      .param<std::string>("level", "",
+          "minimum level (debug, info, warn, mustfix, error, fatal)")
+      .param<std::string>("thread", "", "only lines from this thread")
+      .param<int>("count", "", "number of newest lines to return (default 100)");
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    if (!context_->flightRecorder) {
+      THROW("Flight recorder is not enabled");
+    }
+    auto& params = work->parameters();
+    auto& alloc = work->allocator();
+    FlightRecorder::Filter filter;
+    filter.requestId = params.get<int>("request");
+    if (auto level = params.get<std::string_view>("level")) {
+      auto parsed = Logger::levelFromName(*level);
+      if (!parsed) {
+        THROW("Unknown log level %.*s", (int)level->size(), level->data());
+      }
+      filter.minLevel = *parsed;
+    }
+    if (auto thread = params.get<std::string_view>("thread")) {
+      filter.thread = std::string(*thread);
+    }
+    if (auto count = params.get<int>("count")) {
+      if (*count <= 0) {
+        THROW("count must be positive: %d", *count);
+      }
+      filter.limit = *count;
+    }
+    rapidjson::Value val(rapidjson::kArrayType);
+    for (const auto& line : context_->flightRecorder->query(filter)) {
+      rapidjson::Value entry(rapidjson::kObjectType);
+      std::string st = RealTimePoint(line.time).str();
+      entry.AddMember("time",
+          rapidjson::Value(st.c_str(), st.size(), alloc), alloc);
+      entry.AddMember("level",
+          rapidjson::StringRef(Logger::levelName(line.level)), alloc);
+      entry.AddMember("request", line.requestId, alloc);
+      entry.AddMember("thread", rapidjson::Value(line.thread.c_str(),
+            line.thread.size(), alloc), alloc);
+      entry.AddMember("tid", (int)line.tid, alloc);
+      entry.AddMember("message", rapidjson::Value(line.message.c_str(),
+            line.message.size(), alloc), alloc);
+      val.PushBack(entry, alloc);
+    }
+    return val;
+  }
+  LogsAction(Context* context) : Action(context) {}
+};
+
+class LatencyAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec.param<std::string>("command", "",
+        "only this command, e.g. \"display brightness\"");
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    if (!context_->latency) {
+      THROW("Latency stats are not enabled");
+    }
+    auto& alloc = work->allocator();
+    auto only = work->parameters().get<std::string_view>("command");
+    rapidjson::Value val(rapidjson::kObjectType);
+    auto micros = [](u64 ns) {
+      return rapidjson::Value(ns / 1000.0);
+    };
+    for (size_t i = 0; i < context_->commandManager->size(); ++i) {
+      const Command* command = context_->commandManager->node(i);
+      std::string path = command->path();
+      if (only && *only != path) {
+        continue;
+      }
+      auto summaries = context_->latency->summary(i);
+      if (summaries.empty()) {
+        continue;
+      }
+      rapidjson::Value stages(rapidjson::kObjectType);
+      for (const auto& summary : summaries) {
+        rapidjson::Value stage(rapidjson::kObjectType);
+        stage.AddMember("count", rapidjson::Value((uint64_t)summary.count),
+            alloc);
+        stage.AddMember("p50_us", micros(summary.p50), alloc);
+        stage.AddMember("p99_us", micros(summary.p99), alloc);
+        stage.AddMember("max_us", micros(summary.max), alloc);
+        stages.AddMember(
+            rapidjson::StringRef(LatencyStats::stageName(summary.stage)),
+            stage, alloc);
+      }
+      val.AddMember(rapidjson::Value(path.c_str(), path.size(), alloc),
+          stages, alloc);
+    }
+    return val;
+  }
+  LatencyAction(Context* context) : Action(context) {}
+};
+
+class TraceStartAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec.param<int>("limit", "",
+        "maximum number of requests to keep (default 10000)");
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    int limit = 10000;
+    if (auto val = work->parameters().get<int>("limit")) {
+      if (*val <= 0) {
+        THROW("limit must be positive: %d", *val);
+      }
+      limit = *val;
+    }
+    context_->trace->start(limit);
+    return rapidjson::Value("Tracing started");
+  }
+  TraceStartAction(Context* context) : Action(context) {}
+};
+
+namespace {
+  // A file in the user's runtime directory, which only they can write to
+  std::string runtimeFile(const char* name, const char* extension) {
+    const char* dir = getenv("XDG_RUNTIME_DIR");
+    std::string path = dir && *dir ? dir : St::fmt("/run/user/%d", getuid());
+    return path + St::fmt("/holper-%s-%d.%s", name, getpid(), extension);
+  }
+}
+
+class TraceStopAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec.param<std::string>("path", "",
+        "where to write the trace (default "
+        "$XDG_RUNTIME_DIR/holper-trace-PID.json), "
+        "run again with another path if writing fails");
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    auto& alloc = work->allocator();
+    std::string path = runtimeFile("trace", "json");
+    if (auto val = work->parameters().get<std::string_view>("path")) {
+      path = *val;
+    }
+    auto result = context_->trace->stop();
+    try {
+      Fs::write(path, result.json);
+    } catch (std::exception&) {
+      context_->trace->keep(std::move(result));
+      throw;
+    }
+    rapidjson::Value val(rapidjson::kObjectType);
+    val.AddMember("path",
+        rapidjson::Value(path.c_str(), path.size(), alloc), alloc);
+    val.AddMember("requests", rapidjson::Value((uint64_t)result.requests),
+        alloc);
+    val.AddMember("dropped", rapidjson::Value((uint64_t)result.dropped),
+        alloc);
+    return val;
+  }
+  TraceStopAction(Context* context) : Action(context) {}
+};
+
+class ProfileStartAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec
+      .param<int>("hz", "",
+          "samples per second of CPU time, capped by the kernel tick "
+          "(default 99)")
+      .param<int>("limit", "",
+          "maximum number of samples to keep (default 100000)");
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    auto& params = work->parameters();
+    int hz = params.get<int>("hz").value_or(99);
+    int limit = params.get<int>("limit").value_or(100000);
+    if (limit <= 0) {
+      THROW("limit must be positive: %d", limit);
+    }
+    context_->sampler->start(hz, limit);
+    return rapidjson::Value("Profiling started");
+  }
+  ProfileStartAction(Context* context) : Action(context) {}
+};
+
+class ProfileStopAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec.param<std::string>("path", "",
+        "where to write folded stacks (default "
+        "$XDG_RUNTIME_DIR/holper-profile-PID.folded), "
+        "run again with another path if writing fails");
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    auto& alloc = work->allocator();
+    std::string path = runtimeFile("profile", "folded");
+    if (auto val = work->parameters().get<std::string_view>("path")) {
+      path = *val;
+    }
+    auto result = context_->sampler->stop();
+    try {
+      Fs::write(path, result.folded);
+    } catch (std::exception&) {
+      context_->sampler->keep(std::move(result));
+      throw;
+    }
+    rapidjson::Value val(rapidjson::kObjectType);
+    val.AddMember("path",
+        rapidjson::Value(path.c_str(), path.size(), alloc), alloc);
+    val.AddMember("samples", rapidjson::Value((uint64_t)result.samples),
+        alloc);
+    val.AddMember("dropped", rapidjson::Value((uint64_t)result.dropped),
+        alloc);
+    return val;
+  }
+  ProfileStopAction(Context* context) : Action(context) {}
+};
+
+class MetricsAction : public Action
+{
+public:
+  void spec(ParamSpec& UNUSED(spec)) const override {
+    return;
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    // Kept per worker thread so that scrapes reuse the grown buffer
+    thread_local std::string buffer;
+    buffer.clear();
+    OpenMetrics::render(buffer, context_);
+    return rapidjson::Value(buffer.c_str(), buffer.size(), work->allocator());
+  }
+  MetricsAction(Context* context) : Action(context) {}
+};
+
+class SlowAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec.param<int>("count", "", "number of newest requests (default 10)");
+  }
+  rapidjson::Value actOn(Work* work) const override {
+    if (!context_->slowRequests) {
+      THROW("Slow request retention is not enabled");
+    }
+    auto& alloc = work->allocator();
+    int count = work->parameters().get<int>("count").value_or(10);
+    if (count <= 0) {
+      THROW("count must be positive: %d", count);
+    }
+    auto string = [&](const std::string& st) {
+      return rapidjson::Value(st.c_str(), st.size(), alloc);
+    };
+    std::map<pid_t, std::string> threads;
+    rapidjson::Value val(rapidjson::kArrayType);
+    for (const auto& entry : context_->slowRequests->list(count)) {
+      rapidjson::Value request(rapidjson::kObjectType);
+      request.AddMember("request", entry.requestId, alloc);
+      request.AddMember("command", string(entry.command), alloc);
+      request.AddMember("code", entry.code, alloc);
+      request.AddMember("total_ms", entry.totalNs / 1e6, alloc);
+      request.AddMember("finished", string(entry.finished.str()), alloc);
+      rapidjson::Value params(rapidjson::kObjectType);
+      for (const auto& [name, value] : entry.parameters) {
+        params.AddMember(string(name), string(value), alloc);
+      }
+      request.AddMember("parameters", params, alloc);
+      rapidjson::Value events(rapidjson::kArrayType);
+      TimePoint start = entry.profiler.start();
+      entry.profiler.forEach([&](const TimePoint& time, pid_t tid,
+            const char* prefix, const char* name) {
+        auto thread = threads.find(tid);
+        if (thread == threads.end()) {
+          thread = threads.emplace(tid, ThreadBase::threadName(tid)).first;
+        }
+        rapidjson::Value event(rapidjson::kObjectType);
+        event.AddMember("event", string(std::string(prefix) + name), alloc);
+        event.AddMember("ms", (time - start).ns() / 1e6, alloc);
+        event.AddMember("tid", (int)tid, alloc);
+        event.AddMember("thread", string(thread->second), alloc);
+        events.PushBack(event, alloc);
+      });
+      request.AddMember("events", events, alloc);
+      val.PushBack(request, alloc);
+    }
+    return val;
+  }
+  SlowAction(Context* context) : Action(context) {}
+};
+
 void InfoCommandGroup::initializeCommand(Context* context,
     Command* command)
 {
@@ -39,4 +350,45 @@ void InfoCommandGroup::initializeCommand(Context* context,
     .setName("stats")
     .setDescription("Internal stats")
     .makeAction<StatsAction>(context);
+  (*command->addChild())
+    .setName("logs")
+    .setDescription("Recent log lines and profiler events kept in memory")
+    .makeAction<LogsAction>(context);
+  (*command->addChild())
+    .setName("latency")
+    .setDescription("Per stage latency percentiles for each command")
+    .makeAction<LatencyAction>(context);
+  (*command->addChild())
+    .setName("slow")
+    .setDescription("Timelines of the latest requests slower than the "
+        "threshold or the p99")
+    .makeAction<SlowAction>(context);
+  (*command->addChild())
+    .setName("metrics")
+    .setDescription("All metrics in the OpenMetrics text format")
+    .makeAction<MetricsAction>(context);
+  Command* trace = command->addChild();
+  (*trace)
+    .setName("trace")
+    .setDescription("Capture request timelines as Chrome trace JSON");
+  (*trace->addChild())
+    .setName("start")
+    .setDescription("Start keeping the profiles of finished requests")
+    .makeAction<TraceStartAction>(context);
+  (*trace->addChild())
+    .setName("stop")
+    .setDescription("Stop and write the captured requests to a file")
+    .makeAction<TraceStopAction>(context);
+  Command* profile = command->addChild();
+  (*profile)
+    .setName("profile")
+    .setDescription("Sample the daemon's threads into folded stacks");
+  (*profile->addChild())
+    .setName("start")
+    .setDescription("Start sampling every thread by CPU time")
+    .makeAction<ProfileStartAction>(context);
+  (*profile->addChild())
+    .setName("stop")
+    .setDescription("Stop and write folded stacks for flamegraph.pl")
+    .makeAction<ProfileStopAction>(context);
 }
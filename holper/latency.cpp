@@ -0,0 +1,92 @@
+#include "latency.h"
+#include "exception.h"
+
+namespace {
+struct StageSpan {
+  LatencyStats::Stage stage;
+  // EVENT_COUNT stands for the start of the request
+  Profiler::Event from;
+  Profiler::Event to;
+};
+
+const StageSpan kStageSpans[] = {
+  {LatencyStats::ACCEPT, Profiler::EVENT_COUNT, Profiler::RECEIVED_BY_RESOLVER},
+  {LatencyStats::PARSE, Profiler::RECEIVED_BY_RESOLVER, Profiler::PAYLOAD_PARSED},
+  {LatencyStats::RESOLVE, Profiler::PAYLOAD_PARSED, Profiler::RESOLVED_COMMAND},
+  {LatencyStats::QUEUE, Profiler::RECEIVED_BY_WORKPOOL,
+    Profiler::RECEIVED_BY_WORKER},
+  {LatencyStats::VALIDATE, Profiler::RECEIVED_BY_WORKER, Profiler::VALIDATED},
+  {LatencyStats::ACTION, Profiler::VALIDATED, Profiler::RECEIVED_BY_RESPONDER},
+  {LatencyStats::RESPOND, Profiler::RECEIVED_BY_RESPONDER,
+    Profiler::WRITE_STARTED},
+  {LatencyStats::WRITE, Profiler::WRITE_STARTED, Profiler::WRITE_FINISHED},
+  {LatencyStats::TOTAL, Profiler::EVENT_COUNT, Profiler::WRITE_FINISHED},
+};
+static_assert(sizeof(kStageSpans) / sizeof(kStageSpans[0]) ==
+    LatencyStats::STAGE_COUNT, "every stage needs a span");
+
+const char* const kStageNames[] = {
+  "accept", "parse", "resolve", "queue", "validate", "action", "respond",
+  "write", "total",
+};
+}
+
+LatencyStats::LatencyStats(size_t commandCount) : commands_(commandCount) {}
+
+LatencyStats::~LatencyStats() {
+  for (auto& stats : commands_) {
+    delete stats.load();
+  }
+}
+
+const char* LatencyStats::stageName(Stage stage) {
+  return kStageNames[stage];
+}
+
+void LatencyStats::record(uint32_t command, const Profiler& profiler) {
+  if (command >= commands_.size()) {
+    THROW("Command index %u out of range", command);
+  }
+  CommandStats* stats = commands_[command].load(std::memory_order_acquire);
+  if (stats == nullptr) {
+    auto fresh = std::make_unique<CommandStats>();
+    if (commands_[command].compare_exchange_strong(stats, fresh.get(),
+          std::memory_order_acq_rel)) {
+      stats = fresh.release();
+    }
+  }
+  for (const auto& span : kStageSpans) {
+    int64_t from = span.from == Profiler::EVENT_COUNT ?
+      0 : profiler.since(span.from);
+    int64_t to = profiler.since(span.to);
+    if (from < 0 || to < from) {
+      continue;
+    }
+    stats->stages[span.stage].record(to - from);
+  }
+}
+
+std::vector<LatencyStats::Summary> LatencyStats::summary(
+    uint32_t command) const {
+  std::vector<Summary> summaries;
+  const CommandStats* stats = command < commands_.size() ?
+    commands_[command].load(std::memory_order_acquire) : nullptr;
+  if (stats == nullptr) {
+    return summaries;
+  }
+  for (int i = 0; i < STAGE_COUNT; ++i) {
+    const Histogram& hist = stats->stages[i];
+    if (hist.count() == 0) {
+      continue;
+    }
+    summaries.push_back(Summary{(Stage)i, hist.count(),
+        hist.percentile(0.5), hist.percentile(0.99), hist.max()});
+  }
+  return summaries;
+}
+
+const Histogram* LatencyStats::histogram(uint32_t command, Stage stage) const {
+  const CommandStats* stats = command < commands_.size() ?
+    commands_[command].load(std::memory_order_acquire) : nullptr;
+  return stats ? &stats->stages[stage] : nullptr;
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include "holper.h"
+#include "profiler.h"
+#include "metrics.h"
+
+// Time between consecutive pipeline events, aggregated per command
+class LatencyStats
+{
+public:
+  enum Stage {
+    ACCEPT,
+    PARSE,
+    RESOLVE,
+    QUEUE,
+    VALIDATE,
+    ACTION,
+    RESPOND,
+    WRITE,
+    TOTAL,
+    STAGE_COUNT,
+  };
+  struct Summary {
+    Stage stage;
+    u64 count;
+    u64 p50;
+    u64 p99;
+    u64 max;
+  };
+private:
+  struct CommandStats {
+    Histogram stages[STAGE_COUNT];
+  };
+  // Allocated on a command's first request
+  std::vector<std::atomic<CommandStats*>> commands_;
+public:
+  // commandCount is the size of the frozen command table
+  explicit LatencyStats(size_t commandCount);
+  ~LatencyStats();
+  static const char* stageName(Stage stage);
+  void record(uint32_t command, const Profiler& profiler);
+  // Stages that have seen requests, empty if the command never ran
+  std::vector<Summary> summary(uint32_t command) const;
+  // nullptr until the command has run
+  const Histogram* histogram(uint32_t command, Stage stage) const;
+};
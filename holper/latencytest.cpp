@@ -0,0 +1,27 @@
+#include <gtest/gtest.h>
+#include "latency.h"
+
+TEST(LatencyStatsTest, stages) {
+  TimePoint start;
+  Profiler profiler(start);
+  profiler.event(Profiler::RECEIVED_BY_RESOLVER, start + 0.001);
+  profiler.event(Profiler::PAYLOAD_PARSED, start + 0.003);
+  profiler.event(Profiler::WRITE_STARTED, start + 0.004);
+  profiler.event(Profiler::WRITE_FINISHED, start + 0.010);
+  LatencyStats stats(3);
+  EXPECT_TRUE(stats.summary(1).empty());
+  stats.record(1, profiler);
+  stats.record(1, profiler);
+  auto summaries = stats.summary(1);
+  ASSERT_EQ(summaries.size(), 4);
+  EXPECT_EQ(summaries[0].stage, LatencyStats::ACCEPT);
+  EXPECT_EQ(summaries[0].count, 2);
+  EXPECT_NEAR(summaries[0].max, 1000000, 1000);
+  EXPECT_EQ(summaries[1].stage, LatencyStats::PARSE);
+  EXPECT_NEAR(summaries[1].p50, 2000000, 1000);
+  EXPECT_EQ(summaries[2].stage, LatencyStats::WRITE);
+  EXPECT_EQ(summaries[3].stage, LatencyStats::TOTAL);
+  EXPECT_NEAR(summaries[3].p99, 10000000, 1000);
+  EXPECT_TRUE(stats.summary(0).empty());
+  EXPECT_THROW(stats.record(3, profiler), std::exception);
+}
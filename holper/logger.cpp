@@ -1,11 +1,28 @@
 #include "logger.h"
 #include "string.h"
+#include "thread.h"
+#include <algorithm>
+#include <climits>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-LogLine::LogLine(std::function<void(const std::string&)> log) : log_(log) {
+LogLine::LogLine(Logger* logger, Logger::Level level, bool logErrno)
+    : logger_(logger), level_(level), errno_(logErrno) {
+  if (logger_->enabled(level_)) {
+    ss_.emplace();
+  }
 }
 
 LogLine::~LogLine() {
-  log_(ss.str());
+  if (!ss_) {
+    return;
+  }
+  if (errno_) {
+    logger_->_logErrno(ss_->str());
+  } else {
+    logger_->_log(level_, ss_->str());
+  }
 }
 
 void Logger::_logErrno(const std::string& log) {
@@ -16,44 +33,430 @@ void Logger::_logToTargets(const char* string, size_t len) {
     target.get()->write(string, len);
   }
 }
+
+MmapLogTarget::MmapLogTarget(const std::string& path, size_t segmentSize,
+    size_t segmentCount)
+  : path_(path), segmentSize_(segmentSize), segmentCount_(segmentCount) {
+  if (segmentSize_ == 0 || segmentCount_ == 0) {
+    THROW("Invalid log segments for %s (size:%lu, count:%lu)",
+        path.c_str(), segmentSize, segmentCount);
+  }
+  int r = pthread_mutex_init(&mutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", StringUtils::errorString(r).c_str());
+  }
+  // keep the previous run's log around
+  shiftSegments();
+  openSegment();
+}
+
+MmapLogTarget::~MmapLogTarget() {
+  closeSegment();
+  pthread_mutex_destroy(&mutex_);
+}
+
+std::string MmapLogTarget::segmentPath(size_t index) const {
+  if (index == 0) {
+    return path_;
+  }
+  return St::fmt("%s.%lu", path_.c_str(), index);
+}
+
+void MmapLogTarget::shiftSegments() {
+  for (size_t i = segmentCount_ - 1; i > 0; --i) {
+    if (0 != rename(segmentPath(i - 1).c_str(), segmentPath(i).c_str())
+        && errno != ENOENT) {
+      THROW("Log rotation failed for %s: %s",
+          segmentPath(i - 1).c_str(), StringUtils::errorString().c_str());
+    }
+  }
+}
+
+void MmapLogTarget::openSegment() {
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC,
+      S_IRUSR | S_IWUSR);
+  if (fd_ < 0) {
+    THROW("Log file %s failed to open: %s",
+        path_.c_str(), StringUtils::errorString().c_str());
+  }
+  int r = posix_fallocate(fd_, 0, segmentSize_);
+  if (r != 0) {
+    close(fd_);
+    fd_ = -1;
+    THROW("Log file %s preallocation failed: %s",
+        path_.c_str(), StringUtils::errorString(r).c_str());
+  }
+  void* map = mmap(nullptr, segmentSize_, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd_, 0);
+  if (map == MAP_FAILED) {
+    close(fd_);
+    fd_ = -1;
+    THROW("Log file %s mmap failed: %s",
+        path_.c_str(), StringUtils::errorString().c_str());
+  }
+  map_ = (char*)map;
+  used_ = 0;
+}
+
+void MmapLogTarget::closeSegment() {
+  if (fd_ < 0) {
+    return;
+  }
+  munmap(map_, segmentSize_);
+  map_ = nullptr;
+  // if this fails the file keeps its zeroed tail, nothing else to do
+  int UNUSED(r) = ftruncate(fd_, used_);
+  close(fd_);
+  fd_ = -1;
+}
+
+bool MmapLogTarget::rotate() {
+  if (!map_ && TimePoint() < retryAt_) {
+    return false;
+  }
+  closeSegment();
+  try {
+    // a retry only reopens, shifting again would rotate away good segments
+    if (!shifted_) {
+      shiftSegments();
+      shifted_ = true;
+    }
+    openSegment();
+  } catch (std::exception& e) {
+    used_ = 0;
+    dropReason_ = e.what();
+    retryAt_ = TimePoint() + retryDelay_;
+    retryDelay_ = std::min(kMaxRetryDelay,
+        TimeDelta::fromNs(retryDelay_.ns() * 2));
+    return false;
+  }
+  shifted_ = false;
+  retryDelay_ = kMinRetryDelay;
+  if (dropped_ > 0) {
+    std::string note = St::fmt("[%lu log records dropped: %s]\n",
+        dropped_, dropReason_.c_str());
+    dropped_ = 0;
+    size_t len = std::min(note.size(), segmentSize_);
+    memcpy(map_, note.data(), len);
+    used_ = len;
+  }
+  return true;
+}
+
+bool MmapLogTarget::append(const char* data, size_t len) {
+  if (!map_ || (used_ + len > segmentSize_ && used_ > 0)) {
+    if (!rotate()) {
+      return false;
+    }
+  }
+  len = std::min(len, segmentSize_ - used_);
+  memcpy(map_ + used_, data, len);
+  used_ += len;
+  return true;
+}
+
+void MmapLogTarget::write(const char* string, size_t len) {
+  LockMutex lock(&mutex_);
+  if (!append(string, len)) {
+    dropped_ += 1;
+  }
+}
+
+void MmapLogTarget::writev(const struct iovec* iov, int count) {
+  LockMutex lock(&mutex_);
+  for (int i = 0; i < count; ++i) {
+    if (!append((const char*)iov[i].iov_base, iov[i].iov_len)) {
+      dropped_ += 1;
+    }
+  }
+}
+
+void Logger::appendLine(std::vector<char>& out, const struct timespec& time,
+    pid_t tid, const char* threadName, Level level,
+    const char* message, size_t length) const {
+  char prefix[128];
+  // the date only gets rendered again when the second changes
+  int len = TimeFormat::localTime(time.tv_sec, prefix, sizeof(prefix));
+  int rest = snprintf(prefix + len, sizeof(prefix) - len, " [%d:%d:%s]: %s",
+      getpid(), tid, threadName, levelColors_.at(level));
+  len = std::clamp(len + rest, 0, (int)sizeof(prefix) - 1);
+  out.insert(out.end(), prefix, prefix + len);
+  out.insert(out.end(), message, message + length);
+  const char* suffix = Consts::TerminalColors::DEFAULT;
+  out.insert(out.end(), suffix, suffix + strlen(suffix));
+  out.push_back('\n');
+}
+
 void Logger::_log(Level level, const std::string& message) {
+  if (recorder_ && recorder_->accepts(level)) {
+    recorder_->record(level, message.c_str(), message.size());
+  }
   if ((int)level < (int)verbosity_) {
     return;
   }
-  std::stringstream ss;
+  _logToTargets(level, message);
+}
+
+void Logger::_logToTargets(Level level, const std::string& message) {
+  if (async_) {
+    _logAsync(level, message);
+    return;
+  }
   char thread_name[32];
   pthread_getname_np(pthread_self(), thread_name, 32);
-  ss << RealTimePoint().str()
-    << " [" << getpid() << ":" << gettid() << ":" << thread_name << "]: "
-    << levelColors_.at(level) << message << Consts::TerminalColors::DEFAULT << "\n";
-  std::string str = ss.str();
-  _logToTargets(str.c_str(), str.size());
+  std::vector<char> line;
+  appendLine(line, RealTimePoint().timespec(), gettid(), thread_name, level,
+      message.c_str(), message.size());
+  _logToTargets(line.data(), line.size());
+}
+
+std::atomic<u64> Logger::instanceCounter_;
+
+static const char* const kLevelNames[] = {
+  "debug", "info", "warn", "mustfix", "error", "fatal", "internal",
+};
+
+const char* Logger::levelName(int level) {
+  if (level == FlightRecorder::kProfilerEvent) {
+    return "event";
+  }
+  if (level < DEBUG || level > INTERNAL) {
+    return "unknown";
+  }
+  return kLevelNames[level];
+}
+
+std::optional<Logger::Level> Logger::levelFromName(std::string_view name) {
+  for (int i = DEBUG; i <= INTERNAL; ++i) {
+    if (name == kLevelNames[i]) {
+      return (Level)i;
+    }
+  }
+  return std::nullopt;
+}
+
+Logger::Logger(Level verbosity)
+    : verbosity_(verbosity), instanceId_(++instanceCounter_) {
+  int r = pthread_mutex_init(&ringsMutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", StringUtils::errorString(r).c_str());
+  }
+  r = pthread_mutex_init(&flushMutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", StringUtils::errorString(r).c_str());
+  }
+  if (sem_init(&flushSemaphore_, 0, 0) != 0) {
+    THROW("Semaphore init failed: %s", StringUtils::errorString().c_str());
+  }
+}
+
+Logger::~Logger() {
+  if (async_) {
+    stopping_ = true;
+    sem_post(&flushSemaphore_);
+    pthread_join(flusher_, nullptr);
+  }
+  sem_destroy(&flushSemaphore_);
+  pthread_mutex_destroy(&flushMutex_);
+  pthread_mutex_destroy(&ringsMutex_);
+}
+
+LogRing::LogRing(size_t size) : head_(0), tail_(0) {
+  size_t capacity = 1;
+  while (capacity < size) {
+    capacity <<= 1;
+  }
+  records_.resize(capacity);
+  mask_ = capacity - 1;
+}
+
+LogRing* Logger::ring() {
+  // Only remembers the last async logger used by this thread, which is
+  // enough as long as there is one per process.
+  thread_local u64 owner = 0;
+  thread_local LogRing* ring = nullptr;
+  if (owner != instanceId_) {
+    auto newRing = std::make_unique<LogRing>(asyncOptions_.ringSize);
+    newRing->tid = gettid();
+    pthread_getname_np(pthread_self(), newRing->threadName,
+        sizeof(newRing->threadName));
+    ring = newRing.get();
+    {
+      LockMutex lock(&ringsMutex_);
+      rings_.push_back(std::move(newRing));
+    }
+    owner = instanceId_;
+  }
+  return ring;
+}
+
+LogRecord* Logger::reserveRecord(Level level, LogRing*& logRing) {
+  logRing = ring();
+  LogRecord* record;
+  while (!(record = logRing->reserve())) {
+    if (asyncOptions_.overflow == Overflow::DROP) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    sem_post(&flushSemaphore_);
+    usleep(100);
+  }
+  clock_gettime(CLOCK_REALTIME, &record->time);
+  record->level = level;
+  return record;
+}
+
+void Logger::commitRecord(LogRing* logRing, Level level) {
+  logRing->commit();
+  if (level >= asyncOptions_.flushLevel) {
+    sem_post(&flushSemaphore_);
+  }
+}
+
+void Logger::_logAsync(Level level, const std::string& message) {
+  LogRing* logRing;
+  LogRecord* record = reserveRecord(level, logRing);
+  if (!record) {
+    return;
+  }
+  LogArgs::setText(*record, message.c_str(), message.size());
+  commitRecord(logRing, level);
+}
+
+void Logger::startAsync(const AsyncOptions& options) {
+  if (async_) {
+    THROW("Logger is already async");
+  }
+  asyncOptions_ = options;
+  int r = pthread_create(&flusher_, NULL, startFlusher, (void*)this);
+  if (r != 0) {
+    THROW("Thread creation failed: %s", StringUtils::errorString(r).c_str());
+  }
+  async_ = true;
+}
+
+void* Logger::startFlusher(void* logger) {
+  pthread_setname_np(pthread_self(), "LogFlusher");
+  reinterpret_cast<Logger*>(logger)->runFlusher();
+  return nullptr;
+}
+
+void Logger::runFlusher() {
+  while (true) {
+    struct timespec until = (RealTimePoint() + asyncOptions_.flushInterval)
+      .timespec();
+    sem_timedwait(&flushSemaphore_, &until);
+    bool stopping = stopping_;
+    drain();
+    if (stopping) {
+      return;
+    }
+  }
+}
+
+bool Logger::drain() {
+  LockMutex lock(&flushMutex_);
+  std::vector<LogRing*> rings;
+  {
+    LockMutex ringsLock(&ringsMutex_);
+    rings.reserve(rings_.size());
+    for (auto& logRing : rings_) {
+      rings.push_back(logRing.get());
+    }
+  }
+  batch_.clear();
+  lineEnds_.clear();
+  // merge rings by timestamp so the output stays in order
+  while (true) {
+    LogRing* oldest = nullptr;
+    const LogRecord* oldestRecord = nullptr;
+    for (LogRing* logRing : rings) {
+      const LogRecord* record = logRing->front();
+      if (record && (!oldestRecord ||
+            RealTimePoint(record->time) < RealTimePoint(oldestRecord->time))) {
+        oldest = logRing;
+        oldestRecord = record;
+      }
+    }
+    if (!oldest) {
+      break;
+    }
+    size_t length;
+    const char* message = LogArgs::text(*oldestRecord, scratch_, length);
+    appendLine(batch_, oldestRecord->time, oldest->tid, oldest->threadName,
+        (Level)oldestRecord->level, message, length);
+    lineEnds_.push_back(batch_.size());
+    oldest->pop();
+  }
+  u64 dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != reportedDropped_) {
+    std::string message = St::fmt("Dropped %llu log records",
+        dropped - reportedDropped_);
+    reportedDropped_ = dropped;
+    appendLine(batch_, RealTimePoint().timespec(), gettid(), "LogFlusher",
+        MUSTFIX, message.c_str(), message.size());
+    lineEnds_.push_back(batch_.size());
+  }
+  if (lineEnds_.empty()) {
+    return false;
+  }
+  iovecs_.clear();
+  size_t start = 0;
+  for (size_t end : lineEnds_) {
+    iovecs_.push_back(iovec{batch_.data() + start, end - start});
+    start = end;
+  }
+  for (auto& target : targets_) {
+    for (size_t i = 0; i < iovecs_.size(); i += IOV_MAX) {
+      target->writev(iovecs_.data() + i,
+          (int)std::min(iovecs_.size() - i, (size_t)IOV_MAX));
+    }
+  }
+  return true;
+}
+
+void Logger::flush() {
+  if (!async_) {
+    return;
+  }
+  while (true) {
+    sem_post(&flushSemaphore_);
+    {
+      LockMutex lock(&flushMutex_);
+      LockMutex ringsLock(&ringsMutex_);
+      if (std::all_of(rings_.begin(), rings_.end(),
+            [](const auto& logRing) { return logRing->empty(); })) {
+        return;
+      }
+    }
+    usleep(100);
+  }
 }
 
 LogLine Logger::debug() {
-  return LogLine(std::bind(&Logger::_log, this, DEBUG, std::placeholders::_1));
+  return LogLine(this, DEBUG);
 }
 
 LogLine Logger::info() {
-  return LogLine(std::bind(&Logger::_log, this, INFO, std::placeholders::_1));
+  return LogLine(this, INFO);
 }
 
 LogLine Logger::warn() {
-  return LogLine(std::bind(&Logger::_log, this, WARN, std::placeholders::_1));
+  return LogLine(this, WARN);
 }
 
 LogLine Logger::mustfix() {
-  return LogLine(std::bind(&Logger::_log, this, MUSTFIX, std::placeholders::_1));
+  return LogLine(this, MUSTFIX);
 }
 
 LogLine Logger::error() {
-  return LogLine(std::bind(&Logger::_log, this, ERROR, std::placeholders::_1));
+  return LogLine(this, ERROR);
 }
 
 LogLine Logger::fatal() {
-  return LogLine(std::bind(&Logger::_log, this, FATAL, std::placeholders::_1));
+  return LogLine(this, FATAL);
 }
 
 LogLine Logger::logErrno() {
-  return LogLine(std::bind(&Logger::_logErrno, this, std::placeholders::_1));
+  return LogLine(this, ERROR, true);
 }
@@ -4,19 +4,34 @@
 #include <vector>
 #include <map>
 #include <functional>
+#include <optional>
+#include <sstream>
 #include <cstring>
 #include <cstdio>
 #include <ctime>
 #include <pthread.h>
+#include <semaphore.h>
 #include <stdarg.h>
+#include <sys/uio.h>
+#include <atomic>
+#include "holper.h"
 #include "consts.h"
 #include "string.h"
+#include "time.h"
+#include "logrecord.h"
+#include "flightrecorder.h"
 
 class LogTarget
 {
 public:
   virtual ~LogTarget(){}
   virtual void write(const char*, size_t) = 0;
+  // Used by the async flusher to hand over a batch of log lines at once
+  virtual void writev(const struct iovec* iov, int count) {
+    for (int i = 0; i < count; ++i) {
+      write((const char*)iov[i].iov_base, iov[i].iov_len);
+    }
+  }
 };
 
 class FDLogTarget : public LogTarget
@@ -34,6 +49,48 @@ public:
   void write(const char* string, size_t len) override {
     ::write(fd_, string, len);
   }
+  void writev(const struct iovec* iov, int count) override {
+    ::writev(fd_, iov, count);
+  }
+};
+
+// Writes into a preallocated, memory mapped file. When it fills up the file
+// is trimmed to its used size and shifted to path.1 (path.1 to path.2 and so
+// on), keeping at most segmentCount files. Unused space of the current
+// segment reads as zeroes until it is rotated or closed.
+class MmapLogTarget : public LogTarget
+{
+private:
+  std::string path_;
+  size_t segmentSize_;
+  size_t segmentCount_;
+  int fd_ = -1;
+  char* map_ = nullptr;
+  size_t used_ = 0;
+  // A failed rotation leaves map_ null. Records are dropped and counted
+  // until a retry, backed off up to kMaxRetryDelay, opens a segment.
+  size_t dropped_ = 0;
+  std::string dropReason_;
+  bool shifted_ = false;
+  TimeDelta retryDelay_ = kMinRetryDelay;
+  TimePoint retryAt_ = TimePoint::fromNs(0);
+  pthread_mutex_t mutex_;
+  std::string segmentPath(size_t index) const;
+  void shiftSegments();
+  void openSegment();
+  void closeSegment();
+  // Starts a new segment, false if none is mapped. Never throws.
+  bool rotate();
+  // Copies what fits, false if the record has to be dropped
+  bool append(const char* data, size_t len);
+public:
+  static constexpr TimeDelta kMinRetryDelay = 0.1;
+  static constexpr TimeDelta kMaxRetryDelay = 60.0;
+  MmapLogTarget(const std::string& path, size_t segmentSize,
+      size_t segmentCount);
+  ~MmapLogTarget();
+  void write(const char* string, size_t len) override;
+  void writev(const struct iovec* iov, int count) override;
 };
 
 class InMemoryLogTarget : public LogTarget
@@ -69,21 +126,54 @@ public:
   }
 };
 
-class Logger;
+// Log calls below this level compile to nothing,
+// e.g. -DHOLPER_MIN_LOG_LEVEL=1 drops every debug call
+#ifndef HOLPER_MIN_LOG_LEVEL
+#define HOLPER_MIN_LOG_LEVEL 0
+#endif
 
-class LogLine {
-  std::stringstream ss;
-  std::function<void(const std::string&)> log_;
+// Single producer single consumer ring, one per logging thread
+class LogRing {
+  std::vector<LogRecord> records_;
+  size_t mask_;
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
 public:
-  LogLine(std::function<void(const std::string&)>);
-  ~LogLine();
-  template <typename T>
-  LogLine& operator<<(const T& val) {
-    ss << val;
-    return *this;
+  pid_t tid;
+  char threadName[16];
+  explicit LogRing(size_t size);
+  // Producer side: nullptr when the ring is full
+  LogRecord* reserve() {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if (head - tail_.load(std::memory_order_acquire) > mask_) {
+      return nullptr;
+    }
+    return &records_[head & mask_];
+  }
+  void commit() {
+    head_.store(head_.load(std::memory_order_relaxed) + 1,
+        std::memory_order_release);
+  }
+  // Consumer side: nullptr when the ring is empty
+  const LogRecord* front() {
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail == head_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+    return &records_[tail & mask_];
+  }
+  void pop() {
+    tail_.store(tail_.load(std::memory_order_relaxed) + 1,
+        std::memory_order_release);
+  }
+  bool empty() const {
+    return tail_.load(std::memory_order_acquire) ==
+      head_.load(std::memory_order_acquire);
   }
 };
 
+class LogLine;
+
 class Logger
 {
 public:
@@ -96,9 +186,22 @@ public:
     FATAL = 5,
     INTERNAL = 6,
   };
+  enum class Overflow {
+    DROP,
+    BLOCK,
+  };
+  struct AsyncOptions {
+    // Records per thread, rounded up to a power of two
+    size_t ringSize = 1024;
+    TimeDelta flushInterval = TimeDelta(0.1);
+    // Records at or above this level wake the flusher immediately
+    Level flushLevel = ERROR;
+    Overflow overflow = Overflow::DROP;
+  };
 private:
   std::vector<std::unique_ptr<LogTarget>> targets_;
   void _logToTargets(const char* string, size_t len);
+  void _logToTargets(Level level, const std::string& message);
   void _logErrno(const std::string& log);
   const std::map<Level, const char*> levelColors_ = {
     {DEBUG, Consts::TerminalColors::WHITE},
@@ -109,13 +212,108 @@ private:
     {FATAL, Consts::TerminalColors::RED},
     {INTERNAL, Consts::TerminalColors::PURPLE},
   };
+  friend class LogLine;
   void _log(Level level, const std::string& message);
+  void _logAsync(Level level, const std::string& message);
+  LogRecord* reserveRecord(Level level, LogRing*& logRing);
+  void commitRecord(LogRing* logRing, Level level);
+  void appendLine(std::vector<char>& out, const struct timespec& time,
+      pid_t tid, const char* threadName, Level level,
+      const char* message, size_t length) const;
+  template <typename... Args>
+  void logDeferred(Level level, const char* fmt, Args... args) {
+    LogRing* logRing;
+    LogRecord* record = reserveRecord(level, logRing);
+    if (!record) {
+      return;
+    }
+    LogArgs::capture(*record, fmt, args...);
+    commitRecord(logRing, level);
+  }
+  template <Level L, typename... Args>
+  void logFormat(const char* fmt, Args... args) {
+    if constexpr ((int)L >= HOLPER_MIN_LOG_LEVEL) {
+      bool toTargets = (int)L >= (int)verbosity_;
+      bool toRecorder = recorder_ && recorder_->accepts(L);
+      if (!toTargets && !toRecorder) {
+        return;
+      }
+      if (!LogArgs::capturable(fmt, args...)) {
+        _log(L, St::fmt(fmt, args...));
+        return;
+      }
+      if (toRecorder) {
+        recorder_->capture(L, fmt, args...);
+      }
+      if (!toTargets) {
+        return;
+      }
+      if (async_) {
+        logDeferred(L, fmt, args...);
+      } else {
+        _logToTargets(L, St::fmt(fmt, args...));
+      }
+    }
+  }
   Level verbosity_;
+  std::shared_ptr<FlightRecorder> recorder_;
+
+  // async mode
+  static std::atomic<u64> instanceCounter_;
+  const u64 instanceId_;
+  bool async_ = false;
+  AsyncOptions asyncOptions_;
+  std::vector<std::unique_ptr<LogRing>> rings_;
+  pthread_mutex_t ringsMutex_;
+  // held by the flusher while draining and writing
+  pthread_mutex_t flushMutex_;
+  sem_t flushSemaphore_;
+  pthread_t flusher_;
+  std::atomic<bool> stopping_ = false;
+  std::atomic<u64> dropped_ = 0;
+  u64 reportedDropped_ = 0;
+  std::vector<char> batch_;
+  std::vector<char> scratch_;
+  std::vector<size_t> lineEnds_;
+  std::vector<struct iovec> iovecs_;
+  LogRing* ring();
+  static void* startFlusher(void* logger);
+  void runFlusher();
+  bool drain();
 public:
-  Logger(Level verbosity = DEBUG) : verbosity_(verbosity) {}
+  Logger(Level verbosity = DEBUG);
+  ~Logger();
   void addTarget(std::unique_ptr<LogTarget> target) {
     targets_.push_back(std::move(target));
   }
+  // Moves formatting and writing off the calling thread. Must be called
+  // before other threads start logging and targets must not change after.
+  void startAsync(const AsyncOptions& options);
+  void startAsync() {
+    startAsync(AsyncOptions());
+  }
+  // Blocks until everything logged so far is written to the targets
+  void flush();
+  u64 dropped() const {
+    return dropped_.load(std::memory_order_relaxed);
+  }
+  // True when lines at level reach the targets, not only the recorder.
+  // Guard lines that are expensive to build with this, the recorder
+  // should get a cheap structured line instead.
+  bool verbose(Level level) const {
+    return (int)level >= HOLPER_MIN_LOG_LEVEL && level >= verbosity_;
+  }
+  bool enabled(Level level) const {
+    return (int)level >= HOLPER_MIN_LOG_LEVEL && (level >= verbosity_ ||
+        (recorder_ && recorder_->accepts(level)));
+  }
+  // Records at or above the recorder's level are kept in it regardless of
+  // verbosity. Must be set before other threads start logging.
+  void setFlightRecorder(std::shared_ptr<FlightRecorder> recorder) {
+    recorder_ = std::move(recorder);
+  }
+  static const char* levelName(int level);
+  static std::optional<Level> levelFromName(std::string_view name);
   LogLine debug();
   LogLine info();
   LogLine warn();
@@ -126,30 +324,50 @@ public:
 
   template <typename... Args>
   void debug(const char* fmt, Args... args) {
-    _log(DEBUG, St::fmt(fmt, args...));
+    logFormat<DEBUG>(fmt, args...);
   }
   template <typename... Args>
   void info(const char* fmt, Args... args) {
-    _log(INFO, St::fmt(fmt, args...));
+    logFormat<INFO>(fmt, args...);
   }
   template <typename... Args>
   void warn(const char* fmt, Args... args) {
-    _log(WARN, St::fmt(fmt, args...));
+    logFormat<WARN>(fmt, args...);
   }
   template <typename... Args>
   void mustfix(const char* fmt, Args... args) {
-    _log(MUSTFIX, St::fmt(fmt, args...));
+    logFormat<MUSTFIX>(fmt, args...);
   }
   template <typename... Args>
   void error(const char* fmt, Args... args) {
-    _log(ERROR, St::fmt(fmt, args...));
+    logFormat<ERROR>(fmt, args...);
   }
   template <typename... Args>
   void fatal(const char* fmt, Args... args) {
-    _log(FATAL, St::fmt(fmt, args...));
+    logFormat<FATAL>(fmt, args...);
   }
   template <typename... Args>
   void logErrno(const char* fmt, Args... args) {
-    _logErrno(St::fmt(fmt, args...));
+    if (enabled(ERROR)) {
+      _logErrno(St::fmt(fmt, args...));
+    }
+  }
+};
+
+// Streams into a buffer that is only created when the level is enabled
+class LogLine {
+  std::optional<std::stringstream> ss_;
+  Logger* logger_;
+  Logger::Level level_;
+  bool errno_;
+public:
+  LogLine(Logger* logger, Logger::Level level, bool logErrno = false);
+  ~LogLine();
+  template <typename T>
+  LogLine& operator<<(const T& val) {
+    if (ss_) {
+      *ss_ << val;
+    }
+    return *this;
   }
 };
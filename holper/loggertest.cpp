@@ -76,3 +76,261 @@ TEST_F(LoggerTest, LogRotation) {
     expectSubstring(logs[i], buf);
   }
 }
+
+TEST_F(LoggerTest, Async) {
+  logger_.startAsync();
+  const int kLogCount = 10;
+  for (int i=0; i<kLogCount; ++i) {
+    logger_.info("test %d", i);
+  }
+  logger_.flush();
+  auto logs = target_->getLogs();
+  ASSERT_EQ(logs.size(), kLogCount);
+  for (int i=0; i<kLogCount; ++i) {
+    char buf[32];
+    sprintf(buf, "test %d", i);
+    expectSubstring(logs[i], buf);
+  }
+  EXPECT_EQ(logger_.dropped(), 0);
+}
+
+TEST_F(LoggerTest, AsyncDrop) {
+  Logger::AsyncOptions options;
+  options.ringSize = 4;
+  options.flushInterval = TimeDelta(60.0);
+  logger_.startAsync(options);
+  for (int i=0; i<10; ++i) {
+    logger_.info("test %d", i);
+  }
+  EXPECT_EQ(logger_.dropped(), 6);
+  logger_.flush();
+  auto logs = target_->getLogs();
+  ASSERT_EQ(logs.size(), 5);
+  expectSubstring(logs[3], "test 3");
+  expectSubstring(logs[4], "Dropped 6 log records");
+}
+
+TEST_F(LoggerTest, AsyncBlock) {
+  Logger::AsyncOptions options;
+  options.ringSize = 4;
+  options.overflow = Logger::Overflow::BLOCK;
+  logger_.startAsync(options);
+  const int kLogCount = 20;
+  for (int i=0; i<kLogCount; ++i) {
+    logger_.info("test %d", i);
+  }
+  logger_.flush();
+  EXPECT_EQ(logger_.dropped(), 0);
+  auto logs = target_->getLogs();
+  ASSERT_EQ(logs.size(), kLogCount);
+  expectSubstring(logs[kLogCount - 1], "test 19");
+}
+
+TEST_F(LoggerTest, AsyncThreads) {
+  logger_.startAsync();
+  const int kThreadCount = 4;
+  const int kLogCount = 10;
+  std::vector<pthread_t> threads(kThreadCount);
+  for (auto& thread : threads) {
+    pthread_create(&thread, nullptr, [](void* logger) -> void* {
+      for (int i=0; i<kLogCount; ++i) {
+        reinterpret_cast<Logger*>(logger)->info("thread log %d", i);
+      }
+      return nullptr;
+    }, &logger_);
+  }
+  for (auto& thread : threads) {
+    pthread_join(thread, nullptr);
+  }
+  logger_.flush();
+  EXPECT_EQ(target_->getLogs().size(), kThreadCount * kLogCount);
+}
+
+TEST_F(LoggerTest, DisabledLevel) {
+  Logger logger(Logger::WARN);
+  auto target = new InMemoryLogTarget(kLogSize);
+  logger.addTarget(std::unique_ptr<LogTarget>(target));
+  logger.info("test %d", 1);
+  logger.info() << "test" << 2;
+  logger.warn("test %d", 3);
+  EXPECT_FALSE(logger.enabled(Logger::INFO));
+  EXPECT_TRUE(logger.enabled(Logger::ERROR));
+  auto logs = target->getLogs();
+  ASSERT_EQ(logs.size(), 1);
+  expectSubstring(logs[0], "test 3");
+}
+
+TEST_F(LoggerTest, AsyncDeferred) {
+  logger_.startAsync();
+  {
+    std::string fmt("deferred %s %d %.2f %c");
+    std::string arg("argument");
+    logger_.info(fmt.c_str(), arg.c_str(), 42, 1.5, 'x');
+    arg.assign(arg.size(), '?');
+    fmt.assign(fmt.size(), '?');
+  }
+  std::string str("abcdef");
+  logger_.info("precision %.*s", 3, str.c_str());
+  logger_.info("%s", std::string(1000, 'a').c_str());
+  logger_.info() << "stream " << 7;
+  logger_.flush();
+  auto logs = target_->getLogs();
+  ASSERT_EQ(logs.size(), 4);
+  expectSubstring(logs[0], "deferred argument 42 1.50 x");
+  expectSubstring(logs[1], "precision abc");
+  expectSubstring(logs[2], std::string(400, 'a'));
+  expectSubstring(logs[3], "stream 7");
+}
+
+class MmapLogTargetTest : public ::testing::Test {
+protected:
+  std::string dir_;
+  std::string path_;
+  void SetUp() override {
+    char tmpl[] = "/tmp/holperlogXXXXXX";
+    dir_ = mkdtemp(tmpl);
+    path_ = dir_ + "/test.log";
+  }
+  void TearDown() override {
+    for (const char* suffix : {"", ".1", ".2", ".3"}) {
+      unlink((path_ + suffix).c_str());
+    }
+    rmdir(dir_.c_str());
+  }
+  std::string read(const std::string& path) {
+    FILE* f = fopen(path.c_str(), "r");
+    if (!f) {
+      return "<missing>";
+    }
+    std::string content;
+    char buf[256];
+    size_t len;
+    while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+      content.append(buf, len);
+    }
+    fclose(f);
+    return content;
+  }
+};
+
+TEST_F(MmapLogTargetTest, Write) {
+  {
+    MmapLogTarget target(path_, 64, 2);
+    target.write("first\n", 6);
+    struct iovec iov[2] = {{(void*)"second\n", 7}, {(void*)"third\n", 6}};
+    target.writev(iov, 2);
+  }
+  EXPECT_EQ(read(path_), "first\nsecond\nthird\n");
+}
+
+TEST_F(MmapLogTargetTest, Rotation) {
+  {
+    MmapLogTarget target(path_, 16, 3);
+    for (char c = 'a'; c <= 'e'; ++c) {
+      std::string line(9, c);
+      line.back() = '\n';
+      target.write(line.c_str(), line.size());
+    }
+  }
+  EXPECT_EQ(read(path_), "eeeeeeee\n");
+  EXPECT_EQ(read(path_ + ".1"), "dddddddd\n");
+  EXPECT_EQ(read(path_ + ".2"), "cccccccc\n");
+  EXPECT_EQ(read(path_ + ".3"), "<missing>");
+  {
+    // previous run is shifted out of the way
+    MmapLogTarget target(path_, 16, 3);
+    target.write("new\n", 4);
+  }
+  EXPECT_EQ(read(path_), "new\n");
+  EXPECT_EQ(read(path_ + ".1"), "eeeeeeee\n");
+  EXPECT_EQ(read(path_ + ".2"), "dddddddd\n");
+}
+
+TEST_F(MmapLogTargetTest, RotationFailure) {
+  MmapLogTarget target(path_, 256, 2);
+  std::string full(250, 'a');
+  full.back() = '\n';
+  target.write(full.c_str(), full.size());
+  // with the directory gone the next segment can't be created
+  unlink(path_.c_str());
+  rmdir(dir_.c_str());
+  target.write("dropped\n", 8);
+  struct iovec iov[2] = {{(void*)"one\n", 4}, {(void*)"two\n", 4}};
+  target.writev(iov, 2);
+  ASSERT_EQ(0, mkdir(dir_.c_str(), 0700));
+  // still backing off, nothing gets shifted
+  target.write("early\n", 6);
+  EXPECT_EQ(read(path_), "<missing>");
+  usleep(MmapLogTarget::kMinRetryDelay.ns() / 1000 + 50000);
+  target.write("back\n", 5);
+  target.write("more\n", 5);
+  EXPECT_EQ(read(path_).substr(0, 22), "[4 log records dropped");
+  EXPECT_NE(read(path_).find("back\nmore\n"), std::string::npos);
+  EXPECT_EQ(read(path_ + ".1"), "<missing>");
+}
+
+TEST_F(MmapLogTargetTest, Logger) {
+  Logger logger;
+  logger.addTarget(std::make_unique<MmapLogTarget>(path_, 4096, 2));
+  logger.startAsync();
+  logger.info("mmap %d", 1);
+  logger.flush();
+  EXPECT_NE(read(path_).find("mmap 1"), std::string::npos);
+}
+
+TEST(FlightRecorderTest, Query) {
+  auto recorder = std::make_shared<FlightRecorder>(8, Logger::INFO);
+  Logger logger(Logger::ERROR);
+  auto target = new InMemoryLogTarget(10);
+  logger.addTarget(std::unique_ptr<LogTarget>(target));
+  logger.setFlightRecorder(recorder);
+  logger.debug("not recorded");
+  {
+    FlightRecorder::RequestScope scope(3);
+    logger.info("request %d %s", 3, "info");
+    logger.warn() << "request " << 3 << " warn";
+  }
+  logger.info("no request");
+  recorder->recordEvent(3, TimePoint(), "", "Write finished");
+  EXPECT_TRUE(target->getLogs().empty());
+  EXPECT_TRUE(logger.enabled(Logger::INFO));
+  EXPECT_FALSE(logger.verbose(Logger::INFO));
+  EXPECT_TRUE(logger.verbose(Logger::ERROR));
+
+  auto lines = recorder->query(FlightRecorder::Filter());
+  ASSERT_EQ(lines.size(), 4);
+  EXPECT_EQ(lines[0].message, "request 3 info");
+  EXPECT_EQ(lines[0].requestId, 3);
+  EXPECT_EQ(lines[0].level, Logger::INFO);
+  EXPECT_EQ(lines[1].message, "request 3 warn");
+  EXPECT_EQ(lines[2].requestId, 0);
+  EXPECT_EQ(lines[3].level, FlightRecorder::kProfilerEvent);
+
+  FlightRecorder::Filter filter;
+  filter.requestId = 3;
+  EXPECT_EQ(recorder->query(filter).size(), 3);
+  filter.minLevel = Logger::WARN;
+  lines = recorder->query(filter);
+  ASSERT_EQ(lines.size(), 1);
+  EXPECT_EQ(lines[0].message, "request 3 warn");
+  filter = FlightRecorder::Filter();
+  filter.thread = "nonexistent";
+  EXPECT_TRUE(recorder->query(filter).empty());
+  filter = FlightRecorder::Filter();
+  filter.limit = 1;
+  lines = recorder->query(filter);
+  ASSERT_EQ(lines.size(), 1);
+  EXPECT_EQ(lines[0].message, "Write finished");
+}
+
+TEST(FlightRecorderTest, Wraparound) {
+  FlightRecorder recorder(4, Logger::DEBUG);
+  for (int i = 0; i < 10; ++i) {
+    std::string message = St::fmt("line %d", i);
+    recorder.record(Logger::INFO, message.c_str(), message.size());
+  }
+  auto lines = recorder.query(FlightRecorder::Filter());
+  ASSERT_EQ(lines.size(), 4);
+  EXPECT_EQ(lines[0].message, "line 6");
+  EXPECT_EQ(lines[3].message, "line 9");
+}
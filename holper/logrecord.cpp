@@ -0,0 +1,32 @@
+#include "logrecord.h"
+#include <algorithm>
+#include <stdarg.h>
+
+int LogArgs::format(char* out, size_t size, const char* fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  int len = vsnprintf(out, size, fmt, ap);
+  va_end(ap);
+  return len;
+}
+
+void LogArgs::setText(LogRecord& record, const char* message, size_t length) {
+  record.format = nullptr;
+  record.length = std::min(length, LogRecord::kMessageSize);
+  memcpy(record.message, message, record.length);
+  if (length > LogRecord::kMessageSize) {
+    memcpy(record.message + LogRecord::kMessageSize - 3, "...", 3);
+  }
+}
+
+const char* LogArgs::text(const LogRecord& record, std::vector<char>& scratch,
+    size_t& length) {
+  if (!record.format) {
+    length = record.length;
+    return record.message;
+  }
+  length = std::max(record.format(record, nullptr, 0), 0);
+  scratch.resize(length + 1);
+  record.format(record, scratch.data(), length + 1);
+  return scratch.data();
+}
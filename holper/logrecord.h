@@ -0,0 +1,105 @@
+#pragma once
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <string>
+#include <tuple>
+#include <vector>
+#include <type_traits>
+
+// Fixed size log record kept by the async rings and the flight recorder.
+// Deferred records carry the format string and the captured arguments in message and
+// are formatted by the flusher with format().
+struct LogRecord {
+  static constexpr size_t kMessageSize = 456;
+  struct timespec time;
+  int level;
+  unsigned length;
+  int (*format)(const LogRecord& record, char* out, size_t size);
+  char message[kMessageSize];
+};
+
+// Serializes printf arguments into a LogRecord. Strings are copied since
+// they may not outlive the call.
+namespace LogArgs {
+  template <typename T>
+  using Stored = std::conditional_t<std::is_same_v<T, char*>, const char*, T>;
+
+  template <typename T>
+  struct Arg {
+    static_assert(std::is_trivially_copyable_v<T>,
+        "log arguments must be printf compatible");
+    static size_t size(const T&) {
+      return sizeof(T);
+    }
+    static void write(char*& out, const T& val) {
+      memcpy(out, &val, sizeof(T));
+      out += sizeof(T);
+    }
+    static T read(const char*& in) {
+      T val;
+      memcpy(&val, in, sizeof(T));
+      in += sizeof(T);
+      return val;
+    }
+  };
+
+  template <>
+  struct Arg<const char*> {
+    static size_t size(const char* val) {
+      return strlen(val ? val : "(null)") + 1;
+    }
+    static void write(char*& out, const char* val) {
+      size_t len = size(val);
+      memcpy(out, val ? val : "(null)", len);
+      out += len;
+    }
+    static const char* read(const char*& in) {
+      const char* val = in;
+      in += strlen(in) + 1;
+      return val;
+    }
+  };
+
+  int format(char* out, size_t size, const char* fmt, ...);
+
+  template <typename... Args>
+  int formatRecord(const LogRecord& record, char* out, size_t size) {
+    const char* in = record.message;
+    const char* fmt = Arg<const char*>::read(in);
+    std::tuple<Args...> values{Arg<Args>::read(in)...};
+    return std::apply([&](auto... args) {
+      return format(out, size, fmt, args...);
+    }, values);
+  }
+}
+
+namespace LogArgs {
+  // Whether the call can be captured without formatting; %.* arguments are
+  // not necessarily null terminated so those are formatted right away
+  template <typename... Args>
+  bool capturable(const char* fmt, Args... args) {
+    if (strstr(fmt, ".*")) {
+      return false;
+    }
+    return Arg<const char*>::size(fmt) +
+      (Arg<Stored<Args>>::size(args) + ... + 0) <= LogRecord::kMessageSize;
+  }
+
+  // Only valid if capturable()
+  template <typename... Args>
+  void capture(LogRecord& record, const char* fmt, Args... args) {
+    char* out = record.message;
+    Arg<const char*>::write(out, fmt);
+    (Arg<Stored<Args>>::write(out, args), ...);
+    record.length = out - record.message;
+    record.format = &formatRecord<Stored<Args>...>;
+  }
+
+  // Stores an already formatted message, truncating it if needed
+  void setText(LogRecord& record, const char* message, size_t length);
+
+  // Formatted message of the record, scratch is used for deferred records
+  const char* text(const LogRecord& record, std::vector<char>& scratch,
+      size_t& length);
+}
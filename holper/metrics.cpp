@@ -0,0 +1,155 @@
+#include "metrics.h"
+#include "thread.h"
+#include "exception.h"
+
+size_t Histogram::bucket(u64 value) {
+  if (value < (1u << kSubBits)) {
+    return value;
+  }
+  int shift = 63 - __builtin_clzll(value) - kSubBits;
+  return ((size_t)(shift + 1) << kSubBits) +
+    ((value >> shift) & ((1u << kSubBits) - 1));
+}
+
+u64 Histogram::bucketLimit(size_t bucket) {
+  if (bucket < (1u << kSubBits)) {
+    return bucket;
+  }
+  int shift = (bucket >> kSubBits) - 1;
+  u64 lower = (u64)((1u << kSubBits) + (bucket & ((1u << kSubBits) - 1)))
+    << shift;
+  return lower + ((1ull << shift) - 1);
+}
+
+void Histogram::record(u64 value) {
+  buckets_[bucket(value)].fetch_add(1, std::memory_order_relaxed);
+  count_.fetch_add(1, std::memory_order_relaxed);
+  sum_.fetch_add(value, std::memory_order_relaxed);
+  u64 max = max_.load(std::memory_order_relaxed);
+  while (value > max &&
+      !max_.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+}
+
+u64 Histogram::percentile(double fraction) const {
+  u64 count = this->count();
+  if (count == 0) {
+    return 0;
+  }
+  u64 rank = (u64)(fraction * count);
+  if (rank >= count) {
+    rank = count - 1;
+  }
+  u64 seen = 0;
+  for (size_t i = 0; i < kBuckets; ++i) {
+    seen += buckets_[i].load(std::memory_order_relaxed);
+    if (seen > rank) {
+      return std::min(bucketLimit(i), max());
+    }
+  }
+  return max();
+}
+
+u64 Histogram::countAtMost(u64 limit) const {
+  u64 count = 0;
+  for (size_t i = 0; i < kBuckets && bucketLimit(i) <= limit; ++i) {
+    count += buckets_[i].load(std::memory_order_relaxed);
+  }
+  return count;
+}
+
+size_t Metrics::shard() {
+  static std::atomic<size_t> nextShard;
+  thread_local size_t shard = nextShard.fetch_add(1) % kShards;
+  return shard;
+}
+
+Metrics::Metrics() : shards_(new Shard[kShards]) {
+  int r = pthread_mutex_init(&mutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", StringUtils::errorString(r).c_str());
+  }
+}
+
+Metrics::~Metrics() {
+  pthread_mutex_destroy(&mutex_);
+}
+
+Metrics::Metric& Metrics::add(const std::string& name,
+    const std::string& labels, const std::string& help, Type type) {
+  for (auto& metric : metrics_) {
+    if (metric.name == name && metric.labels == labels) {
+      if (metric.type != type) {
+        THROW("Metric %s{%s} registered with another type",
+            name.c_str(), labels.c_str());
+      }
+      return metric;
+    }
+  }
+  uint32_t cell = 0;
+  if (type != HISTOGRAM) {
+    if (cells_ == kMaxCells) {
+      THROW("Too many metrics (max:%lu)", kMaxCells);
+    }
+    cell = cells_++;
+  }
+  metrics_.push_back(Metric{name, labels, help, type, cell,
+      type == HISTOGRAM ? std::make_unique<Histogram>() : nullptr});
+  return metrics_.back();
+}
+
+Metrics::Counter Metrics::counter(const std::string& name,
+    const std::string& help, const std::string& labels) {
+  LockMutex lock(&mutex_);
+  Counter counter;
+  counter.metrics_ = this;
+  counter.cell_ = add(name, labels, help, COUNTER).cell;
+  return counter;
+}
+
+Metrics::Gauge Metrics::gauge(const std::string& name,
+    const std::string& help, const std::string& labels) {
+  LockMutex lock(&mutex_);
+  Gauge gauge;
+  gauge.metrics_ = this;
+  gauge.cell_ = add(name, labels, help, GAUGE).cell;
+  return gauge;
+}
+
+Histogram* Metrics::histogram(const std::string& name,
+    const std::string& help, const std::string& labels) {
+  LockMutex lock(&mutex_);
+  return add(name, labels, help, HISTOGRAM).histogram.get();
+}
+
+std::vector<Metrics::Sample> Metrics::snapshot() const {
+  LockMutex lock(&mutex_);
+  std::vector<Sample> samples;
+  samples.reserve(metrics_.size());
+  for (const auto& metric : metrics_) {
+    u64 value = 0;
+    if (metric.type != HISTOGRAM) {
+      for (size_t i = 0; i < kShards; ++i) {
+        value += shards_[i].cells[metric.cell].load(std::memory_order_relaxed);
+      }
+    }
+    samples.push_back(Sample{metric.name, metric.labels, metric.help,
+        metric.type, (int64_t)value, metric.histogram.get()});
+  }
+  return samples;
+}
+
+std::string Metrics::label(const std::string& key, const std::string& value) {
+  std::string escaped;
+  escaped.reserve(value.size());
+  for (char c : value) {
+    if (c == '\\' || c == '"') {
+      escaped += '\\';
+      escaped += c;
+    } else if (c == '\n') {
+      escaped += "\\n";
+    } else {
+      escaped += c;
+    }
+  }
+  return key + "=\"" + escaped + "\"";
+}
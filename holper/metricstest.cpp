@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <vector>
+#include "metrics.h"
+
+TEST(HistogramTest, buckets) {
+  for (u64 value : {0ull, 7ull, 8ull, 9ull, 100ull, 1000ull, 123456789ull,
+      ~0ull}) {
+    size_t bucket = Histogram::bucket(value);
+    ASSERT_LT(bucket, Histogram::kBuckets);
+    EXPECT_GE(Histogram::bucketLimit(bucket), value);
+    if (bucket > 0) {
+      EXPECT_LT(Histogram::bucketLimit(bucket - 1), value);
+    }
+  }
+}
+
+TEST(HistogramTest, percentiles) {
+  Histogram hist;
+  EXPECT_EQ(hist.percentile(0.5), 0);
+  for (u64 i = 1; i <= 1000; ++i) {
+    hist.record(i * 1000);
+  }
+  EXPECT_EQ(hist.count(), 1000);
+  EXPECT_EQ(hist.max(), 1000000);
+  EXPECT_NEAR(hist.percentile(0.5), 500000, 500000 / 8);
+  EXPECT_NEAR(hist.percentile(0.99), 990000, 990000 / 8);
+  EXPECT_EQ(hist.percentile(1.0), 1000000);
+  EXPECT_EQ(hist.sum(), 500500000);
+  EXPECT_EQ(hist.countAtMost(Histogram::bucketLimit(Histogram::bucket(1000))),
+      1);
+  EXPECT_EQ(hist.countAtMost(~0ull), 1000);
+}
+
+TEST(MetricsTest, counters) {
+  Metrics metrics;
+  Metrics::Counter unregistered;
+  unregistered.add();
+  auto requests = metrics.counter("requests", "Requests",
+      Metrics::label("command", "info \"stats\""));
+  auto again = metrics.counter("requests", "Requests",
+      Metrics::label("command", "info \"stats\""));
+  auto other = metrics.counter("requests", "Requests",
+      Metrics::label("command", "info logs"));
+  auto depth = metrics.gauge("depth", "Queue depth");
+  requests.add();
+  again.add(2);
+  other.add();
+  depth.add(5);
+  depth.sub(7);
+  EXPECT_THROW(metrics.gauge("requests", "Requests",
+        Metrics::label("command", "info logs")), std::exception);
+  auto samples = metrics.snapshot();
+  ASSERT_EQ(samples.size(), 3);
+  EXPECT_EQ(samples[0].labels, "command=\"info \\\"stats\\\"\"");
+  EXPECT_EQ(samples[0].value, 3);
+  EXPECT_EQ(samples[1].value, 1);
+  EXPECT_EQ(samples[2].type, Metrics::GAUGE);
+  EXPECT_EQ(samples[2].value, -2);
+}
+
+TEST(MetricsTest, threads) {
+  Metrics metrics;
+  auto counter = metrics.counter("adds", "Adds");
+  const int kThreads = 8;
+  const int kAdds = 100000;
+  std::vector<pthread_t> threads(kThreads);
+  for (auto& thread : threads) {
+    pthread_create(&thread, nullptr, [](void* arg) -> void* {
+      auto counter = (Metrics::Counter*)arg;
+      for (int i = 0; i < kAdds; ++i) {
+        counter->add();
+      }
+      return nullptr;
+    }, &counter);
+  }
+  for (auto& thread : threads) {
+    pthread_join(thread, nullptr);
+  }
+  EXPECT_EQ(metrics.snapshot()[0].value, kThreads * kAdds);
+}
@@ -0,0 +1,150 @@
+#include "openmetrics.h"
+#include "context.h"
+#include "logger.h"
+#include "latency.h"
+#include "command.h"
+#include "commandmanager.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace {
+void appendLabels(std::string& out, const std::string& labels,
+    const char* extra = nullptr) {
+  if (labels.empty() && !extra) {
+    return;
+  }
+  out += '{';
+  out += labels;
+  if (extra) {
+    if (!labels.empty()) {
+      out += ',';
+    }
+    out += extra;
+  }
+  out += '}';
+}
+
+// Bucket bounds: powers of two nanoseconds from about a microsecond to a
+// minute, fixed so that every scrape exposes the same series
+const int kMinBucketShift = 10;
+const int kMaxBucketShift = 36;
+}
+
+void OpenMetrics::family(std::string& out, const std::string& name,
+    const char* type, const std::string& help) {
+  out += "# TYPE ";
+  out += name;
+  out += ' ';
+  out += type;
+  out += "\n# HELP ";
+  out += name;
+  out += ' ';
+  out += help;
+  out += '\n';
+}
+
+void OpenMetrics::sample(std::string& out, const std::string& name,
+    const std::string& labels, int64_t value) {
+  char buf[32];
+  out += name;
+  appendLabels(out, labels);
+  int len = snprintf(buf, sizeof(buf), " %lld\n", (long long)value);
+  out.append(buf, len);
+}
+
+void OpenMetrics::sample(std::string& out, const std::string& name,
+    const std::string& labels, double value) {
+  char buf[48];
+  out += name;
+  appendLabels(out, labels);
+  int len = snprintf(buf, sizeof(buf), " %.9g\n", value);
+  out.append(buf, len);
+}
+
+void OpenMetrics::histogram(std::string& out, const std::string& name,
+    const std::string& labels, const Histogram& hist) {
+  char le[48];
+  // Read count first, buckets recorded later only make them larger
+  u64 count = hist.count();
+  for (int shift = kMinBucketShift; shift <= kMaxBucketShift; ++shift) {
+    u64 limit = (1ull << shift) - 1;
+    snprintf(le, sizeof(le), "le=\"%.9g\"", (limit + 1) / 1e9);
+    out += name;
+    out += "_bucket";
+    appendLabels(out, labels, le);
+    snprintf(le, sizeof(le), " %llu\n",
+        (unsigned long long)std::min(hist.countAtMost(limit), count));
+    out += le;
+  }
+  out += name;
+  out += "_bucket";
+  appendLabels(out, labels, "le=\"+Inf\"");
+  snprintf(le, sizeof(le), " %llu\n", (unsigned long long)count);
+  out += le;
+  sample(out, name + "_count", labels, (int64_t)count);
+  sample(out, name + "_sum", labels, hist.sum() / 1e9);
+}
+
+void OpenMetrics::metrics(std::string& out,
+    std::vector<Metrics::Sample> samples) {
+  std::stable_sort(samples.begin(), samples.end(),
+      [](const Metrics::Sample& lhs, const Metrics::Sample& rhs) {
+        return lhs.name < rhs.name;
+      });
+  const std::string* current = nullptr;
+  for (const auto& sample : samples) {
+    if (!current || *current != sample.name) {
+      static const char* const kTypes[] = {"counter", "gauge", "histogram"};
+      family(out, sample.name, kTypes[sample.type], sample.help);
+      current = &sample.name;
+    }
+    switch (sample.type) {
+      case Metrics::COUNTER:
+        OpenMetrics::sample(out, sample.name + "_total", sample.labels,
+            sample.value);
+        break;
+      case Metrics::GAUGE:
+        OpenMetrics::sample(out, sample.name, sample.labels, sample.value);
+        break;
+      case Metrics::HISTOGRAM:
+        histogram(out, sample.name, sample.labels, *sample.histogram);
+        break;
+    }
+  }
+}
+
+void OpenMetrics::render(std::string& out, const Context* context) {
+  if (context->metrics) {
+    metrics(out, context->metrics->snapshot());
+  }
+  family(out, "holper_log_dropped_records", "counter",
+      "Log records dropped because a logging thread's ring was full");
+  sample(out, "holper_log_dropped_records_total", "",
+      (int64_t)context->logger->dropped());
+  family(out, "holper_start_time_seconds", "gauge",
+      "Time the daemon started, in seconds since the epoch");
+  sample(out, "holper_start_time_seconds", "",
+      context->stats.startRealTime.value());
+  if (context->latency && context->commandManager) {
+    family(out, "holper_stage_duration_seconds", "histogram",
+        "Time requests spent in each stage of the pipeline");
+    std::string labels;
+    for (size_t i = 0; i < context->commandManager->size(); ++i) {
+      std::string command = Metrics::label("command",
+          context->commandManager->node(i)->path());
+      for (int stage = 0; stage < LatencyStats::STAGE_COUNT; ++stage) {
+        const Histogram* hist = context->latency->histogram(i,
+            (LatencyStats::Stage)stage);
+        if (!hist || hist->count() == 0) {
+          continue;
+        }
+        labels = command;
+        labels += ',';
+        labels += Metrics::label("stage",
+            LatencyStats::stageName((LatencyStats::Stage)stage));
+        histogram(out, "holper_stage_duration_seconds", labels, *hist);
+      }
+    }
+  }
+  out += "# EOF\n";
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "metrics.h"
+
+class Context;
+
+// Renders metrics in the OpenMetrics text format. Everything is appended to
+// the caller's buffer so that a buffer reused between scrapes stops
+// allocating once it has grown to the size of a scrape.
+namespace OpenMetrics {
+  void family(std::string& out, const std::string& name, const char* type,
+      const std::string& help);
+  void sample(std::string& out, const std::string& name,
+      const std::string& labels, int64_t value);
+  void sample(std::string& out, const std::string& name,
+      const std::string& labels, double value);
+  // Histogram of nanoseconds as _bucket, _count and _sum samples in seconds
+  void histogram(std::string& out, const std::string& name,
+      const std::string& labels, const Histogram& hist);
+  // Registry samples, grouped into families by name
+  void metrics(std::string& out, std::vector<Metrics::Sample> samples);
+  // Everything the daemon exposes, terminated by # EOF
+  void render(std::string& out, const Context* context);
+}
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "openmetrics.h"
+
+TEST(OpenMetricsTest, families) {
+  Metrics metrics;
+  metrics.counter("holper_requests", "Requests",
+      Metrics::label("command", "info stats")).add(3);
+  metrics.gauge("holper_depth", "Depth").add(2);
+  metrics.counter("holper_requests", "Requests",
+      Metrics::label("command", "info logs")).add();
+  std::string out;
+  OpenMetrics::metrics(out, metrics.snapshot());
+  EXPECT_EQ(out,
+      "# TYPE holper_depth gauge\n"
+      "# HELP holper_depth Depth\n"
+      "holper_depth 2\n"
+      "# TYPE holper_requests counter\n"
+      "# HELP holper_requests Requests\n"
+      "holper_requests_total{command=\"info stats\"} 3\n"
+      "holper_requests_total{command=\"info logs\"} 1\n");
+}
+
+TEST(OpenMetricsTest, histogram) {
+  Histogram hist;
+  hist.record(500);
+  hist.record(3000);
+  hist.record(5000000);
+  std::string out;
+  OpenMetrics::histogram(out, "latency", "stage=\"parse\"", hist);
+  auto expect = [&](const std::string& line) {
+    EXPECT_NE(out.find(line + "\n"), std::string::npos) << line << " in\n"
+      << out;
+  };
+  expect("latency_bucket{stage=\"parse\",le=\"1.024e-06\"} 1");
+  expect("latency_bucket{stage=\"parse\",le=\"4.096e-06\"} 2");
+  expect("latency_bucket{stage=\"parse\",le=\"0.004194304\"} 2");
+  expect("latency_bucket{stage=\"parse\",le=\"0.008388608\"} 3");
+  expect("latency_bucket{stage=\"parse\",le=\"+Inf\"} 3");
+  expect("latency_count{stage=\"parse\"} 3");
+  expect("latency_sum{stage=\"parse\"} 0.0050035");
+}
@@ -0,0 +1,210 @@
+#include "passwords.h"
+#include "random.h"
+#include "thread.h"
+#include "exception.h"
+#include "string.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace {
+  const double kNone = -std::numeric_limits<double>::infinity();
+
+  // log(exp(a) + exp(b)) without overflowing
+  double logAdd(double a, double b) {
+    if (a == kNone) {
+      return b;
+    }
+    if (b == kNone) {
+      return a;
+    }
+    double hi = std::max(a, b);
+    return hi + std::log1p(std::exp(std::min(a, b) - hi));
+  }
+
+  double unitInterval() {
+    return (Random::u64() >> 11) * 0x1.0p-53;
+  }
+
+  template <typename T>
+  void shuffle(T* begin, size_t size) {
+    // Fisher-Yates
+    for (size_t i = size; i > 1; --i) {
+      std::swap(begin[i - 1], begin[Random::uniform(i)]);
+    }
+  }
+}
+
+PasswordPolicy::PasswordPolicy(int length, std::vector<CharClass> classes)
+    : classes_(std::move(classes)), length_(length) {
+  if (length_ <= 0 || length_ > kMaxLength) {
+    THROW("Password length must be between 1 and %d", kMaxLength);
+  }
+  // Classes must not share characters for generation to be uniform, a
+  // character in two classes would be counted twice
+  std::string seen;
+  for (auto& cls : classes_) {
+    cls.max = std::clamp(cls.max, 0, length_);
+    cls.min = std::clamp(cls.min, 0, cls.max);
+    if (cls.alphabet.empty()) {
+      cls.max = cls.min = 0;
+    }
+    for (char ch : cls.alphabet) {
+      if (seen.find(ch) != std::string::npos) {
+        THROW("Character %c is in more than one class", ch);
+      }
+      seen.push_back(ch);
+    }
+  }
+  logFactorial_.resize(length_ + 1);
+  for (int n = 0; n <= length_; ++n) {
+    logFactorial_[n] = std::lgamma(n + 1.0);
+  }
+  logWeights_.assign(classes_.size() + 1,
+      std::vector<double>(length_ + 1, kNone));
+  logWeights_[0][0] = 0;
+  for (size_t k = 1; k <= classes_.size(); ++k) {
+    const CharClass& cls = classes_[k - 1];
+    double logSize = cls.alphabet.empty() ? 0 :
+      std::log((double)cls.alphabet.size());
+    for (int n = 0; n <= length_; ++n) {
+      double total = kNone;
+      for (int c = cls.min; c <= std::min(cls.max, n); ++c) {
+        double prev = logWeights_[k - 1][n - c];
+        if (prev != kNone) {
+          total = logAdd(total, prev + c * logSize - logFactorial_[c]);
+        }
+      }
+      logWeights_[k][n] = total;
+    }
+  }
+  double last = logWeights_[classes_.size()][length_];
+  if (last == kNone) {
+    THROW("No password of length %d fits the class limits", length_);
+  }
+  entropy_ = (logFactorial_[length_] + last) / std::log(2.0);
+}
+
+void PasswordPolicy::generate(std::string& out) const {
+  size_t start = out.size();
+  int remaining = length_;
+  // Picks how many characters each class gets with the probability of that
+  // split among all allowed passwords, last class first
+  for (size_t k = classes_.size(); k > 0; --k) {
+    const CharClass& cls = classes_[k - 1];
+    double logSize = cls.alphabet.empty() ? 0 :
+      std::log((double)cls.alphabet.size());
+    double target = unitInterval();
+    double total = logWeights_[k][remaining];
+    int count = cls.min;
+    double sum = 0;
+    for (int c = cls.min; c <= std::min(cls.max, remaining); ++c) {
+      double prev = logWeights_[k - 1][remaining - c];
+      if (prev == kNone) {
+        continue;
+      }
+      count = c;
+      sum += std::exp(prev + c * logSize - logFactorial_[c] - total);
+      if (target < sum) {
+        break;
+      }
+    }
+    for (int i = 0; i < count; ++i) {
+      out.push_back(cls.alphabet[Random::uniform(cls.alphabet.size())]);
+    }
+    remaining -= count;
+  }
+  shuffle(&out[start], out.size() - start);
+}
+
+struct WordList::Mapping {
+  void* data = MAP_FAILED;
+  size_t size = 0;
+  ~Mapping() {
+    if (data != MAP_FAILED) {
+      munmap(data, size);
+    }
+  }
+};
+
+std::shared_ptr<const WordList> WordList::load(const std::string& path) {
+  static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  struct Cached {
+    struct stat stat;
+    std::shared_ptr<const WordList> list;
+  };
+  static std::map<std::string, Cached> cache;
+
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    THROW("Cannot open %s: %s", path.c_str(), St::errorString().c_str());
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    THROW("Cannot stat %s: %s", path.c_str(), St::errorString().c_str());
+  }
+  LockMutex lock(&mutex);
+  auto it = cache.find(path);
+  if (it != cache.end() && it->second.stat.st_ino == st.st_ino &&
+      it->second.stat.st_size == st.st_size &&
+      it->second.stat.st_mtim.tv_sec == st.st_mtim.tv_sec &&
+      it->second.stat.st_mtim.tv_nsec == st.st_mtim.tv_nsec) {
+    close(fd);
+    return it->second.list;
+  }
+  auto mapping = std::make_shared<Mapping>();
+  mapping->size = st.st_size;
+  if (mapping->size) {
+    mapping->data = mmap(nullptr, mapping->size, PROT_READ, MAP_PRIVATE, fd,
+        0);
+  }
+  close(fd);
+  if (mapping->size && mapping->data == MAP_FAILED) {
+    THROW("Cannot map %s: %s", path.c_str(), St::errorString().c_str());
+  }
+  std::shared_ptr<WordList> list(new WordList);
+  list->mapping_ = mapping;
+  std::string_view text((const char*)mapping->data, mapping->size);
+  while (!text.empty()) {
+    size_t end = text.find('\n');
+    std::string_view line = text.substr(0, end);
+    text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+    size_t last = line.find_last_not_of(" \t\r");
+    if (last == std::string_view::npos) {
+      continue;
+    }
+    line = line.substr(0, last + 1);
+    size_t first = line.find_last_of(" \t");
+    list->words_.push_back(first == std::string_view::npos ? line :
+        line.substr(first + 1));
+  }
+  // duplicates would make the entropy look better than it is
+  std::sort(list->words_.begin(), list->words_.end());
+  list->words_.erase(std::unique(list->words_.begin(), list->words_.end()),
+      list->words_.end());
+  if (list->words_.size() < 2) {
+    THROW("%s has fewer than 2 distinct words", path.c_str());
+  }
+  cache[path] = Cached{st, list};
+  return list;
+}
+
+double WordList::entropyBits(int words) const {
+  return words * std::log2((double)words_.size());
+}
+
+void WordList::generate(std::string& out, int count,
+    std::string_view separator) const {
+  for (int i = 0; i < count; ++i) {
+    if (i) {
+      out.append(separator);
+    }
+    out.append(words_[Random::uniform(words_.size())]);
+  }
+}
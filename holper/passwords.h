@@ -0,0 +1,55 @@
+#pragma once
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Password policies are compiled once per request so that generating many
+// passwords is a single pass each. Generation is uniform over every string
+// the policy allows, which makes the entropy exact rather than a guess.
+class PasswordPolicy
+{
+public:
+  struct CharClass {
+    std::string alphabet;
+    int min;
+    int max;
+  };
+private:
+  std::vector<CharClass> classes_;
+  int length_;
+  // logWeights_[k][n]: natural log of the number of ways to fill n
+  // positions from the first k classes, divided by n!
+  std::vector<std::vector<double>> logWeights_;
+  std::vector<double> logFactorial_;
+  double entropy_;
+public:
+  static const int kMaxLength = 1024;
+  // Throws when no password of this length satisfies the class bounds
+  PasswordPolicy(int length, std::vector<CharClass> classes);
+  int length() const { return length_; }
+  // log2 of the number of passwords the policy allows
+  double entropyBits() const { return entropy_; }
+  // Appends one password to out
+  void generate(std::string& out) const;
+};
+
+// Words of a diceware style list, one per line. EFF lists with a dice roll
+// column are accepted, only the last field of a line is used. The file is
+// mapped and shared by every passphrase generated from it.
+class WordList
+{
+  struct Mapping;
+  std::shared_ptr<Mapping> mapping_;
+  std::vector<std::string_view> words_;
+  WordList() {}
+public:
+  // Cached by path, reloaded when the file changes
+  static std::shared_ptr<const WordList> load(const std::string& path);
+  size_t size() const { return words_.size(); }
+  const std::string_view& operator[](size_t i) const { return words_[i]; }
+  double entropyBits(int words) const;
+  // Appends count words joined by separator to out
+  void generate(std::string& out, int count, std::string_view separator)
+    const;
+};
@@ -0,0 +1,87 @@
+#include <gtest/gtest.h>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <set>
+#include <unistd.h>
+#include "passwords.h"
+
+namespace {
+  int countIn(const std::string& str, const std::string& alphabet) {
+    int count = 0;
+    for (char ch : str) {
+      count += alphabet.find(ch) != std::string::npos;
+    }
+    return count;
+  }
+}
+
+TEST(PasswordPolicyTest, bounds) {
+  PasswordPolicy policy(12, {
+    {"abcdefghijklmnopqrstuvwxyz", 1, 12},
+    {"0123456789", 2, 3},
+    {"!@#", 1, 1},
+  });
+  std::string out;
+  for (int i = 0; i < 1000; ++i) {
+    out.clear();
+    policy.generate(out);
+    ASSERT_EQ(out.size(), 12u);
+    int digits = countIn(out, "0123456789");
+    EXPECT_GE(digits, 2);
+    EXPECT_LE(digits, 3);
+    EXPECT_EQ(countIn(out, "!@#"), 1);
+  }
+  EXPECT_THROW(PasswordPolicy(3, {{"ab", 2, 3}, {"cd", 2, 3}}),
+      std::exception);
+  EXPECT_THROW(PasswordPolicy(3, {{"ab", 0, 1}}), std::exception);
+  EXPECT_THROW(PasswordPolicy(3, {{"ab", 0, 3}, {"bc", 0, 3}}),
+      std::exception);
+}
+
+TEST(PasswordPolicyTest, entropy) {
+  PasswordPolicy plain(8, {{"abcdefghijklmnopqrstuvwxyz", 0, 8}});
+  EXPECT_NEAR(plain.entropyBits(), 8 * std::log2(26.0), 1e-9);
+  // exactly one digit: 4 positions * 10 digits * 2^3 letters
+  PasswordPolicy mixed(4, {{"ab", 0, 4}, {"0123456789", 1, 1}});
+  EXPECT_NEAR(mixed.entropyBits(), std::log2(4 * 10 * 8.0), 1e-9);
+}
+
+TEST(PasswordPolicyTest, uniform) {
+  // 2 letters + exactly one digit: "a0" style strings, 3 * 2 * 2 * 2 = 24
+  PasswordPolicy policy(3, {{"ab", 0, 3}, {"01", 1, 1}});
+  EXPECT_NEAR(policy.entropyBits(), std::log2(24.0), 1e-9);
+  std::map<std::string, int> seen;
+  const int kDraws = 48000;
+  std::string out;
+  for (int i = 0; i < kDraws; ++i) {
+    out.clear();
+    policy.generate(out);
+    seen[out] += 1;
+  }
+  EXPECT_EQ(seen.size(), 24u);
+  for (const auto& [password, count] : seen) {
+    EXPECT_NEAR(count, kDraws / 24, kDraws / 24 / 5) << password;
+  }
+}
+
+TEST(WordListTest, load) {
+  char path[] = "/tmp/holperwordsXXXXXX";
+  int fd = mkstemp(path);
+  ASSERT_GE(fd, 0);
+  std::string words = "11111\tapple\n11112\tbanana\n\n11113 cherry\r\n"
+    "11114\tapple\n";
+  ASSERT_EQ(write(fd, words.data(), words.size()), (ssize_t)words.size());
+  close(fd);
+  auto list = WordList::load(path);
+  ASSERT_EQ(list->size(), 3u);
+  EXPECT_EQ((*list)[0], "apple");
+  EXPECT_EQ((*list)[2], "cherry");
+  EXPECT_EQ(WordList::load(path), list);
+  EXPECT_NEAR(list->entropyBits(4), 4 * std::log2(3.0), 1e-9);
+  std::string out;
+  list->generate(out, 4, "-");
+  EXPECT_EQ(std::count(out.begin(), out.end(), '-'), 3);
+  unlink(path);
+  EXPECT_THROW(WordList::load(path), std::exception);
+}
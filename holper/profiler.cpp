@@ -1,33 +1,196 @@
 #include "profiler.h"
+#include <atomic>
+#include <ctime>
+#include <sstream>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
-std::string Profiler::str() {
+namespace {
+struct TickClock {
+  std::atomic<bool> tsc = false;
+  double nsPerTick = 1.0;
+};
+
+TickClock tickClock;
+
+// Without an invariant TSC the counter can stop or change rate with the
+// core's frequency and differ between cores
+bool invariantTsc() {
+#if defined(__x86_64__)
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000000, &eax, &ebx, &ecx, &edx) ||
+      eax < 0x80000007) {
+    return false;
+  }
+  __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+  return edx & (1u << 8);
+#else
+  return false;
+#endif
+}
+
+int64_t monotonicNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ll + ts.tv_nsec;
+}
+
+const char* const kEventNames[] = {
+  "Read program options",
+  "Constructed payload",
+  "Sent data",
+  "Received data",
+  "Received by Resolver",
+  "Payload json parsed",
+  "Resolved command",
+  "Received by WorkPool",
+  "Received by WorkPoolWorker",
+  "Validated with parameter spec",
+  "Received by Responder",
+  "sendResponse called",
+  "Write started",
+  "Write finished",
+};
+static_assert(sizeof(kEventNames) / sizeof(kEventNames[0]) ==
+    Profiler::EVENT_COUNT, "every profiler event needs a name");
+}
+
+const char* Profiler::name(Event event) {
+  if (event >= EVENT_COUNT) {
+    return "Unknown";
+  }
+  return kEventNames[event];
+}
+
+void Profiler::calibrate() {
+#if defined(__x86_64__)
+  static pthread_once_t once = PTHREAD_ONCE_INIT;
+  pthread_once(&once, []() {
+    if (!invariantTsc()) {
+      return;
+    }
+    // against the monotonic clock over a millisecond
+    TimePoint start;
+    uint64_t startTicks = __rdtsc();
+    TimePoint end;
+    do {
+      end = TimePoint();
+    } while ((end - start).ns() < 1000000);
+    uint64_t endTicks = __rdtsc();
+    tickClock.nsPerTick = (end - start).ns() / (double)(endTicks - startTicks);
+    tickClock.tsc.store(true, std::memory_order_release);
+  });
+#endif
+}
+
+uint64_t Profiler::ticks() {
+  return ticks(tickClock.tsc.load(std::memory_order_acquire));
+}
+
+uint64_t Profiler::ticks(bool tsc) {
+#if defined(__x86_64__)
+  if (tsc) {
+    return __rdtsc();
+  }
+#else
+  (void)tsc;
+#endif
+  return monotonicNs();
+}
+
+namespace {
+pid_t currentTid() {
+  thread_local pid_t tid = gettid();
+  return tid;
+}
+}
+
+Profiler::Profiler() : Profiler(TimePoint()) {}
+
+Profiler::Profiler(const TimePoint& start)
+    : startNs_(start.ns()),
+      tsc_(tickClock.tsc.load(std::memory_order_acquire)) {
+  anchorTicks_ = ticks(tsc_);
+  anchorNs_ = TimePoint().ns();
+}
+
+void Profiler::insert(const Record& record) {
+  if (size_ == kMaxEvents) {
+    dropped_ += 1;
+    return;
+  }
+  // Events nearly always arrive in order, keep them sorted by time
+  size_t i = size_;
+  while (i > 0 && events_[i - 1].ns > record.ns) {
+    events_[i] = events_[i - 1];
+    --i;
+  }
+  events_[i] = record;
+  size_ += 1;
+}
+
+void Profiler::event(Event event) {
+  int64_t elapsed = (int64_t)(ticks(tsc_) - anchorTicks_);
+  if (tsc_) {
+    elapsed = (int64_t)(elapsed * tickClock.nsPerTick);
+  }
+  insert(Record{anchorNs_ + elapsed, "", currentTid(), event});
+}
+
+void Profiler::event(Event event, const TimePoint& tp) {
+  insert(Record{tp.ns(), "", currentTid(), event});
+}
+
+int64_t Profiler::since(Event event) const {
+  for (size_t i = 0; i < size_; ++i) {
+    if (events_[i].event == event) {
+      return events_[i].ns - startNs_;
+    }
+  }
+  return -1;
+}
+
+std::string Profiler::str() const {
   std::stringstream ss;
   TimePoint now;
-  ss << "Started " << (now - start_).str() << " ago\n";
+  ss << "Started " << (now - TimePoint::fromNs(startNs_)).str() << " ago\n";
   ss << "Events: \n";
-  for (const auto& event : events_ ) {
-    ss << "  " << event.second << ": " << (event.first - start_).str() << "\n";
+  for (size_t i = 0; i < size_; ++i) {
+    const Record& record = events_[i];
+    ss << "  " << record.prefix << name(record.event) << ": "
+      << TimeDelta::fromNs(record.ns - startNs_).str() << "\n";
+  }
+  if (dropped_) {
+    ss << "  (" << dropped_ << " events dropped)\n";
   }
   return ss.str();
 }
 
-rapidjson::Value Profiler::json(rapidjson::Document::AllocatorType& alloc) {
+rapidjson::Value Profiler::json(
+    rapidjson::Document::AllocatorType& alloc) const {
   rapidjson::Value val(rapidjson::kArrayType);
-  for (const auto& event : events_ ) {
+  std::string st;
+  for (size_t i = 0; i < size_; ++i) {
+    const Record& record = events_[i];
+    st = record.prefix;
+    st += name(record.event);
     rapidjson::Value elem(rapidjson::kArrayType);
-    elem.PushBack(
-      rapidjson::Value(event.second.c_str(), event.second.size(), alloc),
-      alloc);
-    elem.PushBack(
-      rapidjson::Value((event.first - start_).value()),
-      alloc);
+    elem.PushBack(rapidjson::Value(st.c_str(), st.size(), alloc), alloc);
+    elem.PushBack(rapidjson::Value((record.ns - startNs_) / 1e9), alloc);
     val.PushBack(elem, alloc);
   }
   return val;
 }
 
-void Profiler::join(const Profiler& prof, std::string prefix) {
-  for (const auto& prof_event : prof.events_) {
-    event(prefix + prof_event.second, prof_event.first);
+void Profiler::join(const Profiler& prof, const char* prefix) {
+  for (size_t i = 0; i < prof.size_; ++i) {
+    Record record = prof.events_[i];
+    record.prefix = prefix;
+    insert(record);
   }
+  dropped_ += prof.dropped_;
 }
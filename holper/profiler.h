@@ -1,24 +1,88 @@
 #pragma once
-#include <sstream>
-#include <vector>
-#include <utility>
+#include <array>
 #include <string>
-#include <map>
+#include <cstdint>
+#include <sys/types.h>
 #include "time.h"
 #include <rapidjson/document.h>
 
+// Records when a request reaches each stage of the pipeline. Events are
+// fixed ids stored inline with raw clock ticks; names and seconds are only
+// worked out when a profile is rendered, so recording never allocates.
 class Profiler
 {
-  TimePoint start_;
-  std::multimap<TimePoint, std::string> events_;
 public:
-  Profiler() {}
-  Profiler(const TimePoint& start) : start_(start) {}
-  void event(const std::string& name, const TimePoint tp = TimePoint()) {
-    events_.insert(std::make_pair(tp, name));
+  enum Event : uint8_t {
+    READ_OPTIONS,
+    CONSTRUCTED_PAYLOAD,
+    SENT_DATA,
+    RECEIVED_DATA,
+    RECEIVED_BY_RESOLVER,
+    PAYLOAD_PARSED,
+    RESOLVED_COMMAND,
+    RECEIVED_BY_WORKPOOL,
+    RECEIVED_BY_WORKER,
+    VALIDATED,
+    RECEIVED_BY_RESPONDER,
+    SEND_RESPONSE_CALLED,
+    WRITE_STARTED,
+    WRITE_FINISHED,
+    EVENT_COUNT,
+  };
+  static constexpr size_t kMaxEvents = 32;
+  static const char* name(Event event);
+  // Switches profilers created afterwards to the cycle counter when the
+  // CPU has an invariant TSC. Spins for a millisecond to calibrate it, so
+  // only the daemon calls this, the client stays on CLOCK_MONOTONIC.
+  static void calibrate();
+  // Cycle counter once calibrated, CLOCK_MONOTONIC nanoseconds otherwise
+  static uint64_t ticks();
+private:
+  struct Record {
+    int64_t ns;
+    const char* prefix;
+    pid_t tid;
+    Event event;
+  };
+  int64_t startNs_;
+  // Ticks are converted relative to a per profiler anchor so that
+  // calibration error can't accumulate over the daemon's lifetime
+  uint64_t anchorTicks_;
+  int64_t anchorNs_;
+  // whether ticks are cycles, fixed at construction
+  bool tsc_;
+  static uint64_t ticks(bool tsc);
+  std::array<Record, kMaxEvents> events_;
+  size_t size_ = 0;
+  size_t dropped_ = 0;
+  void insert(const Record& record);
+public:
+  Profiler();
+  Profiler(const TimePoint& start);
+  void event(Event event);
+  void event(Event event, const TimePoint& tp);
+  // fn(time, tid of the recording thread, prefix, event name), in order
+  template <typename Fn>
+  void forEach(Fn fn) const {
+    for (size_t i = 0; i < size_; ++i) {
+      const Record& record = events_[i];
+      fn(TimePoint::fromNs(record.ns), record.tid, record.prefix,
+          name(record.event));
+    }
+  }
+  TimePoint start() const {
+    return TimePoint::fromNs(startNs_);
+  }
+  // Nanoseconds from start to the first occurrence of event, -1 if missing
+  int64_t since(Event event) const;
+  size_t size() const {
+    return size_;
+  }
+  size_t dropped() const {
+    return dropped_;
   }
-  std::string str();
-  void join(const Profiler& prof, std::string prefix);
-  Profiler& operator+=(const Profiler& prof);
-  rapidjson::Value json(rapidjson::Document::AllocatorType& alloc);
+  std::string str() const;
+  // prefix must outlive this profiler, in practice a string literal
+  void join(const Profiler& prof, const char* prefix);
+  rapidjson::Value json(rapidjson::Document::AllocatorType& alloc) const;
 };
@@ -10,7 +10,7 @@ struct FastForwardableProfiler {
   void fastForward(double secs) {
     now += secs;
   }
-  void event(const std::string& event) {
+  void event(Profiler::Event event) {
     profiler.event(event, now);
   }
 };
@@ -27,7 +27,7 @@ protected:
   void fastForward(double secs) {
     profiler.fastForward(secs);
   }
-  void event(const std::string& event) {
+  void event(Profiler::Event event) {
     profiler.event(event);
   }
   std::vector<std::pair<std::string, double>> events() {
@@ -45,36 +45,62 @@ protected:
 
 TEST_F(ProfilerTest, profile) {
   EXPECT_TRUE(events().empty());
-  event("start");
+  event(Profiler::SENT_DATA);
   fastForward(1.0);
-  event("end");
+  event(Profiler::RECEIVED_DATA);
   auto ev = events();
   ASSERT_EQ(ev.size(), 2);
-  EXPECT_STREQ(ev[0].first.c_str(), "start");
+  EXPECT_STREQ(ev[0].first.c_str(), "Sent data");
   EXPECT_NEAR(ev[0].second, 0.0, 0.0001);
-  EXPECT_STREQ(ev[1].first.c_str(), "end");
+  EXPECT_STREQ(ev[1].first.c_str(), "Received data");
   EXPECT_NEAR(ev[1].second, 1.0, 0.0001);
 }
 
 TEST_F(ProfilerTest, combine) {
   EXPECT_TRUE(events().empty());
   FastForwardableProfiler ffp(profiler.now + 0.5);
-  event("start");
+  event(Profiler::RECEIVED_BY_RESOLVER);
   fastForward(1.0);
-  event("end");
-  ffp.event("start2");
+  event(Profiler::RECEIVED_BY_RESPONDER);
+  ffp.event(Profiler::RECEIVED_BY_WORKPOOL);
   ffp.fastForward(1.0);
-  ffp.event("end2");
+  ffp.event(Profiler::RECEIVED_BY_WORKER);
   profiler.profiler.join(ffp.profiler, "ffp_");
   auto ev = events();
   ASSERT_EQ(ev.size(), 4);
-  EXPECT_STREQ(ev[0].first.c_str(), "start");
+  EXPECT_STREQ(ev[0].first.c_str(), "Received by Resolver");
   EXPECT_NEAR(ev[0].second, 0.0, 0.0001);
-  EXPECT_STREQ(ev[1].first.c_str(), "ffp_start2");
+  EXPECT_STREQ(ev[1].first.c_str(), "ffp_Received by WorkPool");
   EXPECT_NEAR(ev[1].second, 0.5, 0.0001);
-  EXPECT_STREQ(ev[2].first.c_str(), "end");
+  EXPECT_STREQ(ev[2].first.c_str(), "Received by Responder");
   EXPECT_NEAR(ev[2].second, 1.0, 0.0001);
-  EXPECT_STREQ(ev[3].first.c_str(), "ffp_end2");
+  EXPECT_STREQ(ev[3].first.c_str(), "ffp_Received by WorkPoolWorker");
   EXPECT_NEAR(ev[3].second, 1.5, 0.0001);
 }
 
+TEST_F(ProfilerTest, ticks) {
+  // on CLOCK_MONOTONIC first, then on the cycle counter if there is one
+  for (int calibrated = 0; calibrated < 2; ++calibrated) {
+    if (calibrated) {
+      Profiler::calibrate();
+    }
+    Profiler prof;
+    prof.event(Profiler::WRITE_STARTED);
+    TimePoint before;
+    while ((TimePoint() - before).value() < 0.01) {}
+    prof.event(Profiler::WRITE_FINISHED);
+    int64_t elapsed = prof.since(Profiler::WRITE_FINISHED) -
+      prof.since(Profiler::WRITE_STARTED);
+    EXPECT_NEAR(elapsed / 1e9, 0.01, 0.005);
+    EXPECT_LT(prof.since(Profiler::VALIDATED), 0);
+  }
+}
+
+TEST_F(ProfilerTest, capacity) {
+  for (size_t i = 0; i < Profiler::kMaxEvents + 3; ++i) {
+    event(Profiler::VALIDATED);
+  }
+  EXPECT_EQ(profiler.profiler.size(), Profiler::kMaxEvents);
+  EXPECT_EQ(profiler.profiler.dropped(), 3);
+}
+
@@ -7,216 +7,287 @@
 #include "request.h"
 #include "logger.h"
 #include "workpool.h"
-#include <pulse/pulseaudio.h>
+#include "exception.h"
+#include "pulseclient.h"
 #include <algorithm>
-void pulse_callback(pa_context *context, void *userdata);
+#include <cmath>
 
-enum class PulseState
-{
-  CONNECTING,
-  CONNECTED,
-  ERROR,
-};
+namespace {
+  typedef PulseClient::Node Node;
 
-class PulseAudio
-{
-private:
-  PulseState state_;
-  pa_mainloop* mainloop_;
-  pa_context* pulseContext_;
-  std::string defaultSinkName_;
-  const pa_sink_info* defaultSink_;
-  Context* context_;
-  static void pulseSuccessCallback(pa_context* UNUSED(c), int UNUSED(success),
-      void* UNUSED(p)) {}
-  static void pulseServerInfoCallback(pa_context* UNUSED(c),
-      const pa_server_info *i, void* p) {
-    reinterpret_cast<PulseAudio*>(p)->defaultSinkName_ = i->default_sink_name;
-  }
-
-  static void pulseContextStateCallback(pa_context *context, void* userdata) {
-    PulseAudio* pa = reinterpret_cast<PulseAudio*>(userdata);
-    // TODO: call pa->callback(context)
-    pa_context_state_t state = pa_context_get_state(context);
-    switch(state) {
-      default:
-        pa->context_->logger->debug("What's %d?\n", (int)state);
-        return;
-      case PA_CONTEXT_UNCONNECTED:
-        pa->context_->logger->debug("PulseAudio state: PA_CONTEXT_UNCONNECTED");
-        break;
-      case PA_CONTEXT_CONNECTING:
-        pa->context_->logger->debug("PulseAudio state: PA_CONTEXT_CONNECTING");
-        break;
-      case PA_CONTEXT_AUTHORIZING:
-        pa->context_->logger->debug("PulseAudio state: PA_CONTEXT_AUTHORIZING");
-        break;
-      case PA_CONTEXT_SETTING_NAME:
-        pa->context_->logger->debug("PulseAudio state: PA_CONTEXT_SETTING_NAME");
-        break;
-      case PA_CONTEXT_TERMINATED:
-        pa->context_->logger->debug("PulseAudio state: PA_CONTEXT_TERMINATED");
-        break;
-      case PA_CONTEXT_READY:
-        pa->context_->logger->debug("PulseAudio state: PA_CONTEXT_READY");
-        pa->state_ = PulseState::CONNECTED;
-        break;
-      case PA_CONTEXT_FAILED:
-        pa->context_->logger->debug("PulseAudio state: PA_CONTEXT_FAILED");
-        pa->logError("failed to connect");
-        pa->state_ = PulseState::ERROR;
-        break;
+  PulseClient& pulse(Context* context) {
+    if (!context->pulse) {
+      THROW("Not connected to PulseAudio");
     }
+    return *context->pulse;
   }
-  static void pulseSinkInfoCallback(pa_context* UNUSED(c),
-      const pa_sink_info* info, int eol, void* userdata) {
-    if (eol) {
-      return;
-    }
-    PulseAudio* pa = reinterpret_cast<PulseAudio*>(userdata);
-    if(pa->defaultSinkName_ != info->name) {
-      pa->logError("Received an irrelevant sink");
-      // TODO: error handling
-      return;
-    }
-    pa->defaultSink_ = info;
-  }
-  void logError(const char* msg) {
-      context_->logger->error("%s: %s",
-          msg, pa_strerror(pa_context_errno(pulseContext_)));
-  }
-  void iterate(pa_operation* op) {
-    int ret;
-    if (op == nullptr) {
-      while(state_ == PulseState::CONNECTING) {
-        if(pa_mainloop_iterate(mainloop_, 1, &ret) < 0) {
-          logError("Failed to iterate on connect");
-          break;
-        }
-      }
+
+  int percent(const Node& node) {
+    return (int)std::lround(100 * node.level());
+  }
+
+  void addString(rapidjson::Value& val, const char* key,
+      const std::string& str, rapidjson::Document::AllocatorType& alloc) {
+    val.AddMember(rapidjson::StringRef(key),
+        rapidjson::Value(str.c_str(), str.size(), alloc), alloc);
+  }
+
+  rapidjson::Value nodeJson(const Node& node,
+      const PulseClient::State& state,
+      rapidjson::Document::AllocatorType& alloc) {
+    rapidjson::Value val(rapidjson::kObjectType);
+    val.AddMember("kind",
+        rapidjson::StringRef(PulseClient::kindName(node.kind)), alloc);
+    val.AddMember("index", rapidjson::Value(node.index), alloc);
+    addString(val, "name", node.name, alloc);
+    addString(val, "description", node.description, alloc);
+    val.AddMember("volume", rapidjson::Value(percent(node)), alloc);
+    val.AddMember("mute", rapidjson::Value(node.mute), alloc);
+    if (node.kind == PulseClient::STREAM) {
+      val.AddMember("sink", rapidjson::Value(node.sink), alloc);
+      val.AddMember("pid", rapidjson::Value(node.pid), alloc);
     } else {
-      while (pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
-        if(pa_mainloop_iterate(mainloop_, 1, &ret) < 0) {
-          logError("Failed to iterate");
-          break;
-        }
+      const std::string& def = node.kind == PulseClient::SINK ?
+        state.defaultSink : state.defaultSource;
+      val.AddMember("default", rapidjson::Value(node.name == def), alloc);
+      val.AddMember("bluetooth", rapidjson::Value(node.bluetooth), alloc);
+    }
+    return val;
+  }
+
+  rapidjson::Value changesJson(const PulseClient::Changes& changes,
+      const PulseClient::State& state,
+      rapidjson::Document::AllocatorType& alloc) {
+    rapidjson::Value val(rapidjson::kArrayType);
+    for (const auto& [before, after] : changes) {
+      auto entry = nodeJson(after, state, alloc);
+      entry.AddMember("old_volume", rapidjson::Value(percent(before)), alloc);
+      entry.AddMember("old_mute", rapidjson::Value(before.mute), alloc);
+      if (after.kind == PulseClient::STREAM) {
+        entry.AddMember("old_sink", rapidjson::Value(before.sink), alloc);
       }
-      pa_operation_unref(op);
+      val.PushBack(entry, alloc);
     }
+    return val;
   }
-public:
-  PulseAudio(Context* context) : context_(context) {
-  }
-  ~PulseAudio() {
-    pa_context_disconnect(pulseContext_);
-    pa_context_unref(pulseContext_);
-    pa_mainloop_free(mainloop_);
-  }
-  void init() {
-    state_ = PulseState::CONNECTING;
-    mainloop_ = pa_mainloop_new();
-    if (!mainloop_) {
-      logError("mainloop failed");
-      // TODO: throw
-      return;
+
+  void changeLevel(Node& node, const Parameters& params) {
+    if (auto incr = params.get<int>("incr")) {
+      node.setLevel(std::clamp(node.level() + *incr * 0.01f, 0.0f, 2.0f));
+    } else if (auto set = params.get<int>("set")) {
+      node.setLevel(std::clamp(*set * 0.01f, 0.0f, 2.0f));
     }
-    pa_mainloop_api* api = pa_mainloop_get_api(mainloop_);
-    if (!api) {
-      logError("api failed");
-      return;
+  }
+
+  // Streams picked by the app, pid and index parameters, all of them
+  // when none is given
+  bool selected(const Node& node, const Parameters& params) {
+    if (node.kind != PulseClient::STREAM) {
+      return false;
     }
-    pulseContext_ = pa_context_new(api, "holper");
-    if (!pulseContext_) {
-      logError("context failed");
-      return;
+    if (auto index = params.get<int>("index")) {
+      if (node.index != (uint32_t)*index) {
+        return false;
+      }
     }
-    pa_context_set_state_callback(pulseContext_, pulseContextStateCallback, this);
-    if (pa_context_connect(pulseContext_, NULL, PA_CONTEXT_NOFLAGS, NULL) < 0) {
-      logError("context connect failed");
-      return;
+    if (auto pid = params.get<int>("pid")) {
+      if (node.pid != *pid) {
+        return false;
+      }
     }
-    iterate(nullptr);
-    if (state_ == PulseState::ERROR) {
-      logError("failed to connect\n");
-      return;
+    if (auto app = params.get<std::string_view>("app")) {
+      if (!std::equal(app->begin(), app->end(), node.description.begin(),
+            node.description.end(), [](char a, char b) {
+              return tolower(a) == tolower(b);
+            })) {
+        return false;
+      }
     }
-    iterate(pa_context_get_server_info(pulseContext_, pulseServerInfoCallback, this));
-    iterate(pa_context_get_sink_info_by_name(pulseContext_, defaultSinkName_.c_str(), pulseSinkInfoCallback, this));
+    return true;
   }
 
-  float getVolume() {
-    return pa_cvolume_avg(&defaultSink_->volume) * 1.0f / 65536;
+  void streamSpec(ParamSpec& spec) {
+    spec
+      .param<std::string>("app", "", "application name of the streams")
+      .param<int>("pid", "", "process playing the streams")
+      .param<int>("index", "", "stream index (see volume list)");
   }
-  void setVolume(float vol_perc) {
-    if (vol_perc < 0.0f) {
-      vol_perc = 0.0f;
-    } else if (vol_perc > 2.0f) {
-      vol_perc = 2.0f;
-    }
-    pa_cvolume cvol;
-    pa_cvolume_set(&cvol, defaultSink_->volume.channels,
-        (pa_volume_t)(vol_perc * 65536));
-    iterate(pa_context_set_sink_volume_by_name(pulseContext_,
-        defaultSinkName_.c_str(), &cvol, pulseSuccessCallback, this));
+
+  const char* kDeviceHelp =
+    "index, name, default or bluetooth (see volume list)";
+}
+
+// Volume of one sink or source, the default one unless named
+class DeviceVolumeAction : public Action
+{
+  PulseClient::Kind kind_;
+  const char* param_;
+public:
+  void spec(ParamSpec& spec) const override {
+    spec
+      .param<int>("set", "operations", "sets volume to value")
+      .param<int>("incr", "operations", "increments volume by value")
+      .param<std::nullptr_t>("mute", "operations", "Toggles mute/unmute")
+      .param<std::string>(param_, "", kDeviceHelp)
+      .key("operations", 0, 1);
   }
-  void setMute(bool mute) {
-    iterate(pa_context_set_sink_mute_by_name(pulseContext_, defaultSinkName_.c_str(),
-      (int)mute, pulseSuccessCallback, this));
+
+  rapidjson::Value actOn(Work* work) const override {
+    auto& params = work->parameters();
+    auto& alloc = work->allocator();
+    std::string_view name = params.get<std::string_view>(param_)
+      .value_or("default");
+    auto find = [&](PulseClient::State& state) -> Node& {
+      Node* node = state.find(kind_, name);
+      if (!node) {
+        THROW("No %s %.*s", PulseClient::kindName(kind_), (int)name.size(),
+            name.data());
+      }
+      return *node;
+    };
+    bool toggle = params.get<nullptr_t>("mute").has_value();
+    if (!toggle && !params.get<int>("incr") && !params.get<int>("set")) {
+      auto state = pulse(context_).state();
+      return nodeJson(find(state), state, alloc);
+    }
+    Node before, after;
+    pulse(context_).update([&](PulseClient::State& state) {
+      Node& node = find(state);
+      before = node;
+      if (toggle) {
+        node.mute = !node.mute;
+      } else {
+        changeLevel(node, params);
+      }
+      after = node;
+    });
+    rapidjson::Value val(rapidjson::kObjectType);
+    addString(val, "name", after.name, alloc);
+    val.AddMember("old_volume", rapidjson::Value(percent(before)), alloc);
+    val.AddMember("new_volume", rapidjson::Value(percent(after)), alloc);
+    val.AddMember("old_mute", rapidjson::Value(before.mute), alloc);
+    val.AddMember("new_mute", rapidjson::Value(after.mute), alloc);
+    return val;
   }
-  bool isMuted() {
-    return defaultSink_->mute;
+
+  DeviceVolumeAction(Context* context, PulseClient::Kind kind)
+    : Action(context), kind_(kind),
+      param_(kind == PulseClient::SOURCE ? "source" : "sink") {}
+};
+
+class ListAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec.param<std::string>("kind", "", "only sink, source or stream");
   }
-  void toggleMute() {
-    return setMute(!defaultSink_->mute);
+
+  rapidjson::Value actOn(Work* work) const override {
+    auto& alloc = work->allocator();
+    auto kind = work->parameters().get<std::string_view>("kind");
+    auto state = pulse(context_).state();
+    rapidjson::Value val(rapidjson::kArrayType);
+    for (const auto& node : state.nodes) {
+      if (!kind || *kind == PulseClient::kindName(node.kind)) {
+        val.PushBack(nodeJson(node, state, alloc), alloc);
+      }
+    }
+    return val;
   }
+
+  ListAction(Context* context) : Action(context) {}
 };
 
-class VolumeAction : public Action
+// Per-application volume, every selected stream in one round trip
+class StreamVolumeAction : public Action
 {
 public:
   void spec(ParamSpec& spec) const override {
     spec
       .param<int>("set", "operations", "sets volume to value")
       .param<int>("incr", "operations", "increments volume by value")
-      .param<std::nullptr_t>("mute", "operations", "Toggles mute/unmute")
+      .param<std::nullptr_t>("mute", "operations",
+          "Mutes the streams, or unmutes them if all are muted")
+      .param<std::nullptr_t>("solo", "operations",
+          "Unmutes the streams and mutes every other one")
       .key("operations", 1, 1);
+    streamSpec(spec);
   }
 
   rapidjson::Value actOn(Work* work) const override {
     auto& params = work->parameters();
-    PulseAudio pa(context_);
-    pa.init();
-    rapidjson::Value val(rapidjson::kObjectType);
-    float vol = pa.getVolume();
-    bool mute = pa.isMuted();
-    if (params.get<nullptr_t>("mute")) {
-      pa.toggleMute();
-      val.AddMember("volume", rapidjson::Value(vol), work->allocator());
-      val.AddMember("old_mute", rapidjson::Value(mute), work->allocator());
-      val.AddMember("new_mute", rapidjson::Value(!mute), work->allocator());
-      return val;
-    }
-    float new_vol;
-    if (auto incr = params.get<int>("incr")) {
-      new_vol = vol + *incr * 0.01f;
-    } else if (auto set = params.get<int>("set")) {
-      new_vol = *set * 0.01f;
-    }
-    new_vol = std::clamp(new_vol, 0.0f, 2.0f);
-    pa.setVolume(new_vol);
-    val.AddMember("old_volume",
-        rapidjson::Value((int)(100 * vol)),
-        work->allocator());
-    val.AddMember("new_volume",
-        rapidjson::Value((int)(100 * new_vol)),
-        work->allocator());
-    val.AddMember("mute",
-        rapidjson::Value(mute),
-        work->allocator());
-    return val;
+    bool toggle = params.get<nullptr_t>("mute").has_value();
+    bool solo = params.get<nullptr_t>("solo").has_value();
+    PulseClient::State after;
+    auto changes = pulse(context_).update([&](PulseClient::State& state) {
+      bool mute = false;
+      size_t count = 0;
+      for (const auto& node : state.nodes) {
+        if (selected(node, params)) {
+          mute |= !node.mute;
+          count += 1;
+        }
+      }
+      if (!count) {
+        THROW("No stream matched");
+      }
+      for (auto& node : state.nodes) {
+        if (node.kind != PulseClient::STREAM) {
+          continue;
+        }
+        bool chosen = selected(node, params);
+        if (solo) {
+          node.mute = !chosen;
+        } else if (!chosen) {
+          continue;
+        } else if (toggle) {
+          node.mute = mute;
+        } else {
+          changeLevel(node, params);
+        }
+      }
+      after = state;
+    });
+    return changesJson(changes, after, work->allocator());
+  }
+
+  StreamVolumeAction(Context* context) : Action(context) {}
+};
+
+class MoveAction : public Action
+{
+public:
+  void spec(ParamSpec& spec) const override {
+    spec.param<std::string>("sink", "sink", kDeviceHelp).key("sink", 1, 1);
+    streamSpec(spec);
+  }
+
+  rapidjson::Value actOn(Work* work) const override {
+    auto& params = work->parameters();
+    std::string_view name = *params.get<std::string_view>("sink");
+    bool everything = !params.get<std::string_view>("app") &&
+      !params.get<int>("pid") && !params.get<int>("index");
+    PulseClient::State after;
+    auto changes = pulse(context_).update([&](PulseClient::State& state) {
+      Node* sink = state.find(PulseClient::SINK, name);
+      if (!sink) {
+        THROW("No sink %.*s", (int)name.size(), name.data());
+      }
+      // moving everything makes new streams follow too
+      if (everything) {
+        state.defaultSink = sink->name;
+      }
+      for (auto& node : state.nodes) {
+        if (selected(node, params)) {
+          node.sink = sink->index;
+        }
+      }
+      after = state;
+    });
+    return changesJson(changes, after, work->allocator());
   }
 
-  VolumeAction(Context* context) : Action(context) {}
+  MoveAction(Context* context) : Action(context) {}
 };
 
 void PulseCommandGroup::initializeCommand(Context* context,
@@ -225,5 +296,21 @@ void PulseCommandGroup::initializeCommand(Context* context,
   (*command)
     .setName("volume").setName("vol")
     .setDescription("Volume management")
-    .makeAction<VolumeAction>(context);
+    .makeAction<DeviceVolumeAction>(context, PulseClient::SINK);
+  (*command->addChild())
+    .setName("mic").setName("source")
+    .setDescription("Microphone volume")
+    .makeAction<DeviceVolumeAction>(context, PulseClient::SOURCE);
+  (*command->addChild())
+    .setName("list")
+    .setDescription("Lists sinks, sources and playback streams")
+    .makeAction<ListAction>(context);
+  (*command->addChild())
+    .setName("app").setName("stream")
+    .setDescription("Volume of applications' playback streams")
+    .makeAction<StreamVolumeAction>(context);
+  (*command->addChild())
+    .setName("move")
+    .setDescription("Moves playback streams to another sink")
+    .makeAction<MoveAction>(context);
 }
@@ -0,0 +1,492 @@
+#include "pulseclient.h"
+#include "holper.h"
+#include "context.h"
+#include "logger.h"
+#include "exception.h"
+#include <algorithm>
+#include <charconv>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+  class MainloopLock {
+    pa_threaded_mainloop* mainloop_;
+  public:
+    explicit MainloopLock(pa_threaded_mainloop* mainloop)
+        : mainloop_(mainloop) {
+      pa_threaded_mainloop_lock(mainloop_);
+    }
+    ~MainloopLock() {
+      pa_threaded_mainloop_unlock(mainloop_);
+    }
+  };
+
+  const char* stateName(pa_context_state_t state) {
+    switch (state) {
+      case PA_CONTEXT_UNCONNECTED:
+        return "unconnected";
+      case PA_CONTEXT_CONNECTING:
+        return "connecting";
+      case PA_CONTEXT_AUTHORIZING:
+        return "authorizing";
+      case PA_CONTEXT_SETTING_NAME:
+        return "setting name";
+      case PA_CONTEXT_READY:
+        return "ready";
+      case PA_CONTEXT_FAILED:
+        return "failed";
+      case PA_CONTEXT_TERMINATED:
+        return "terminated";
+      default:
+        return "unknown";
+    }
+  }
+  void release(pa_operation* op) {
+    if (op) {
+      pa_operation_unref(op);
+    }
+  }
+
+  bool isBluetooth(const pa_proplist* props, const char* name) {
+    const char* bus = props ? pa_proplist_gets(props, PA_PROP_DEVICE_BUS)
+      : nullptr;
+    if (bus) {
+      return strcmp(bus, "bluetooth") == 0;
+    }
+    return strncmp(name, "bluez_", 6) == 0;
+  }
+
+  std::optional<PulseClient::Node> toNode(const pa_sink_info* info) {
+    PulseClient::Node node;
+    node.kind = PulseClient::SINK;
+    node.index = info->index;
+    node.name = info->name;
+    node.description = info->description ? info->description : "";
+    node.volume = info->volume;
+    node.mute = info->mute != 0;
+    node.bluetooth = isBluetooth(info->proplist, info->name);
+    return node;
+  }
+
+  std::optional<PulseClient::Node> toNode(const pa_source_info* info) {
+    // every sink has one, they'd only be noise
+    if (info->monitor_of_sink != PA_INVALID_INDEX) {
+      return std::nullopt;
+    }
+    PulseClient::Node node;
+    node.kind = PulseClient::SOURCE;
+    node.index = info->index;
+    node.name = info->name;
+    node.description = info->description ? info->description : "";
+    node.volume = info->volume;
+    node.mute = info->mute != 0;
+    node.bluetooth = isBluetooth(info->proplist, info->name);
+    return node;
+  }
+
+  std::optional<PulseClient::Node> toNode(const pa_sink_input_info* info) {
+    PulseClient::Node node;
+    node.kind = PulseClient::STREAM;
+    node.index = info->index;
+    node.name = info->name ? info->name : "";
+    const char* app = info->proplist ?
+      pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_NAME) : nullptr;
+    node.description = app ? app : node.name;
+    const char* pid = info->proplist ?
+      pa_proplist_gets(info->proplist, PA_PROP_APPLICATION_PROCESS_ID) :
+      nullptr;
+    node.pid = pid ? atoi(pid) : 0;
+    node.volume = info->volume;
+    node.mute = info->mute != 0;
+    node.sink = info->sink;
+    return node;
+  }
+}
+
+const char* PulseClient::kindName(Kind kind) {
+  switch (kind) {
+    case SINK:
+      return "sink";
+    case SOURCE:
+      return "source";
+    case STREAM:
+      return "stream";
+    default:
+      return "unknown";
+  }
+}
+
+float PulseClient::Node::level() const {
+  return pa_cvolume_max(&volume) * 1.0f / PA_VOLUME_NORM;
+}
+
+void PulseClient::Node::setLevel(float level) {
+  pa_volume_t target = (pa_volume_t)(std::max(level, 0.0f) * PA_VOLUME_NORM);
+  if (pa_cvolume_max(&volume) == PA_VOLUME_MUTED) {
+    // nothing to keep the balance of
+    pa_cvolume_set(&volume, std::max<unsigned>(volume.channels, 1), target);
+  } else {
+    pa_cvolume_scale(&volume, target);
+  }
+}
+
+PulseClient::Node* PulseClient::State::find(Kind kind, uint32_t index) {
+  for (auto& node : nodes) {
+    if (node.kind == kind && node.index == index) {
+      return &node;
+    }
+  }
+  return nullptr;
+}
+
+PulseClient::Node* PulseClient::State::find(Kind kind,
+    std::string_view name) {
+  if (name == "default") {
+    name = kind == SOURCE ? defaultSource : defaultSink;
+  }
+  uint32_t index;
+  auto [end, ec] = std::from_chars(name.data(), name.data() + name.size(),
+      index);
+  if (ec == std::errc() && end == name.data() + name.size()) {
+    return find(kind, index);
+  }
+  bool bluetooth = name == "bluetooth";
+  for (auto& node : nodes) {
+    if (node.kind == kind && (bluetooth ? node.bluetooth : node.name == name)) {
+      return &node;
+    }
+  }
+  return nullptr;
+}
+
+PulseClient::PulseClient(Context* context) : context_(context) {
+  mainloop_ = pa_threaded_mainloop_new();
+  if (!mainloop_) {
+    THROW("Could not create the PulseAudio mainloop");
+  }
+  {
+    MainloopLock lock(mainloop_);
+    connect();
+  }
+  if (pa_threaded_mainloop_start(mainloop_) < 0) {
+    pa_context_unref(pulse_);
+    pa_threaded_mainloop_free(mainloop_);
+    THROW("Could not start the PulseAudio mainloop");
+  }
+}
+
+PulseClient::~PulseClient() {
+  pa_threaded_mainloop_stop(mainloop_);
+  if (pulse_) {
+    pa_context_disconnect(pulse_);
+    pa_context_unref(pulse_);
+  }
+  pa_threaded_mainloop_free(mainloop_);
+}
+
+std::string PulseClient::error() const {
+  return pa_strerror(pulse_ ? pa_context_errno(pulse_) : 0);
+}
+
+void PulseClient::connect() {
+  pulse_ = pa_context_new(pa_threaded_mainloop_get_api(mainloop_), "holper");
+  if (!pulse_) {
+    disconnected("context creation failed");
+    return;
+  }
+  pa_context_set_state_callback(pulse_, stateCallback, this);
+  pa_context_set_subscribe_callback(pulse_, subscribeCallback, this);
+  if (pa_context_connect(pulse_, nullptr, PA_CONTEXT_NOFLAGS, nullptr) < 0) {
+    disconnected("connect failed: " + error());
+  }
+}
+
+void PulseClient::disconnected(const std::string& reason) {
+  if (failures_++ == 0) {
+    context_->logger->warn("PulseAudio %s, retrying in the background",
+        reason.c_str());
+  } else {
+    context_->logger->debug("PulseAudio %s (attempt %d)", reason.c_str(),
+        failures_);
+  }
+  connected_ = false;
+  settled_ = true;
+  for (auto& nodes : nodes_) {
+    nodes.clear();
+  }
+  pa_threaded_mainloop_signal(mainloop_, 0);
+  // the context can't be replaced from inside its own callbacks
+  pa_mainloop_api* api = pa_threaded_mainloop_get_api(mainloop_);
+  struct timeval tv;
+  pa_gettimeofday(&tv);
+  pa_timeval_add(&tv, reconnectDelay_);
+  api->time_new(api, &tv, reconnectCallback, this);
+  reconnectDelay_ = std::min(reconnectDelay_ * 2, kMaxReconnectDelay);
+}
+
+void PulseClient::listed() {
+  if (--pendingLists_ == 0) {
+    if (failures_ > 0) {
+      context_->logger->info("PulseAudio connected after %d failed attempts",
+          failures_);
+    }
+    failures_ = 0;
+    reconnectDelay_ = kMinReconnectDelay;
+    connected_ = true;
+    settled_ = true;
+    pa_threaded_mainloop_signal(mainloop_, 0);
+  }
+}
+
+void PulseClient::reconnectCallback(pa_mainloop_api* api,
+    pa_time_event* event, const struct timeval* UNUSED(tv), void* userdata) {
+  PulseClient* client = reinterpret_cast<PulseClient*>(userdata);
+  api->time_free(event);
+  if (client->pulse_) {
+    pa_context_set_state_callback(client->pulse_, nullptr, nullptr);
+    pa_context_disconnect(client->pulse_);
+    pa_context_unref(client->pulse_);
+    client->pulse_ = nullptr;
+  }
+  client->connect();
+}
+
+void PulseClient::stateCallback(pa_context* c, void* userdata) {
+  PulseClient* client = reinterpret_cast<PulseClient*>(userdata);
+  pa_context_state_t state = pa_context_get_state(c);
+  client->context_->logger->debug("PulseAudio state: %s", stateName(state));
+  switch (state) {
+    case PA_CONTEXT_READY:
+      release(pa_context_subscribe(c,
+            (pa_subscription_mask_t)(PA_SUBSCRIPTION_MASK_SINK |
+              PA_SUBSCRIPTION_MASK_SOURCE | PA_SUBSCRIPTION_MASK_SINK_INPUT |
+              PA_SUBSCRIPTION_MASK_SERVER), nullptr, nullptr));
+      // replies come in order, the defaults are known before the lists
+      client->refreshServer();
+      client->pendingLists_ = 3;
+      release(pa_context_get_sink_info_list(c,
+            infoCallback<pa_sink_info, true>, client));
+      release(pa_context_get_source_info_list(c,
+            infoCallback<pa_source_info, true>, client));
+      release(pa_context_get_sink_input_info_list(c,
+            infoCallback<pa_sink_input_info, true>, client));
+      break;
+    case PA_CONTEXT_FAILED:
+    case PA_CONTEXT_TERMINATED:
+      client->disconnected(St::fmt("connection %s: %s", stateName(state),
+            client->error().c_str()));
+      break;
+    default:
+      break;
+  }
+}
+
+void PulseClient::refreshServer() {
+  release(pa_context_get_server_info(pulse_, serverInfoCallback, this));
+}
+
+void PulseClient::refresh(Kind kind, uint32_t index) {
+  switch (kind) {
+    case SINK:
+      release(pa_context_get_sink_info_by_index(pulse_, index,
+            infoCallback<pa_sink_info, false>, this));
+      break;
+    case SOURCE:
+      release(pa_context_get_source_info_by_index(pulse_, index,
+            infoCallback<pa_source_info, false>, this));
+      break;
+    case STREAM:
+      release(pa_context_get_sink_input_info(pulse_, index,
+            infoCallback<pa_sink_input_info, false>, this));
+      break;
+    default:
+      break;
+  }
+}
+
+void PulseClient::serverInfoCallback(pa_context* UNUSED(c),
+    const pa_server_info* info, void* userdata) {
+  PulseClient* client = reinterpret_cast<PulseClient*>(userdata);
+  if (!info) {
+    return;
+  }
+  client->defaultSink_ = info->default_sink_name ?
+    info->default_sink_name : "";
+  client->defaultSource_ = info->default_source_name ?
+    info->default_source_name : "";
+}
+
+template <typename Info, bool initial>
+void PulseClient::infoCallback(pa_context* UNUSED(c), const Info* info,
+    int eol, void* userdata) {
+  PulseClient* client = reinterpret_cast<PulseClient*>(userdata);
+  if (eol) {
+    if (initial) {
+      client->listed();
+    }
+    return;
+  }
+  if (auto node = toNode(info)) {
+    client->nodes_[node->kind][node->index] = std::move(*node);
+  }
+}
+
+void PulseClient::subscribeCallback(pa_context* UNUSED(c),
+    pa_subscription_event_type_t type, uint32_t index, void* userdata) {
+  PulseClient* client = reinterpret_cast<PulseClient*>(userdata);
+  Kind kind;
+  switch (type & PA_SUBSCRIPTION_EVENT_FACILITY_MASK) {
+    case PA_SUBSCRIPTION_EVENT_SERVER:
+      client->refreshServer();
+      return;
+    case PA_SUBSCRIPTION_EVENT_SINK:
+      kind = SINK;
+      break;
+    case PA_SUBSCRIPTION_EVENT_SOURCE:
+      kind = SOURCE;
+      break;
+    case PA_SUBSCRIPTION_EVENT_SINK_INPUT:
+      kind = STREAM;
+      break;
+    default:
+      return;
+  }
+  if ((type & PA_SUBSCRIPTION_EVENT_TYPE_MASK) ==
+      PA_SUBSCRIPTION_EVENT_REMOVE) {
+    client->nodes_[kind].erase(index);
+  } else {
+    client->refresh(kind, index);
+  }
+}
+
+void PulseClient::operationCallback(pa_operation* UNUSED(op),
+    void* userdata) {
+  PulseClient* client = reinterpret_cast<PulseClient*>(userdata);
+  pa_threaded_mainloop_signal(client->mainloop_, 0);
+}
+
+void PulseClient::successCallback(pa_context* UNUSED(c), int success,
+    void* userdata) {
+  *reinterpret_cast<int*>(userdata) = success;
+}
+
+bool PulseClient::await(pa_operation* op) {
+  if (!op) {
+    return false;
+  }
+  pa_operation_set_state_callback(op, operationCallback, this);
+  while (pa_operation_get_state(op) == PA_OPERATION_RUNNING) {
+    pa_threaded_mainloop_wait(mainloop_);
+  }
+  pa_operation_state_t state = pa_operation_get_state(op);
+  pa_operation_unref(op);
+  return state == PA_OPERATION_DONE;
+}
+
+void PulseClient::waitConnected() {
+  while (!settled_) {
+    pa_threaded_mainloop_wait(mainloop_);
+  }
+  if (!connected_) {
+    THROW("Not connected to PulseAudio: %s", error().c_str());
+  }
+}
+
+PulseClient::State PulseClient::state() {
+  MainloopLock lock(mainloop_);
+  waitConnected();
+  return snapshot();
+}
+
+PulseClient::State PulseClient::snapshot() const {
+  State state{defaultSink_, defaultSource_, {}};
+  for (const auto& nodes : nodes_) {
+    for (const auto& [index, node] : nodes) {
+      state.nodes.push_back(node);
+    }
+  }
+  return state;
+}
+
+PulseClient::Changes PulseClient::update(
+    const std::function<void(State&)>& change) {
+  MainloopLock lock(mainloop_);
+  waitConnected();
+  State state = snapshot();
+  change(state);
+  Changes changes;
+  std::vector<pa_operation*> ops;
+  // written by successCallback, one per operation
+  std::vector<int> successes(3 * state.nodes.size() + 2, 1);
+  auto success = [&]() { return &successes[ops.size()]; };
+  for (const auto& node : state.nodes) {
+    auto it = nodes_[node.kind].find(node.index);
+    if (it == nodes_[node.kind].end()) {
+      // gone since the copy was made
+      continue;
+    }
+    const Node& current = it->second;
+    bool changed = false;
+    if (!pa_cvolume_equal(&node.volume, &current.volume)) {
+      changed = true;
+      if (node.kind == SINK) {
+        ops.push_back(pa_context_set_sink_volume_by_index(pulse_,
+              node.index, &node.volume, successCallback, success()));
+      } else if (node.kind == SOURCE) {
+        ops.push_back(pa_context_set_source_volume_by_index(pulse_,
+              node.index, &node.volume, successCallback, success()));
+      } else {
+        ops.push_back(pa_context_set_sink_input_volume(pulse_,
+              node.index, &node.volume, successCallback, success()));
+      }
+    }
+    if (node.mute != current.mute) {
+      changed = true;
+      if (node.kind == SINK) {
+        ops.push_back(pa_context_set_sink_mute_by_index(pulse_,
+              node.index, node.mute, successCallback, success()));
+      } else if (node.kind == SOURCE) {
+        ops.push_back(pa_context_set_source_mute_by_index(pulse_,
+              node.index, node.mute, successCallback, success()));
+      } else {
+        ops.push_back(pa_context_set_sink_input_mute(pulse_,
+              node.index, node.mute, successCallback, success()));
+      }
+    }
+    if (node.kind == STREAM && node.sink != current.sink) {
+      changed = true;
+      ops.push_back(pa_context_move_sink_input_by_index(pulse_,
+            node.index, node.sink, successCallback, success()));
+    }
+    if (changed) {
+      changes.emplace_back(current, node);
+    }
+  }
+  if (state.defaultSink != defaultSink_) {
+    ops.push_back(pa_context_set_default_sink(pulse_,
+          state.defaultSink.c_str(), successCallback, success()));
+  }
+  if (state.defaultSource != defaultSource_) {
+    ops.push_back(pa_context_set_default_source(pulse_,
+          state.defaultSource.c_str(), successCallback, success()));
+  }
+  bool sent = true;
+  for (auto op : ops) {
+    sent &= await(op);
+  }
+  if (!sent || std::count(successes.begin(), successes.end(), 0)) {
+    THROW("PulseAudio refused the change: %s", error().c_str());
+  }
+  // the subscription confirms it later, until then trust what we sent
+  for (const auto& [before, after] : changes) {
+    auto it = nodes_[after.kind].find(after.index);
+    if (it != nodes_[after.kind].end()) {
+      it->second.volume = after.volume;
+      it->second.mute = after.mute;
+      it->second.sink = after.sink;
+    }
+  }
+  defaultSink_ = state.defaultSink;
+  defaultSource_ = state.defaultSource;
+  return changes;
+}
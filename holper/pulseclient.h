@@ -0,0 +1,114 @@
+#pragma once
+#include <pulse/pulseaudio.h>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+class Context;
+
+// One PulseAudio connection for the whole daemon, driven by a
+// pa_threaded_mainloop. Sinks, sources and playback streams are listed
+// once and then kept current through a subscription, so reading them
+// costs no IPC. Changes to any number of them go out together and cost
+// a single round trip. A lost connection is retried after a delay that
+// doubles from kMinReconnectDelay up to kMaxReconnectDelay, only the first
+// failure and the recovery are logged.
+class PulseClient
+{
+public:
+  static constexpr pa_usec_t kMinReconnectDelay = PA_USEC_PER_SEC;
+  static constexpr pa_usec_t kMaxReconnectDelay = 60 * PA_USEC_PER_SEC;
+  enum Kind {
+    SINK,
+    SOURCE,
+    // a sink input, one application's playback
+    STREAM,
+    KIND_COUNT
+  };
+  static const char* kindName(Kind kind);
+  struct Node {
+    Kind kind = SINK;
+    uint32_t index = PA_INVALID_INDEX;
+    std::string name;
+    // the application's name for streams
+    std::string description;
+    pa_cvolume volume = {};
+    bool mute = false;
+    // sinks and sources
+    bool bluetooth = false;
+    // streams: the sink it plays on and the process playing it
+    uint32_t sink = PA_INVALID_INDEX;
+    int pid = 0;
+    // Loudest channel, 1.0 is 100%
+    float level() const;
+    // Scales every channel, keeping the balance
+    void setLevel(float level);
+  };
+  struct State {
+    std::string defaultSink;
+    std::string defaultSource;
+    std::vector<Node> nodes;
+    Node* find(Kind kind, uint32_t index);
+    // A sink or source by index or name, "default" or "bluetooth"
+    Node* find(Kind kind, std::string_view name);
+  };
+  typedef std::vector<std::pair<Node, Node>> Changes;
+private:
+  Context* context_;
+  pa_threaded_mainloop* mainloop_;
+  // guarded by the mainloop lock
+  pa_context* pulse_ = nullptr;
+  // the first connection attempt has either failed or listed everything
+  bool settled_ = false;
+  bool connected_ = false;
+  int pendingLists_ = 0;
+  // consecutive failed attempts, reset once connected
+  int failures_ = 0;
+  pa_usec_t reconnectDelay_ = kMinReconnectDelay;
+  std::string defaultSink_;
+  std::string defaultSource_;
+  std::map<uint32_t, Node> nodes_[KIND_COUNT];
+
+  void connect();
+  // Logs reason unless an earlier attempt already failed and schedules
+  // the next one
+  void disconnected(const std::string& reason);
+  void listed();
+  void refreshServer();
+  void refresh(Kind kind, uint32_t index);
+  std::string error() const;
+  // Waits for op with the mainloop lock held, false unless it completed
+  bool await(pa_operation* op);
+  // Both with the mainloop lock held exactly once, the wait releases
+  // only one level of it
+  void waitConnected();
+  State snapshot() const;
+  static void stateCallback(pa_context* c, void* userdata);
+  static void subscribeCallback(pa_context* c,
+      pa_subscription_event_type_t type, uint32_t index, void* userdata);
+  static void serverInfoCallback(pa_context* c, const pa_server_info* info,
+      void* userdata);
+  template <typename Info, bool initial>
+  static void infoCallback(pa_context* c, const Info* info, int eol,
+      void* userdata);
+  static void reconnectCallback(pa_mainloop_api* api, pa_time_event* event,
+      const struct timeval* tv, void* userdata);
+  static void operationCallback(pa_operation* op, void* userdata);
+  static void successCallback(pa_context* c, int success, void* userdata);
+public:
+  explicit PulseClient(Context* context);
+  ~PulseClient();
+  PulseClient(const PulseClient&) = delete;
+  PulseClient& operator=(const PulseClient&) = delete;
+  // A copy of everything, throws when not connected
+  State state();
+  // Lets change edit a copy of the state and sends the server every
+  // difference in volume, mute, a stream's sink and the defaults. All
+  // requests go out before waiting on any. Returns the nodes that
+  // changed, before and after.
+  Changes update(const std::function<void(State&)>& change);
+};
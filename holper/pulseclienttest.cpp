@@ -0,0 +1,46 @@
+#include <gtest/gtest.h>
+#include "pulseclient.h"
+
+namespace {
+  PulseClient::Node node(PulseClient::Kind kind, uint32_t index,
+      const std::string& name, bool bluetooth = false) {
+    PulseClient::Node node;
+    node.kind = kind;
+    node.index = index;
+    node.name = name;
+    node.bluetooth = bluetooth;
+    return node;
+  }
+}
+
+TEST(PulseClientTest, find) {
+  PulseClient::State state;
+  state.defaultSink = "alsa_output.pci";
+  state.defaultSource = "alsa_input.pci";
+  state.nodes.push_back(node(PulseClient::SINK, 0, "alsa_output.pci"));
+  state.nodes.push_back(node(PulseClient::SINK, 4, "bluez_sink.00", true));
+  state.nodes.push_back(node(PulseClient::SOURCE, 1, "alsa_input.pci"));
+  state.nodes.push_back(node(PulseClient::STREAM, 7, "Playback"));
+  EXPECT_EQ(state.find(PulseClient::SINK, "default")->index, 0u);
+  EXPECT_EQ(state.find(PulseClient::SINK, "bluetooth")->index, 4u);
+  EXPECT_EQ(state.find(PulseClient::SINK, "4")->name, "bluez_sink.00");
+  EXPECT_EQ(state.find(PulseClient::SOURCE, "default")->index, 1u);
+  EXPECT_FALSE(state.find(PulseClient::SOURCE, "bluetooth"));
+  EXPECT_FALSE(state.find(PulseClient::SINK, "1"));
+  EXPECT_EQ(state.find(PulseClient::STREAM, 7u)->name, "Playback");
+}
+
+TEST(PulseClientTest, levelKeepsBalance) {
+  PulseClient::Node sink;
+  sink.volume.channels = 2;
+  sink.volume.values[0] = PA_VOLUME_NORM;
+  sink.volume.values[1] = PA_VOLUME_NORM / 2;
+  EXPECT_FLOAT_EQ(sink.level(), 1.0f);
+  sink.setLevel(0.5f);
+  EXPECT_EQ(sink.volume.values[0], PA_VOLUME_NORM / 2);
+  EXPECT_EQ(sink.volume.values[1], PA_VOLUME_NORM / 4);
+  sink.setLevel(0.0f);
+  sink.setLevel(0.3f);
+  EXPECT_EQ(sink.volume.channels, 2);
+  EXPECT_EQ(sink.volume.values[1], sink.volume.values[0]);
+}
@@ -0,0 +1,174 @@
+#include "random.h"
+#include "exception.h"
+#include "string.h"
+#include <atomic>
+#include <cstring>
+#include <pthread.h>
+#include <sys/random.h>
+
+namespace {
+  const size_t kBlockSize = 64;
+  const size_t kBufferBlocks = 16;
+  const size_t kBufferSize = kBlockSize * kBufferBlocks;
+  const size_t kKeySize = 32;
+
+  std::atomic<uint64_t> forkGeneration(0);
+
+  void onFork() {
+    forkGeneration.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const int kAtFork = pthread_atfork(nullptr, nullptr, onFork);
+
+  inline uint32_t rotl(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+  }
+
+  inline void quarterRound(uint32_t* x, int a, int b, int c, int d) {
+    x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 16);
+    x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 12);
+    x[a] += x[b]; x[d] = rotl(x[d] ^ x[a], 8);
+    x[c] += x[d]; x[b] = rotl(x[b] ^ x[c], 7);
+  }
+
+  struct State {
+    uint32_t key[8];
+    uint64_t counter = 0;
+    uint8_t buffer[kBufferSize];
+    size_t pos = kBufferSize;
+    size_t sinceSeed = 0;
+    size_t seeds = 0;
+    uint64_t generation = 0;
+    bool seeded = false;
+
+    ~State() {
+      explicit_bzero(key, sizeof(key));
+      explicit_bzero(buffer, sizeof(buffer));
+    }
+
+    void seed() {
+      uint8_t* out = (uint8_t*)key;
+      size_t got = 0;
+      while (got < sizeof(key)) {
+        ssize_t r = getrandom(out + got, sizeof(key) - got, 0);
+        if (r < 0) {
+          if (errno == EINTR) {
+            continue;
+          }
+          THROW("getrandom failed: %s", St::errorString().c_str());
+        }
+        got += r;
+      }
+      counter = 0;
+      sinceSeed = 0;
+      seeds += 1;
+      seeded = true;
+      generation = forkGeneration.load(std::memory_order_relaxed);
+    }
+
+    void refill() {
+      if (!seeded || sinceSeed >= Random::kReseedBytes ||
+          generation != forkGeneration.load(std::memory_order_relaxed)) {
+        seed();
+      }
+      // a fresh nonce comes with every key, the counter never wraps
+      const uint32_t nonce[3] = {0, 0, 0};
+      for (size_t i = 0; i < kBufferBlocks; ++i) {
+        Random::chacha20Block(key, (uint32_t)counter++, nonce,
+            buffer + i * kBlockSize);
+      }
+      memcpy(key, buffer, kKeySize);
+      memset(buffer, 0, kKeySize);
+      pos = kKeySize;
+      sinceSeed += kBufferSize - kKeySize;
+    }
+
+    void take(uint8_t* out, size_t len) {
+      while (len) {
+        if (pos == kBufferSize ||
+            generation != forkGeneration.load(std::memory_order_relaxed)) {
+          refill();
+        }
+        size_t n = std::min(len, kBufferSize - pos);
+        memcpy(out, buffer + pos, n);
+        // handed out bytes don't stay behind
+        memset(buffer + pos, 0, n);
+        pos += n;
+        out += n;
+        len -= n;
+      }
+    }
+  };
+
+  State& state() {
+    thread_local State state;
+    return state;
+  }
+}
+
+void Random::chacha20Block(const uint32_t key[8], uint32_t counter,
+    const uint32_t nonce[3], uint8_t out[64]) {
+  // "expand 32-byte k"
+  uint32_t input[16] = {
+    0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+    key[0], key[1], key[2], key[3], key[4], key[5], key[6], key[7],
+    counter, nonce[0], nonce[1], nonce[2],
+  };
+  uint32_t x[16];
+  memcpy(x, input, sizeof(x));
+  for (int i = 0; i < 10; ++i) {
+    quarterRound(x, 0, 4, 8, 12);
+    quarterRound(x, 1, 5, 9, 13);
+    quarterRound(x, 2, 6, 10, 14);
+    quarterRound(x, 3, 7, 11, 15);
+    quarterRound(x, 0, 5, 10, 15);
+    quarterRound(x, 1, 6, 11, 12);
+    quarterRound(x, 2, 7, 8, 13);
+    quarterRound(x, 3, 4, 9, 14);
+  }
+  for (int i = 0; i < 16; ++i) {
+    uint32_t v = x[i] + input[i];
+    out[4 * i] = v;
+    out[4 * i + 1] = v >> 8;
+    out[4 * i + 2] = v >> 16;
+    out[4 * i + 3] = v >> 24;
+  }
+}
+
+void Random::bytes(void* data, size_t len) {
+  state().take((uint8_t*)data, len);
+}
+
+uint32_t Random::u32() {
+  uint32_t val;
+  bytes(&val, sizeof(val));
+  return val;
+}
+
+uint64_t Random::u64() {
+  uint64_t val;
+  bytes(&val, sizeof(val));
+  return val;
+}
+
+uint32_t Random::uniform(uint32_t bound) {
+  if (bound == 0) {
+    THROW("Empty range");
+  }
+  // Lemire's multiply and reject, the division only runs when the low
+  // half lands in the biased zone
+  uint64_t m = (uint64_t)u32() * bound;
+  uint32_t low = (uint32_t)m;
+  if (low < bound) {
+    uint32_t threshold = -bound % bound;
+    while (low < threshold) {
+      m = (uint64_t)u32() * bound;
+      low = (uint32_t)m;
+    }
+  }
+  return m >> 32;
+}
+
+size_t Random::seedCount() {
+  return state().seeds;
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Per-thread ChaCha20 keystream seeded from getrandom(). Output is
+// generated a buffer at a time and the key is replaced from the keystream
+// after every refill, so a leaked state doesn't reveal earlier output.
+// Reseeds after kReseedBytes and in the child after fork.
+namespace Random {
+  const size_t kReseedBytes = 1 << 20;
+
+  void bytes(void* data, size_t len);
+  uint32_t u32();
+  uint64_t u64();
+  // Uniform in [0, bound), without the modulo bias of u32() % bound
+  uint32_t uniform(uint32_t bound);
+
+  // One 64 byte ChaCha20 block (RFC 8439), exposed for the test vectors
+  void chacha20Block(const uint32_t key[8], uint32_t counter,
+      const uint32_t nonce[3], uint8_t out[64]);
+  // getrandom() calls made by this thread, to check buffering
+  size_t seedCount();
+}
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "random.h"
+
+TEST(RandomTest, chacha20Vector) {
+  // RFC 8439 2.3.2
+  uint32_t key[8];
+  uint8_t keyBytes[32];
+  for (int i = 0; i < 32; ++i) {
+    keyBytes[i] = i;
+  }
+  memcpy(key, keyBytes, sizeof(key));
+  const uint32_t nonce[3] = {0x09000000, 0x4a000000, 0};
+  uint8_t out[64];
+  Random::chacha20Block(key, 1, nonce, out);
+  const uint8_t expected[64] = {
+    0x10, 0xf1, 0xe7, 0xe4, 0xd1, 0x3b, 0x59, 0x15,
+    0x50, 0x0f, 0xdd, 0x1f, 0xa3, 0x20, 0x71, 0xc4,
+    0xc7, 0xd1, 0xf4, 0xc7, 0x33, 0xc0, 0x68, 0x03,
+    0x04, 0x22, 0xaa, 0x9a, 0xc3, 0xd4, 0x6c, 0x4e,
+    0xd2, 0x82, 0x64, 0x46, 0x07, 0x9f, 0xaa, 0x09,
+    0x14, 0xc2, 0xd7, 0x05, 0xd9, 0x8b, 0x02, 0xa2,
+    0xb5, 0x12, 0x9c, 0xd1, 0xde, 0x16, 0x4e, 0xb9,
+    0xcb, 0xd0, 0x83, 0xe8, 0xa2, 0x50, 0x3c, 0x4e,
+  };
+  EXPECT_EQ(memcmp(out, expected, sizeof(out)), 0);
+}
+
+TEST(RandomTest, uniform) {
+  const uint32_t kBound = 7;
+  const int kDraws = 70000;
+  int counts[kBound] = {};
+  for (int i = 0; i < kDraws; ++i) {
+    uint32_t val = Random::uniform(kBound);
+    ASSERT_LT(val, kBound);
+    counts[val] += 1;
+  }
+  for (uint32_t i = 0; i < kBound; ++i) {
+    EXPECT_NEAR(counts[i], kDraws / kBound, kDraws / kBound / 10);
+  }
+  EXPECT_EQ(Random::uniform(1), 0u);
+  EXPECT_ANY_THROW(Random::uniform(0));
+}
+
+TEST(RandomTest, buffered) {
+  Random::u32();
+  size_t seeds = Random::seedCount();
+  // a password's worth of draws doesn't go back to the kernel
+  for (int i = 0; i < 1000; ++i) {
+    Random::uniform(62);
+  }
+  EXPECT_EQ(Random::seedCount(), seeds);
+  std::vector<uint8_t> big(Random::kReseedBytes + 4096);
+  Random::bytes(big.data(), big.size());
+  EXPECT_GT(Random::seedCount(), seeds);
+}
+
+TEST(RandomTest, reseedsAfterFork) {
+  Random::u64();
+  int fds[2];
+  ASSERT_EQ(pipe(fds), 0);
+  pid_t pid = fork();
+  ASSERT_GE(pid, 0);
+  if (pid == 0) {
+    uint64_t val = Random::u64();
+    _exit(write(fds[1], &val, sizeof(val)) == sizeof(val) ? 0 : 1);
+  }
+  uint64_t mine = Random::u64();
+  uint64_t child = 0;
+  ASSERT_EQ(read(fds[0], &child, sizeof(child)), (ssize_t)sizeof(child));
+  waitpid(pid, nullptr, 0);
+  close(fds[0]);
+  close(fds[1]);
+  EXPECT_NE(mine, child);
+}
@@ -3,6 +3,12 @@
 #include "info.h"
 #include "consts.h"
 #include "logger.h"
+#include "flightrecorder.h"
+#include "latency.h"
+#include "trace.h"
+#include "slowrequests.h"
+#include "workpool.h"
+#include "command.h"
 #include "string.h"
 #include "exception.h"
 #include <rapidjson/writer.h>
@@ -47,55 +53,119 @@ Response& Response::set(std::string key, rapidjson::Value& value) {
   return *this;
 }
 
-rapidjson::Value& Parameters::getRaw(const std::string& name, bool* exists) {
-  // ugh
-  static rapidjson::Value dummy;
-  auto it = rawParameters_.find(name);
-  if (it == rawParameters_.end()) {
-    if (exists) {
-      *exists = false;
+Parameters::Parameters(std::vector<char>&& payload,
+    std::unique_ptr<rapidjson::Document> doc)
+  : payload_(std::move(payload)), doc_(std::move(doc)) {
+  auto& params = (*doc_)["parameters"];
+  parameters_.reserve(params.MemberCount());
+  for ( auto& val : params.GetObject() ) {
+    std::string_view name(val.name.GetString(), val.name.GetStringLength());
+    if (val.value.IsString()) {
+      parameters_.emplace_back(name, std::string_view(val.value.GetString(),
+            val.value.GetStringLength()), nullptr);
+    } else {
+      parameters_.emplace_back(name, std::string_view(), &val.value);
     }
-    return dummy;
   }
+}
+
+rapidjson::Value& Parameters::getRaw(std::string_view name, bool* exists) {
+  // ugh
+  static rapidjson::Value dummy;
+  const Parameter* param = find(name, true);
   if (exists) {
-    *exists = true;
+    *exists = param != nullptr;
+  }
+  if (!param) {
+    return dummy;
   }
-  return it->second;
+  return *param->raw;
 }
 
-void Request::sendResponse(int code) {
-  profiler_.event("sendResponse called");
+size_t Request::sendResponse(int code) {
+  profiler_.event(Profiler::SEND_RESPONSE_CALLED);
   response_.set("code", code);
   if (verbose_) {
     response_.set("profiler", profiler_.json(response_.alloc()).Move());
   }
   response_.set("id", id_);
   std::string msg = response_.serialize();
-  profiler_.event("Write started");
+  profiler_.event(Profiler::WRITE_STARTED);
   socket_->write(msg);
-  profiler_.event("Write finished");
-  context_->logger->info(
-    "Response for request %d: %s%s%s\nRequest Stats: %s%s%s",
-    id_,
-    Consts::TerminalColors::YELLOW,
-    msg.c_str(),
-    Consts::TerminalColors::DEFAULT,
-    Consts::TerminalColors::PURPLE,
-    profiler_.str().c_str(),
-    Consts::TerminalColors::DEFAULT
-  );
+  profiler_.event(Profiler::WRITE_FINISHED);
+  if (context_->latency && command_) {
+    context_->latency->record(command_->index(), profiler_);
+  }
+  keepIfSlow(code);
+  if (context_->trace && context_->trace->active()) {
+    context_->trace->record(id_, command_ ? command_->path() : "",
+        profiler_);
+  }
+  if (context_->flightRecorder) {
+    profiler_.forEach([&](const TimePoint& time, pid_t UNUSED(tid),
+          const char* prefix, const char* name) {
+      context_->flightRecorder->recordEvent(id_, time, prefix, name);
+    });
+  }
+  if (!context_->logger->verbose(Logger::INFO)) {
+    // the profiler events above already tell the recorder the timing
+    context_->logger->info("Responded to request %d with %lu bytes", id_,
+        msg.size());
+  } else {
+    context_->logger->info(
+      "Response for request %d: %s%s%s\nRequest Stats: %s%s%s",
+      id_,
+      Consts::TerminalColors::YELLOW,
+      msg.c_str(),
+      Consts::TerminalColors::DEFAULT,
+      Consts::TerminalColors::PURPLE,
+      profiler_.str().c_str(),
+      Consts::TerminalColors::DEFAULT
+    );
+  }
   socket_.reset(nullptr);
+  return msg.size();
+}
+
+void Request::keepIfSlow(int code) {
+  int64_t total = profiler_.since(Profiler::WRITE_FINISHED);
+  if (!context_->slowRequests || total < 0 ||
+      !context_->slowRequests->observe(total)) {
+    return;
+  }
+  SlowRequests::Entry entry{id_, command_ ? command_->path() : "",
+    code, (u64)total, RealTimePoint(), {}, profiler_};
+  if (work_) {
+    for (const auto& param : work_->parameters().list()) {
+      std::string value;
+      if (param.raw) {
+        rapidjson::StringBuffer buf;
+        rapidjson::Writer<rapidjson::StringBuffer> writer(buf);
+        param.raw->Accept(writer);
+        value.assign(buf.GetString(), buf.GetSize());
+      } else {
+        value = param.value;
+      }
+      entry.parameters.emplace_back(std::string(param.name), value);
+    }
+  }
+  context_->slowRequests->add(std::move(entry));
 }
 
 void Request::setVerbose(bool verbose) {
   verbose_ = verbose;
 }
 
+Request::Request(Context* context, std::unique_ptr<UnixSocket> socket)
+    : id_(++idCounter_), profiler_(socket->ctime()),
+      socket_(std::move(socket)), context_(context) {
+}
+
 Request::~Request() {
   context_->logger->info("Request %d destroyed", id_);
 }
 
-std::string ParamSpec::help() {
+std::string ParamSpec::help() const {
   if (paramSpecs_.empty()) {
     return "Takes no arguments";
   }
@@ -131,3 +201,82 @@ std::string ParamSpec::help() {
   }
   return ss.str();
 }
+
+ParamValidator::ParamValidator(const ParamSpec& spec) : help_(spec.help()) {
+  for (const auto& [name, minmax] : spec.keyRestrictions_) {
+    if (keys_.size() == kMaxKeys) {
+      THROW("Too many restricted keys (max:%lu)", kMaxKeys);
+    }
+    keys_.push_back(Key{name, minmax.first, minmax.second});
+  }
+  params_.reserve(spec.paramSpecs_.size());
+  for (const auto& single : spec.paramSpecs_) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      if (single.keys.find(keys_[i].name) != single.keys.end()) {
+        mask |= 1u << i;
+      }
+    }
+    params_.push_back(Param{single.name, single.type, single.check, mask});
+  }
+}
+
+std::optional<std::string> ParamValidator::failReason(
+    const Parameters& parameters) const {
+  int counters[kMaxKeys] = {};
+  bool failed = false;
+  for (const auto& param : parameters.list()) {
+    if (param.raw) {
+      continue;
+    }
+    const Param* spec = find(param.name);
+    if (!spec || !spec->check(param)) {
+      failed = true;
+      continue;
+    }
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      counters[i] += (spec->keys >> i) & 1;
+    }
+  }
+  for (size_t i = 0; i < keys_.size() && !failed; ++i) {
+    failed = counters[i] < keys_[i].min ||
+      (keys_[i].max != -1 && counters[i] > keys_[i].max);
+  }
+  if (!failed) {
+    return std::nullopt;
+  }
+  std::string reason;
+  auto addFailReason = [&reason](const std::string& st) {
+    if (!reason.empty()) {
+      reason += ", ";
+    }
+    reason += st;
+  };
+  for (const auto& param : parameters.list()) {
+    const Param* spec = param.raw ? nullptr : find(param.name);
+    if (spec && !spec->check(param)) {
+      addFailReason(St::fmt("parameter %s is not %s: \"%.*s\"",
+          spec->name.c_str(), spec->type.c_str(),
+          (int)param.value.size(), param.value.data()));
+    }
+  }
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    const Key& key = keys_[i];
+    if (counters[i] < key.min) {
+      addFailReason(St::fmt("has %d %s (min:%d)",
+            counters[i], key.name.c_str(), key.min));
+    }
+    if (key.max != -1 && counters[i] > key.max) {
+      addFailReason(St::fmt("has %d %s (max:%d)",
+            counters[i], key.name.c_str(), key.max));
+    }
+  }
+  for (const auto& param : parameters.list()) {
+    if (!param.raw && !find(param.name)) {
+      addFailReason(St::fmt("was not expecting param %.*s with value \"%.*s\"",
+          (int)param.name.size(), param.name.data(),
+          (int)param.value.size(), param.value.data()));
+    }
+  }
+  return reason;
+}
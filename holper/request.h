@@ -10,10 +10,13 @@
 #include <vector>
 #include <set>
 #include <string>
+#include <string_view>
 #include <map>
 #include <optional>
+#include <cstdint>
 
 class Command;
+class Work;
 class Request;
 class Resolver;
 
@@ -45,72 +48,105 @@ public:
 
 
 class Parameters {
-  friend class Request;
-  std::map<std::string,std::string> parameters_;
-  std::map<std::string,rapidjson::Value> rawParameters_;
-  void set(std::map<std::string,std::string>&& parameters,
-      std::map<std::string, rapidjson::Value>&& rawParameters) {
-    parameters_ = std::move(parameters);
-    rawParameters_ = std::move(rawParameters);
+public:
+  // Name and value point into the request payload which Parameters owns.
+  // Non-string values are only reachable through raw.
+  class Parameter {
+    friend class Parameters;
+    mutable std::optional<std::optional<int>> int_;
+    mutable std::optional<std::optional<float>> float_;
+    template <typename T>
+    std::optional<T> convert() const {
+      T val;
+      if (St::to<T>(value, val)) {
+        return val;
+      }
+      return std::nullopt;
+    }
+    template <typename T>
+    std::optional<T> cached(std::optional<std::optional<T>>& cache) const {
+      if (!cache) {
+        cache = convert<T>();
+      }
+      return *cache;
+    }
+  public:
+    std::string_view name;
+    std::string_view value;
+    rapidjson::Value* raw = nullptr;
+    Parameter(std::string_view n, std::string_view v, rapidjson::Value* r)
+      : name(n), value(v), raw(r) {}
+    template <typename T>
+    std::optional<T> as() const {
+      return convert<T>();
+    }
+  };
+private:
+  std::vector<char> payload_;
+  std::unique_ptr<rapidjson::Document> doc_;
+  std::vector<Parameter> parameters_;
+  const Parameter* find(std::string_view name, bool raw) const {
+    for (const auto& param : parameters_) {
+      if ((param.raw != nullptr) == raw && param.name == name) {
+        return &param;
+      }
+    }
+    return nullptr;
   }
 public:
   Parameters() {}
-  Parameters(Parameters&& p)
-    : parameters_(std::move(p.parameters_)),
-      rawParameters_(std::move(p.rawParameters_)) {}
-
-  Parameters(std::map<std::string,std::string>&& parameters,
-        std::map<std::string, rapidjson::Value>&& rawParameters)
-    : parameters_(std::move(parameters)),
-      rawParameters_(std::move(rawParameters)) {}
+  Parameters(Parameters&& p) = default;
+  // payload must be the buffer doc was parsed in situ from
+  Parameters(std::vector<char>&& payload,
+      std::unique_ptr<rapidjson::Document> doc);
 
-  const std::map<std::string,std::string>& map() const {
+  const std::vector<Parameter>& list() const {
     return parameters_;
   }
   template <typename T>
-  std::optional<T> get(const std::string& name, bool* exists = nullptr) const {
-    auto it = parameters_.find(name);
-    if (it == parameters_.end()) {
-      if (exists) {
-        *exists = false;
-      }
-      return std::nullopt;
-    }
+  std::optional<T> get(std::string_view name, bool* exists = nullptr) const {
+    const Parameter* param = find(name, false);
     if (exists) {
-      *exists = true;
+      *exists = param != nullptr;
     }
-    T val;
-    if(St::to<T>(it->second, val)) {
-      return val;
+    if (!param) {
+      return std::nullopt;
     }
-    return std::nullopt;
+    return param->as<T>();
   }
-  rapidjson::Value& getRaw(const std::string& name, bool* exists = nullptr);
+  rapidjson::Value& getRaw(std::string_view name, bool* exists = nullptr);
 };
 
+template <>
+inline std::optional<int> Parameters::Parameter::as<int>() const {
+  return cached(int_);
+}
+
+template <>
+inline std::optional<float> Parameters::Parameter::as<float>() const {
+  return cached(float_);
+}
+
 class ParamSpec {
 private:
-  const Parameters* parameters_;
-  std::map<std::string, int> counters_;
-  std::set<std::string> parametersAccountedFor_;
-  std::string failReason_;
-  bool validate_;
-  void addFailReason(const std::string& st) {
-    failReason_ += st + ", ";
+  friend class ParamValidator;
+  typedef bool (*Checker)(const Parameters::Parameter&);
+  template <typename T>
+  static bool check(const Parameters::Parameter& param) {
+    return param.as<T>().has_value();
   }
   struct SingleParamSpec {
     std::string name;
     std::string type;
     std::string help;
     std::set<std::string> keys;
+    Checker check;
   };
   std::vector<SingleParamSpec> paramSpecs_;
   std::map<std::string, std::pair<int, int>> keyRestrictions_;
 public:
-  std::string help();
-  ParamSpec(const Parameters& parameters, bool validate)
-    : parameters_(&parameters), validate_(validate) {
-  }
+  std::string help() const;
+  ParamSpec() {}
   template <typename T>
   ParamSpec& param(const std::string& name, const std::string& key,
       const std::string& help) {
@@ -119,28 +155,13 @@ public:
   template <typename T>
   ParamSpec& param(const std::string& name,
       const std::set<std::string>& keys, const std::string& help) {
-    if (parametersAccountedFor_.find(name) != parametersAccountedFor_.end()) {
-      THROW("Parameter %s specified multiple times!", name.c_str());
-    }
-    parametersAccountedFor_.insert(name);
-      paramSpecs_.push_back(SingleParamSpec{name, St::to<T>(), help, keys});
-    if (!validate_) {
-      return *this;
-    }
-    bool exists;
-    if (!parameters_->get<T>(name, &exists) && exists) {
-      addFailReason(St::fmt("parameter %s is not %s: \"%s\"", name.c_str(),
-          St::to<T>(), parameters_->get<std::string>(name)->c_str()));
-    } else if (exists) {
-      for (const auto& key : keys) {
-        auto it = counters_.find(key);
-        if (it == counters_.end()) {
-          counters_.insert(std::make_pair(key, 1));
-        } else {
-          it->second++;
-        }
+    for (const auto& spec : paramSpecs_) {
+      if (spec.name == name) {
+        THROW("Parameter %s specified multiple times!", name.c_str());
       }
     }
+    paramSpecs_.push_back(
+        SingleParamSpec{name, St::to<T>(), help, keys, &check<T>});
     return *this;
   }
   ParamSpec& key(const std::string& key, int min, int max) {
@@ -149,33 +170,43 @@ public:
           key.c_str(), min, max);
     }
     keyRestrictions_[key] = std::make_pair(min, max);
-    if (!validate_) {
-      return *this;
-    }
-    auto it = counters_.find(key);
-    int val = it == counters_.end() ? 0 : it->second;
-    if (val < min) {
-      addFailReason(St::fmt("has %d %s (min:%d)", val, key.c_str(), min));
-    }
-    if (val > max && max != -1) {
-      addFailReason(St::fmt("has %d %s (max:%d)", val, key.c_str(), max));
-    }
     return *this;
   }
-  std::optional<std::string> failReason() {
-    for (const auto& [key, val] : parameters_->map()) {
-      if (parametersAccountedFor_.find(key) == parametersAccountedFor_.end()) {
-        addFailReason(St::fmt("was not expecting param %s with value \"%s\"",
-            key.c_str(), val.c_str()));
+};
+
+// ParamSpec compiled into flat tables once per Action. Restricted keys are
+// indexed so that each parameter carries a bitmask of the keys it counts
+// towards; validating a well formed request does not allocate.
+class ParamValidator {
+private:
+  static constexpr size_t kMaxKeys = 32;
+  struct Param {
+    std::string name;
+    std::string type;
+    ParamSpec::Checker check;
+    uint32_t keys;
+  };
+  struct Key {
+    std::string name;
+    int min;
+    int max;
+  };
+  std::vector<Param> params_;
+  std::vector<Key> keys_;
+  std::string help_;
+  const Param* find(std::string_view name) const {
+    for (const auto& param : params_) {
+      if (param.name == name) {
+        return &param;
       }
     }
-    if (failReason_.empty()) {
-      return std::nullopt;
-    } else {
-      failReason_.pop_back();
-      failReason_.pop_back();
-      return failReason_;
-    }
+    return nullptr;
+  }
+public:
+  explicit ParamValidator(const ParamSpec& spec);
+  std::optional<std::string> failReason(const Parameters& parameters) const;
+  const std::string& help() const {
+    return help_;
   }
 };
 
@@ -195,12 +226,13 @@ class Request {
   Response response_;
   Context* context_;
   bool verbose_ = false;
+  const Command* command_ = nullptr;
+  // Kept until the response is sent for its parameters
+  std::unique_ptr<Work> work_;
   void setVerbose(bool verbose);
+  void keepIfSlow(int code);
 public:
-  Request(Context* context, std::unique_ptr<UnixSocket> socket)
-      : id_(++idCounter_), profiler_(socket->ctime()),
-        socket_(std::move(socket)), context_(context) {
-  }
+  Request(Context* context, std::unique_ptr<UnixSocket> socket);
   ~Request();
   int id() const {
     return id_;
@@ -219,5 +251,11 @@ public:
     return verbose_;
   }
 
-  void sendResponse(int code);
+  // Set once the resolver has found the command
+  const Command* command() const {
+    return command_;
+  }
+
+  // Returns the number of bytes written
+  size_t sendResponse(int code);
 };
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include "request.h"
+
+namespace {
+  Parameters makeParameters(const char* json) {
+    std::vector<char> payload(json, json + strlen(json) + 1);
+    auto doc = std::make_unique<rapidjson::Document>();
+    doc->ParseInsitu(payload.data());
+    return Parameters(std::move(payload), std::move(doc));
+  }
+}
+
+TEST(ParametersTest, get) {
+  Parameters params = makeParameters(
+      R"({"parameters": {"num": "12", "str": "abc", "none": ""}})");
+  bool exists;
+  EXPECT_EQ(*params.get<int>("num", &exists), 12);
+  EXPECT_TRUE(exists);
+  EXPECT_FLOAT_EQ(*params.get<float>("num"), 12.0f);
+  EXPECT_EQ(*params.get<std::string_view>("str"), "abc");
+  EXPECT_EQ(*params.get<std::string>("str"), "abc");
+  EXPECT_FALSE(params.get<int>("str", &exists));
+  EXPECT_TRUE(exists);
+  EXPECT_TRUE(params.get<std::nullptr_t>("none"));
+  EXPECT_FALSE(params.get<int>("missing", &exists));
+  EXPECT_FALSE(exists);
+}
+
+TEST(ParametersTest, cachedValueSurvivesMove) {
+  Parameters params = makeParameters(R"({"parameters": {"num": "7"}})");
+  EXPECT_EQ(*params.get<int>("num"), 7);
+  Parameters moved(std::move(params));
+  EXPECT_EQ(*moved.get<int>("num"), 7);
+  EXPECT_EQ(moved.list().size(), 1);
+  EXPECT_EQ(moved.list()[0].name, "num");
+}
+
+TEST(ParametersTest, raw) {
+  Parameters params = makeParameters(
+      R"({"parameters": {"list": [1, 2], "str": "abc"}})");
+  bool exists;
+  EXPECT_TRUE(params.getRaw("list", &exists).IsArray());
+  EXPECT_TRUE(exists);
+  params.getRaw("str", &exists);
+  EXPECT_FALSE(exists);
+  EXPECT_FALSE(params.get<std::string>("list", &exists));
+  EXPECT_FALSE(exists);
+}
+
+namespace {
+  ParamSpec makeSpec() {
+    ParamSpec spec;
+    spec
+      .param<int>("set", "operations", "sets value")
+      .param<int>("incr", "operations", "increments value")
+      .param<std::nullptr_t>("toggle", "operations", "toggles value")
+      .param<float>("ratio", "", "ratio")
+      .key("operations", 1, 1);
+    return spec;
+  }
+}
+
+TEST(ParamValidatorTest, valid) {
+  ParamValidator validator(makeSpec());
+  EXPECT_FALSE(validator.failReason(
+        makeParameters(R"({"parameters": {"set": "5"}})")));
+  EXPECT_FALSE(validator.failReason(
+        makeParameters(R"({"parameters": {"toggle": "", "ratio": "0.5"}})")));
+}
+
+TEST(ParamValidatorTest, invalid) {
+  ParamValidator validator(makeSpec());
+  auto reason = validator.failReason(makeParameters(R"({"parameters": {}})"));
+  ASSERT_TRUE(reason);
+  EXPECT_EQ(*reason, "has 0 operations (min:1)");
+  reason = validator.failReason(
+      makeParameters(R"({"parameters": {"set": "5", "incr": "1"}})"));
+  ASSERT_TRUE(reason);
+  EXPECT_EQ(*reason, "has 2 operations (max:1)");
+  reason = validator.failReason(
+      makeParameters(R"({"parameters": {"set": "x", "foo": "bar"}})"));
+  ASSERT_TRUE(reason);
+  EXPECT_EQ(*reason, "parameter set is not number: \"x\", "
+      "has 0 operations (min:1), "
+      "was not expecting param foo with value \"bar\"");
+}
+
+TEST(ParamValidatorTest, help) {
+  ParamValidator validator(makeSpec());
+  EXPECT_EQ(validator.help(), makeSpec().help());
+  EXPECT_NE(validator.help().find("set:VALUE(number)"), std::string::npos);
+  EXPECT_ANY_THROW(ParamSpec().param<int>("a", "", "").param<int>("a", "", ""));
+}
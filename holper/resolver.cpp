@@ -1,5 +1,6 @@
 #include "resolver.h"
 #include "logger.h"
+#include "flightrecorder.h"
 #include "string.h"
 #include "commandmanager.h"
 #include "command.h"
@@ -8,57 +9,55 @@
 #include <rapidjson/document.h>
 #include <vector>
 #include <string>
-#include <map>
+#include <string_view>
 
 void Resolver::sendToResponder(Request* request,
     std::unique_ptr<WorkResult> result) {
   // This runs in worker threads
   context_->logger->info("Sending request %d to responder", request->id());
   request->profiler().join(result->work->profiler(), "Work.");
+  request->work_ = std::move(result->work);
   context_->responder->sendMessage(std::make_unique<ResponderArgs>(
         std::unique_ptr<Request>(request),
         std::move(result->result.Move()),
         result->code));
 }
 
+Resolver::Resolver(Context* context) : Thread("Resolver", context) {
+  if (context_->metrics) {
+    bytesReceived_ = context_->metrics->counter(
+        "holper_received_bytes", "Bytes of requests read from clients");
+  }
+}
+
 void Resolver::handleMessage(std::unique_ptr<ResolverArgs> msg) {
   std::unique_ptr<Request> request = std::move(msg->request);
-  request->profiler().event("Received by Resolver");
+  FlightRecorder::RequestScope scope(request->id());
+  request->profiler().event(Profiler::RECEIVED_BY_RESOLVER);
   context_->logger->info("Resolver received request %d", request->id());
-  std::string payload = request->socket()->read();
-  rapidjson::Document doc;
-  doc.Parse(payload.c_str());
-  context_->logger->info("Request %d: %s", request->id(), payload.c_str());
-  request->setVerbose(doc["verbose"].GetBool());
-  std::vector<std::string> command_tokens;
-  for ( auto& val : doc["command"].GetArray() ) {
-    command_tokens.push_back(std::string(val.GetString(), val.GetStringLength()));
-  }
-  std::map<std::string, std::string> str_parameters;
-  std::map<std::string, rapidjson::Value> raw_parameters;
-  for ( auto& val : doc["parameters"].GetObject() ) {
-    auto& name = val.name;
-    auto& value = val.value;
-    if (value.IsString()) {
-      str_parameters.insert(std::make_pair<std::string, std::string>(
-            std::move(std::string(name.GetString(), name.GetStringLength())),
-            std::move(std::string(value.GetString(), value.GetStringLength()))));
-    } else {
-      raw_parameters.insert(std::make_pair<std::string, rapidjson::Value>(
-        std::move(std::string(name.GetString(), name.GetStringLength())),
-        std::move(value.Move())
-      ));
-    }
+  std::vector<char> payload = request->socket()->readBuffer();
+  // readBuffer() null terminates the payload
+  bytesReceived_.add(payload.size() - 1);
+  context_->logger->info("Request %d: %s", request->id(), payload.data());
+  auto doc = std::make_unique<rapidjson::Document>();
+  doc->ParseInsitu(payload.data());
+  request->setVerbose((*doc)["verbose"].GetBool());
+  std::vector<std::string_view> command_tokens;
+  for ( auto& val : (*doc)["command"].GetArray() ) {
+    command_tokens.push_back(
+        std::string_view(val.GetString(), val.GetStringLength()));
   }
-  Parameters parameters(std::move(str_parameters), std::move(raw_parameters));
-  request->profiler().event("Payload json parsed");
+  request->profiler().event(Profiler::PAYLOAD_PARSED);
+  Command* command = context_->commandManager->resolveCommand(command_tokens);
+  request->command_ = command;
+  Parameters parameters(std::move(payload), std::move(doc));
   auto work = std::make_unique<Work>(request->id(),
-      context_->commandManager->resolveCommand(command_tokens),
+      command,
       std::move(parameters),
       request->response().alloc(),
       std::bind(&Resolver::sendToResponder, this, request.get(),
           std::placeholders::_1));
-  request->profiler().event("Resolved command");
+  request->profiler().event(Profiler::RESOLVED_COMMAND);
   context_->logger->info("Request %d will run %s",
       request->id(),
       work->command()->name().c_str());
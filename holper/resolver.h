@@ -2,6 +2,7 @@
 #include "request.h"
 #include "thread.h"
 #include "context.h"
+#include "metrics.h"
 #include <memory>
 
 class WorkResult;
@@ -15,10 +16,11 @@ struct ResolverArgs {
 class Resolver : public Thread<ResolverArgs>
 {
 private:
+  Metrics::Counter bytesReceived_;
   void sendToResponder(Request* request,
       std::unique_ptr<WorkResult> result);
 public:
-  explicit Resolver(Context* context) : Thread("Resolver", context) {}
+  explicit Resolver(Context* context);
   ~Resolver() {}
   void handleMessage(std::unique_ptr<ResolverArgs> msg) override;
 };
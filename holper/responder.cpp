@@ -1,10 +1,44 @@
 #include "responder.h"
 #include "logger.h"
+#include "flightrecorder.h"
+#include "command.h"
+#include "commandmanager.h"
+
+Responder::Responder(Context* context) : Thread("Responder", context) {
+  if (context_->metrics) {
+    bytesSent_ = context_->metrics->counter(
+        "holper_sent_bytes", "Bytes of responses written to clients");
+  }
+}
+
+void Responder::count(const Command* command, int code) {
+  if (!context_->metrics || !command) {
+    return;
+  }
+  if (commandMetrics_.size() <= command->index()) {
+    commandMetrics_.resize(context_->commandManager->size());
+  }
+  CommandMetrics& metrics = commandMetrics_[command->index()];
+  if (!metrics.registered) {
+    std::string label = Metrics::label("command", command->path());
+    metrics.requests = context_->metrics->counter("holper_requests",
+        "Requests responded to", label);
+    metrics.errors = context_->metrics->counter("holper_request_errors",
+        "Requests that failed", label);
+    metrics.registered = true;
+  }
+  metrics.requests.add();
+  if (code != 0) {
+    metrics.errors.add();
+  }
+}
 
 void Responder::handleMessage(std::unique_ptr<ResponderArgs> msg) {
   std::unique_ptr<Request> request = std::move(msg->request);
+  FlightRecorder::RequestScope scope(request->id());
   context_->logger->info() << "Responder responding to " << request->id();
-  request->profiler().event("Received by Responder");
+  request->profiler().event(Profiler::RECEIVED_BY_RESPONDER);
   request->response().set("response", msg->response.Move());
-  request->sendResponse(msg->code);
+  count(request->command(), msg->code);
+  bytesSent_.add(request->sendResponse(msg->code));
 }
@@ -2,7 +2,9 @@
 #include "request.h"
 #include "thread.h"
 #include "context.h"
+#include "metrics.h"
 #include <memory>
+#include <vector>
 
 
 struct ResponderArgs {
@@ -16,8 +18,17 @@ struct ResponderArgs {
 
 class Responder : public Thread<ResponderArgs>
 {
+  struct CommandMetrics {
+    bool registered = false;
+    Metrics::Counter requests;
+    Metrics::Counter errors;
+  };
+  // Indexed by Command::index(), registered on first use
+  std::vector<CommandMetrics> commandMetrics_;
+  Metrics::Counter bytesSent_;
+  void count(const Command* command, int code);
 public:
-  explicit Responder(Context* context) : Thread("Responder", context) {}
+  explicit Responder(Context* context);
   void handleMessage(std::unique_ptr<ResponderArgs> msg) override;
 };
 
@@ -0,0 +1,280 @@
+#include "sampler.h"
+#include "thread.h"
+#include "exception.h"
+#include "string.h"
+#include <algorithm>
+#include <map>
+#include <csignal>
+#include <cstring>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <ucontext.h>
+#include <cxxabi.h>
+#include <sched.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+std::atomic<SamplingProfiler*> SamplingProfiler::active_;
+std::atomic<int> SamplingProfiler::handlersRunning_;
+
+namespace {
+// Clock id of another thread's CPU time, as pthread_getcpuclockid() would
+// return for it, see CPUCLOCK_* in the kernel's posix-timers.h
+clockid_t threadCpuClock(pid_t tid) {
+  return (~(clockid_t)tid << 3) | 6;
+}
+
+std::vector<pid_t> processThreads() {
+  std::vector<pid_t> tids;
+  DIR* dir = opendir("/proc/self/task");
+  if (dir == nullptr) {
+    THROW("Could not list threads: %s", St::errorString().c_str());
+  }
+  while (struct dirent* entry = readdir(dir)) {
+    int tid;
+    if (St::to(std::string_view(entry->d_name), tid)) {
+      tids.push_back(tid);
+    }
+  }
+  closedir(dir);
+  return tids;
+}
+}
+
+std::vector<SamplingProfiler::Range> SamplingProfiler::writableMappings() {
+  std::vector<Range> ranges;
+  FILE* maps = fopen("/proc/self/maps", "r");
+  if (maps == nullptr) {
+    THROW("Could not read mappings: %s", St::errorString().c_str());
+  }
+  char line[512];
+  while (fgets(line, sizeof(line), maps)) {
+    Range range;
+    char perms[5];
+    if (sscanf(line, "%lx-%lx %4s", &range.begin, &range.end, perms) == 3 &&
+        perms[0] == 'r' && perms[1] == 'w') {
+      ranges.push_back(range);
+    }
+    // skip the rest of overlong lines
+    while (!strchr(line, '\n') && fgets(line, sizeof(line), maps)) {}
+  }
+  fclose(maps);
+  // record() binary searches them
+  std::sort(ranges.begin(), ranges.end(),
+      [](const Range& a, const Range& b) { return a.begin < b.begin; });
+  return ranges;
+}
+
+SamplingProfiler::SamplingProfiler() {
+  int r = pthread_mutex_init(&mutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", StringUtils::errorString(r).c_str());
+  }
+}
+
+SamplingProfiler::~SamplingProfiler() {
+  if (running()) {
+    stop();
+  }
+}
+
+bool SamplingProfiler::running() {
+  LockMutex lock(&mutex_);
+  return running_;
+}
+
+void SamplingProfiler::handleSignal(int UNUSED(signal),
+    siginfo_t* UNUSED(info), void* context) {
+  int savedErrno = errno;
+  handlersRunning_.fetch_add(1);
+  SamplingProfiler* profiler = active_.load();
+  if (profiler) {
+    profiler->record(context);
+  }
+  handlersRunning_.fetch_sub(1);
+  errno = savedErrno;
+}
+
+void SamplingProfiler::record(void* context) {
+#if defined(__x86_64__)
+  size_t index = next_.fetch_add(1, std::memory_order_relaxed);
+  if (index >= samples_.size()) {
+    return;
+  }
+  Sample& sample = samples_[index];
+  const mcontext_t& mcontext = ((ucontext_t*)context)->uc_mcontext;
+  sample.tid = gettid();
+  sample.pcs[0] = mcontext.gregs[REG_RIP];
+  sample.depth = 1;
+  uintptr_t sp = mcontext.gregs[REG_RSP];
+  uintptr_t fp = mcontext.gregs[REG_RBP];
+  // The mapping holding the stack, frames must stay inside it and move
+  // towards its base
+  auto range = std::upper_bound(stacks_.begin(), stacks_.end(), sp,
+      [](uintptr_t addr, const Range& range) { return addr < range.end; });
+  if (range == stacks_.end() || sp < range->begin) {
+    return;
+  }
+  uintptr_t limit = range->end - 2 * sizeof(uintptr_t);
+  while (sample.depth < kMaxDepth && fp >= sp && fp <= limit &&
+      fp % sizeof(uintptr_t) == 0) {
+    uintptr_t next = ((uintptr_t*)fp)[0];
+    uintptr_t pc = ((uintptr_t*)fp)[1];
+    if (pc == 0) {
+      break;
+    }
+    sample.pcs[sample.depth++] = pc;
+    if (next <= fp) {
+      break;
+    }
+    fp = next;
+  }
+#else
+  (void)context;
+#endif
+}
+
+void SamplingProfiler::start(int hz, size_t maxSamples) {
+#if !defined(__x86_64__)
+  THROW("Sampling is only supported on x86-64");
+#endif
+  if (hz <= 0 || hz > 10000) {
+    THROW("Sampling rate must be between 1 and 10000: %d", hz);
+  }
+  LockMutex lock(&mutex_);
+  if (running_) {
+    THROW("Profiler is already running");
+  }
+  unsaved_.reset();
+  samples_.assign(maxSamples, Sample());
+  stacks_ = writableMappings();
+  next_ = 0;
+  SamplingProfiler* expected = nullptr;
+  if (!active_.compare_exchange_strong(expected, this)) {
+    THROW("Another profiler is already running");
+  }
+  struct sigaction action = {};
+  action.sa_sigaction = &SamplingProfiler::handleSignal;
+  action.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  if (sigaction(SIGPROF, &action, nullptr) != 0) {
+    active_ = nullptr;
+    THROW("Could not install SIGPROF handler: %s",
+        St::errorString().c_str());
+  }
+  struct itimerspec interval = {};
+  interval.it_interval.tv_sec = hz == 1 ? 1 : 0;
+  interval.it_interval.tv_nsec = hz == 1 ? 0 : 1000000000 / hz;
+  interval.it_value = interval.it_interval;
+  for (pid_t tid : processThreads()) {
+    struct sigevent event = {};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event.sigev_notify_thread_id = tid;
+    timer_t timer;
+    if (timer_create(threadCpuClock(tid), &event, &timer) != 0) {
+      // the thread exited since we listed it
+      continue;
+    }
+    timers_.push_back(timer);
+    if (timer_settime(timer, 0, &interval, nullptr) != 0) {
+      int err = errno;
+      stopTimers();
+      THROW("Could not arm sampling timer: %s", St::errorString(err).c_str());
+    }
+  }
+  running_ = true;
+}
+
+void SamplingProfiler::stopTimers() {
+  for (timer_t timer : timers_) {
+    timer_delete(timer);
+  }
+  timers_.clear();
+  // Drops signals that are still pending, the default action would kill us
+  signal(SIGPROF, SIG_IGN);
+  active_ = nullptr;
+  // Let handlers that already picked us up finish their sample
+  while (handlersRunning_.load() != 0) {
+    sched_yield();
+  }
+}
+
+SamplingProfiler::Result SamplingProfiler::stop() {
+  LockMutex lock(&mutex_);
+  if (!running_) {
+    if (unsaved_) {
+      Result result = std::move(*unsaved_);
+      unsaved_.reset();
+      return result;
+    }
+    THROW("Profiler is not running");
+  }
+  stopTimers();
+  running_ = false;
+  size_t taken = next_.load();
+  size_t count = std::min(taken, samples_.size());
+  std::map<pid_t, std::string> threads;
+  std::map<uintptr_t, std::string> symbols;
+  std::map<std::string, size_t> stacks;
+  std::string stack;
+  for (size_t i = 0; i < count; ++i) {
+    const Sample& sample = samples_[i];
+    auto thread = threads.find(sample.tid);
+    if (thread == threads.end()) {
+      thread = threads.emplace(sample.tid,
+          ThreadBase::threadName(sample.tid)).first;
+    }
+    stack = thread->second;
+    for (size_t depth = sample.depth; depth > 0; --depth) {
+      uintptr_t pc = sample.pcs[depth - 1];
+      auto symbol = symbols.find(pc);
+      if (symbol == symbols.end()) {
+        // return addresses point after the call
+        symbol = symbols.emplace(pc, symbolize(depth == 1 ? pc : pc - 1))
+          .first;
+      }
+      stack += ";";
+      stack += symbol->second;
+    }
+    stacks[stack] += 1;
+  }
+  std::string folded;
+  for (const auto& [line, samples] : stacks) {
+    folded += St::fmt("%s %lu\n", line.c_str(), samples);
+  }
+  samples_ = std::vector<Sample>();
+  stacks_ = std::vector<Range>();
+  return Result{count, taken - count, folded};
+}
+
+void SamplingProfiler::keep(Result result) {
+  LockMutex lock(&mutex_);
+  unsaved_ = std::move(result);
+}
+
+std::string SamplingProfiler::symbolize(uintptr_t pc) {
+  Dl_info info;
+  if (dladdr((void*)pc, &info) == 0) {
+    return St::fmt("0x%lx", pc);
+  }
+  if (info.dli_sname == nullptr) {
+    const char* object = info.dli_fname ? strrchr(info.dli_fname, '/') : nullptr;
+    return St::fmt("%s+0x%lx", object ? object + 1 : "?",
+        pc - (uintptr_t)info.dli_fbase);
+  }
+  int status;
+  char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr,
+      &status);
+  std::string name = status == 0 ? demangled : info.dli_sname;
+  free(demangled);
+  // ';' separates frames in the folded format
+  for (char& c : name) {
+    if (c == ';') {
+      c = ':';
+    }
+  }
+  return name;
+}
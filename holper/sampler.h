@@ -0,0 +1,66 @@
+#pragma once
+#include <atomic>
+#include <optional>
+#include <string>
+#include <vector>
+#include <ctime>
+#include <csignal>
+#include <pthread.h>
+#include <sys/types.h>
+#include "holper.h"
+
+// Samples the call stacks of every daemon thread from a SIGPROF handler
+// driven by per thread CPU time timers, so idle threads cost nothing.
+// Stacks are walked through frame pointers into a preallocated buffer and
+// symbolized into folded stacks (flamegraph.pl input) once sampling stops.
+// Only one sampler can run in a process at a time.
+class SamplingProfiler
+{
+public:
+  static constexpr size_t kMaxDepth = 32;
+  struct Sample {
+    pid_t tid;
+    u64 depth;
+    uintptr_t pcs[kMaxDepth];
+  };
+  struct Result {
+    size_t samples;
+    size_t dropped;
+    // "thread;outermost;...;innermost count" lines
+    std::string folded;
+  };
+private:
+  struct Range {
+    uintptr_t begin;
+    uintptr_t end;
+  };
+  static std::atomic<SamplingProfiler*> active_;
+  static std::atomic<int> handlersRunning_;
+  std::vector<Sample> samples_;
+  std::atomic<size_t> next_ = 0;
+  std::vector<timer_t> timers_;
+  // Writable mappings when sampling started. Frames are only followed
+  // inside the one holding the interrupted stack pointer, code without
+  // frame pointers leaves anything in RBP.
+  std::vector<Range> stacks_;
+  pthread_mutex_t mutex_;
+  bool running_ = false;
+  std::optional<Result> unsaved_;
+  static void handleSignal(int signal, siginfo_t* info, void* context);
+  void record(void* context);
+  static std::vector<Range> writableMappings();
+  void stopTimers();
+public:
+  SamplingProfiler();
+  ~SamplingProfiler();
+  bool running();
+  // Samples threads that exist now at hz per second of CPU time each,
+  // keeping at most maxSamples stacks
+  void start(int hz, size_t maxSamples);
+  // When not running, returns the result handed to keep()
+  Result stop();
+  // Holds on to a result that could not be saved until the next stop()
+  // or start()
+  void keep(Result result);
+  static std::string symbolize(uintptr_t pc);
+};
@@ -0,0 +1,99 @@
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <atomic>
+#include <sys/mman.h>
+#include "sampler.h"
+#include "time.h"
+
+namespace {
+__attribute__((noinline)) double spin(double seconds) {
+  TimePoint start;
+  double sum = 0;
+  while ((TimePoint() - start).value() < seconds) {
+    sum += 1.0;
+  }
+  return sum;
+}
+
+struct BadFramePointer {
+  uintptr_t rbp;
+  std::atomic<bool> stop = false;
+};
+
+// Spins with RBP pointing just past the end of the thread's stack, as code
+// built without frame pointers may leave it
+void* spinWithoutFramePointer(void* arg) {
+#if defined(__x86_64__)
+  auto* bad = (BadFramePointer*)arg;
+  asm volatile(
+      "mov %%rbp, %%r12\n"
+      "mov %0, %%rbp\n"
+      "1: cmpb $0, (%1)\n"
+      "je 1b\n"
+      "mov %%r12, %%rbp\n"
+      : : "r"(bad->rbp), "r"(&bad->stop) : "r12", "memory");
+#else
+  (void)arg;
+#endif
+  return nullptr;
+}
+}
+
+TEST(SamplingProfilerTest, folded) {
+  pthread_setname_np(pthread_self(), "SamplerTest");
+  SamplingProfiler profiler;
+  EXPECT_THROW(profiler.stop(), std::exception);
+  EXPECT_THROW(profiler.start(0, 10), std::exception);
+  profiler.start(1000, 10000);
+  EXPECT_TRUE(profiler.running());
+  EXPECT_THROW(profiler.start(1000, 10000), std::exception);
+  SamplingProfiler other;
+  EXPECT_THROW(other.start(1000, 10000), std::exception);
+  spin(0.2);
+  auto result = profiler.stop();
+  EXPECT_FALSE(profiler.running());
+  // CPU time timers expire on scheduler ticks, so expect far fewer than 200
+  EXPECT_GT(result.samples, 5);
+  EXPECT_EQ(result.dropped, 0);
+  EXPECT_EQ(result.folded.rfind("SamplerTest;", 0), 0);
+  // writing it failed, the next stop gets it back
+  profiler.keep(std::move(result));
+  auto again = profiler.stop();
+  EXPECT_EQ(again.folded.rfind("SamplerTest;", 0), 0);
+  EXPECT_THROW(profiler.stop(), std::exception);
+}
+
+TEST(SamplingProfilerTest, limit) {
+  SamplingProfiler profiler;
+  profiler.start(1000, 5);
+  spin(0.1);
+  auto result = profiler.stop();
+  EXPECT_EQ(result.samples, 5);
+  EXPECT_GT(result.dropped, 0);
+}
+
+TEST(SamplingProfilerTest, garbageFramePointer) {
+  const size_t kStackSize = 1 << 18;
+  const size_t kPage = 4096;
+  // the stack with an unreadable page above it
+  char* map = (char*)mmap(nullptr, kStackSize + kPage,
+      PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ASSERT_NE(map, MAP_FAILED);
+  ASSERT_EQ(mprotect(map + kStackSize, kPage, PROT_NONE), 0);
+  BadFramePointer bad;
+  bad.rbp = (uintptr_t)(map + kStackSize + 64);
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setstack(&attr, map, kStackSize);
+  pthread_t thread;
+  ASSERT_EQ(pthread_create(&thread, &attr, spinWithoutFramePointer, &bad), 0);
+  pthread_attr_destroy(&attr);
+  SamplingProfiler profiler;
+  profiler.start(1000, 10000);
+  spin(0.2);
+  auto result = profiler.stop();
+  bad.stop = true;
+  pthread_join(thread, nullptr);
+  munmap(map, kStackSize + kPage);
+  EXPECT_GT(result.samples, 5);
+}
@@ -16,13 +16,25 @@
 #include "music.h"
 #include "system.h"
 #include "clipboard.h"
+#include "flightrecorder.h"
+#include "latency.h"
+#include "profiler.h"
+#include "trace.h"
+#include "sampler.h"
+#include "metrics.h"
+#include "slowrequests.h"
+#include "subprocessmanager.h"
+#include "xclipboard.h"
+#include "sysfs.h"
+#include "brightnessfader.h"
+#include "pulseclient.h"
 #include <memory>
 #include <string>
 #include <cstdio>
 #include <unistd.h>
 #include <sys/stat.h>
-#include <fcntl.h>
 #include <systemd/sd-daemon.h>
+#include <X11/Xlib.h>
 
 class Server
 {
@@ -57,6 +69,9 @@ public:
 };
 
 int main(int argc, char** argv) {
+  // workers, the fader and the clipboard all talk to X
+  XInitThreads();
+  Profiler::calibrate();
   Context context;
   int opt;
   std::string socket_path = St::fmt(
@@ -66,6 +81,12 @@ int main(int argc, char** argv) {
   bool verbose = false;
   size_t worker_threads = 4;
   bool dev_mode = false;
+  bool sync_logging = false;
+  const size_t kLogSegmentCount = 4;
+  size_t log_segment_mb = 4;
+  const size_t kFlightRecorderSize = 4096;
+  const size_t kSlowRequestCount = 64;
+  size_t slow_request_ms = 100;
   auto print_help_and_exit = [&](int code) {
     printf("Holper server - System control helper\n");
     printf("Options:\n");
@@ -75,11 +96,16 @@ int main(int argc, char** argv) {
     printf("  -s [PATH]: Use provided unix socket path (current: %s)\n",
         socket_path.c_str());
     printf("  -v: Verbose\n");
+    printf("  -l [MB]: Log file segment size, %lu are kept (current: %lu)\n",
+        kLogSegmentCount, log_segment_mb);
+    printf("  -y: Synchronous logging (write logs on the calling thread)\n");
     printf("  -w [COUNT]: Worker thread count (current: %lu)\n",
         worker_threads);
+    printf("  -S [MS]: Keep requests slower than this or the p99 "
+        "(current: %lu)\n", slow_request_ms);
     exit(code);
   };
-  while ((opt = getopt(argc, argv, "+ds:vw:h")) != -1) {
+  while ((opt = getopt(argc, argv, "+ds:vw:l:yS:h")) != -1) {
     switch(opt) {
       case 'd':
         socket_path = dev_socket_path;
@@ -97,12 +123,28 @@ int main(int argc, char** argv) {
           print_help_and_exit(-1);
         }
         break;
+      case 'l':
+        if (1 != sscanf(optarg, "%lu", &log_segment_mb) || !log_segment_mb) {
+          print_help_and_exit(-1);
+        }
+        break;
+      case 'y':
+        sync_logging = true;
+        break;
+      case 'S':
+        if (1 != sscanf(optarg, "%lu", &slow_request_ms)) {
+          print_help_and_exit(-1);
+        }
+        break;
       case 'h':
       default:
         print_help_and_exit(opt == 'h' ? 0 : -1);
     }
   }
   context.logger.reset(new Logger(verbose ? Logger::DEBUG : Logger::MUSTFIX));
+  context.flightRecorder = std::make_shared<FlightRecorder>(
+      kFlightRecorderSize, Logger::INFO);
+  context.logger->setFlightRecorder(context.flightRecorder);
   context.logger->addTarget(
       std::make_unique<FDLogTarget>(STDOUT_FILENO, false));
   std::string logfile;
@@ -111,13 +153,19 @@ int main(int argc, char** argv) {
   } else {
     logfile = St::fmt("/run/user/%d/holperd.log", getuid());
   }
-  int logfd = open(logfile.c_str(), O_APPEND | O_CREAT | O_SYNC | O_WRONLY,
-      S_IRUSR | S_IWUSR);
-  if (logfd < 0) {
-    context.logger->logErrno("Log file %s failed to open", logfile.c_str());
-    THROW("Log file %s failed to open", logfile.c_str());
+  try {
+    context.logger->addTarget(std::make_unique<MmapLogTarget>(logfile,
+          log_segment_mb << 20, kLogSegmentCount));
+  } catch (std::exception& e) {
+    context.logger->error("%s", e.what());
+    throw;
+  }
+  if (!sync_logging) {
+    context.logger->startAsync();
   }
-  context.logger->addTarget(std::make_unique<FDLogTarget>(logfd, true));
+  context.metrics = std::make_shared<Metrics>();
+  context.slowRequests = std::make_shared<SlowRequests>(kSlowRequestCount,
+      slow_request_ms * 1000000);
   context.resolver.reset(new Resolver(&context));
   context.resolver->start();
   context.responder.reset(new Responder(&context));
@@ -129,6 +177,34 @@ int main(int argc, char** argv) {
   context.commandManager->registerCommandGroup<MusicCommandGroup>();
   context.commandManager->registerCommandGroup<SystemCommandGroup>();
   context.commandManager->registerCommandGroup<ClipboardCommandGroup>();
+  context.commandManager->freeze();
+  context.latency = std::make_shared<LatencyStats>(
+      context.commandManager->size());
+  context.trace = std::make_shared<TraceRecorder>();
+  context.sampler = std::make_shared<SamplingProfiler>();
+  context.sysfs = std::make_shared<SysfsDevices>();
+  try {
+    context.sysfsWatcher = std::make_shared<SysfsWatcher>(&context,
+        context.sysfs.get());
+    context.sysfsWatcher->start();
+  } catch (std::exception& e) {
+    context.logger->warn("Brightness is read on every request: %s", e.what());
+  }
+  context.fader = std::make_shared<BrightnessFader>(&context);
+  context.fader->start();
+  try {
+    context.pulse = std::make_shared<PulseClient>(&context);
+  } catch (std::exception& e) {
+    context.logger->warn("Volume commands are unavailable: %s", e.what());
+  }
+  context.subprocesses = std::make_shared<SubprocessManager>(&context);
+  context.subprocesses->start();
+  try {
+    context.clipboard = std::make_shared<XClipboard>(&context);
+    context.clipboard->start();
+  } catch (std::exception& e) {
+    context.logger->warn("Clipboard commands are unavailable: %s", e.what());
+  }
   context.workPool.reset(new WorkPool(&context, worker_threads));
   context.workPool->start();
   Server server(&context, socket_path);
@@ -0,0 +1,46 @@
+#include "slowrequests.h"
+#include "thread.h"
+#include "exception.h"
+
+SlowRequests::SlowRequests(size_t capacity, u64 thresholdNs)
+    : capacity_(capacity), thresholdNs_(thresholdNs) {
+  if (capacity == 0) {
+    THROW("Slow request capacity must be positive");
+  }
+  int r = pthread_mutex_init(&mutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", StringUtils::errorString(r).c_str());
+  }
+  entries_.reserve(capacity);
+}
+
+bool SlowRequests::observe(u64 totalNs) {
+  totals_.record(totalNs);
+  u64 count = totals_.count();
+  if (count == kMinRequests ||
+      (count > kMinRequests && count % kRefreshInterval == 0)) {
+    p99_.store(totals_.percentile(0.99), std::memory_order_relaxed);
+  }
+  return totalNs >= thresholdNs_ || totalNs > p99();
+}
+
+void SlowRequests::add(Entry&& entry) {
+  LockMutex lock(&mutex_);
+  if (entries_.size() < capacity_) {
+    entries_.push_back(std::move(entry));
+  } else {
+    entries_[next_] = std::move(entry);
+  }
+  next_ = (next_ + 1) % capacity_;
+}
+
+std::vector<SlowRequests::Entry> SlowRequests::list(size_t limit) const {
+  LockMutex lock(&mutex_);
+  std::vector<Entry> entries;
+  size_t count = std::min(limit, entries_.size());
+  entries.reserve(count);
+  for (size_t i = 1; i <= count; ++i) {
+    entries.push_back(entries_[(next_ + capacity_ - i) % capacity_]);
+  }
+  return entries;
+}
@@ -0,0 +1,52 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+#include <pthread.h>
+#include "holper.h"
+#include "metrics.h"
+#include "profiler.h"
+#include "time.h"
+
+// Keeps the whole timeline of requests that took longer than a fixed
+// threshold or the running p99, newest ones in a bounded ring. Fast
+// requests only pay for a histogram update and a comparison.
+class SlowRequests
+{
+public:
+  struct Entry {
+    int requestId;
+    std::string command;
+    int code;
+    u64 totalNs;
+    RealTimePoint finished;
+    std::vector<std::pair<std::string, std::string>> parameters;
+    Profiler profiler;
+  };
+  // p99 is only trusted after this many requests
+  static constexpr u64 kMinRequests = 100;
+  // and refreshed every this many requests
+  static constexpr u64 kRefreshInterval = 256;
+private:
+  size_t capacity_;
+  u64 thresholdNs_;
+  Histogram totals_;
+  std::atomic<u64> p99_ = ~0ull;
+  std::vector<Entry> entries_;
+  size_t next_ = 0;
+  mutable pthread_mutex_t mutex_;
+public:
+  SlowRequests(size_t capacity, u64 thresholdNs);
+  // Records the end to end latency and tells whether to keep the request
+  bool observe(u64 totalNs);
+  void add(Entry&& entry);
+  u64 p99() const {
+    return p99_.load(std::memory_order_relaxed);
+  }
+  u64 threshold() const {
+    return thresholdNs_;
+  }
+  // Newest first
+  std::vector<Entry> list(size_t limit) const;
+};
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include "slowrequests.h"
+
+namespace {
+SlowRequests::Entry entry(int id, u64 totalNs) {
+  return SlowRequests::Entry{id, "info stats", 0, totalNs, RealTimePoint(),
+    {{"count", "3"}}, Profiler()};
+}
+}
+
+TEST(SlowRequestsTest, threshold) {
+  SlowRequests slow(4, 1000000);
+  EXPECT_FALSE(slow.observe(999999));
+  EXPECT_TRUE(slow.observe(1000000));
+}
+
+TEST(SlowRequestsTest, p99) {
+  SlowRequests slow(4, ~0ull);
+  for (u64 i = 1; i < SlowRequests::kMinRequests; ++i) {
+    EXPECT_FALSE(slow.observe(i * 1000));
+  }
+  // p99 is known from here on
+  EXPECT_FALSE(slow.observe(1000));
+  EXPECT_LT(slow.p99(), 120000);
+  EXPECT_FALSE(slow.observe(50000));
+  EXPECT_TRUE(slow.observe(1000000));
+}
+
+TEST(SlowRequestsTest, ring) {
+  SlowRequests slow(3, 0);
+  EXPECT_TRUE(slow.list(10).empty());
+  for (int i = 1; i <= 5; ++i) {
+    slow.add(entry(i, i));
+  }
+  auto entries = slow.list(10);
+  ASSERT_EQ(entries.size(), 3);
+  EXPECT_EQ(entries[0].requestId, 5);
+  EXPECT_EQ(entries[1].requestId, 4);
+  EXPECT_EQ(entries[2].requestId, 3);
+  EXPECT_EQ(entries[0].parameters[0].second, "3");
+  EXPECT_EQ(slow.list(1).size(), 1);
+}
@@ -63,10 +63,9 @@ void UnixSocket::write(const std::string& data) {
 
 void UnixSocket::readRaw(u64 len, void* dest) {
   u64 total_read = 0;
-  TimePoint until;
-  until += TimeDelta(3.0);
+  CoarseTimePoint until = CoarseTimePoint() + TimeDelta(3.0);
   char* bytes = (char*)dest;
-  while (total_read < len && TimePoint() < until) {
+  while (total_read < len && CoarseTimePoint() < until) {
     int res = recv(socket_, bytes + total_read, len - total_read, MSG_WAITALL);
     if (res < 0) {
       THROW("Cannot read from unix socket: %s",
@@ -89,6 +88,15 @@ std::string UnixSocket::read() {
   return st;
 }
 
+std::vector<char> UnixSocket::readBuffer() {
+  u64 length;
+  readRaw(sizeof(u64), (void*)&length);
+  std::vector<char> buf(length + 1);
+  readRaw(length, (void*)buf.data());
+  buf[length] = '\0';
+  return buf;
+}
+
 void UnixSocket::serve(std::function<void(std::unique_ptr<UnixSocket>)> fn) {
   struct sockaddr_un addr;
   memset(&addr, 0, sizeof(struct sockaddr_un));
@@ -2,6 +2,7 @@
 #include "holper.h"
 #include "time.h"
 #include <string>
+#include <vector>
 #include <functional>
 #include <memory>
 
@@ -24,5 +25,7 @@ public:
   void serve(std::function<void(std::unique_ptr<UnixSocket>)> fn);
   void write(const std::string& data);
   std::string read();
+  // Null terminated, suitable for in situ parsing
+  std::vector<char> readBuffer();
   TimePoint ctime();
 };
@@ -3,27 +3,41 @@
 #include <stdarg.h>
 #include <cstring>
 #include <errno.h>
+#include <charconv>
+
+namespace {
+  template <typename T>
+  bool fromChars(std::string_view str, T& val) {
+    const char* end = str.data() + str.size();
+    auto [ptr, ec] = std::from_chars(str.data(), end, val);
+    return ec == std::errc() && ptr == end;
+  }
+}
 
 template <>
-bool StringUtils::to(const std::string& str, int& val) {
-  char tmp;
-  return sscanf(str.c_str(), "%d%c", &val, &tmp) == 1;
+bool StringUtils::to(std::string_view str, int& val) {
+  return fromChars(str, val);
 }
 
 template <>
-bool StringUtils::to(const std::string& str, float& val) {
-  char tmp;
-  return sscanf(str.c_str(), "%f%c", &val, &tmp) == 1;
+bool StringUtils::to(std::string_view str, float& val) {
+  return fromChars(str, val);
 }
 
 template <>
-bool StringUtils::to(const std::string& str, std::string& val) {
+bool StringUtils::to(std::string_view str, std::string& val) {
   val = str;
   return true;
 }
 
 template <>
-bool StringUtils::to(const std::string& str, nullptr_t& UNUSED(val)) {
+bool StringUtils::to(std::string_view str, std::string_view& val) {
+  val = str;
+  return true;
+}
+
+template <>
+bool StringUtils::to(std::string_view str, nullptr_t& UNUSED(val)) {
   return str.empty();
 }
 
@@ -69,3 +83,8 @@ template <>
 std::string StringUtils::to<std::string>() {
   return "string";
 }
+
+template <>
+std::string StringUtils::to<std::string_view>() {
+  return "string";
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include <string>
+#include <string_view>
 #include <vector>
 #include "exception.h"
 
@@ -8,27 +9,24 @@ namespace StringUtils {
   std::string errorString();
   std::string errorString(int err);
   template <typename T>
-  bool to(const std::string&, T&);
+  bool to(std::string_view, T&);
   template <typename T>
-  std::vector<T> split(const std::string& str, char delim) {
+  std::vector<T> split(std::string_view str, char delim) {
     std::vector<T> vec;
     size_t left = 0;
     T t;
     while(true) {
       size_t right = str.find(delim, left);
-      if (right == std::string::npos) {
-        if (!to<T>(std::string(str.c_str()+left), t)) {
-          THROW("Cannot parse %s", std::string(str.c_str()+left));
-        }
-        vec.push_back(t);
-        return vec;
+      std::string_view token = str.substr(left,
+          right == std::string_view::npos ? right : right - left);
+      if (!to<T>(token, t)) {
+        THROW("Cannot parse %.*s", (int)token.size(), token.data());
       }
-      if (!to(std::string(str.c_str()+left, right - left), t)) {
-        THROW("Cannot parse %s",
-            std::string(str.c_str()+left, right - left).c_str());
+      vec.push_back(t);
+      if (right == std::string_view::npos) {
+        return vec;
       }
       left = right + 1;
-      vec.push_back(t);
     }
   }
   template <typename T>
@@ -8,6 +8,13 @@ TEST(StringUtilsTest, to) {
   EXPECT_EQ(val, 123);
   EXPECT_FALSE(St::to("123a", val));
   EXPECT_FALSE(St::to("xyz", val));
+  EXPECT_FALSE(St::to("", val));
+  EXPECT_TRUE(St::to("-42", val));
+  EXPECT_EQ(val, -42);
+  float fval;
+  EXPECT_TRUE(St::to("1.5", fval));
+  EXPECT_FLOAT_EQ(fval, 1.5f);
+  EXPECT_FALSE(St::to("1.5f", fval));
   std::string str;
   EXPECT_TRUE(St::to("xyz", str));
   EXPECT_EQ(str, "xyz");
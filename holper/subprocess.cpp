@@ -0,0 +1,400 @@
+#include "subprocess.h"
+#include "exception.h"
+#include "string.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <spawn.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+
+extern char** environ;
+
+namespace {
+  // Keeps a write to a pipe whose reader has gone away from killing the
+  // daemon. The pending SIGPIPE is consumed before the mask is restored.
+  class BlockSigpipe {
+    sigset_t old_;
+    bool pending_ = false;
+  public:
+    BlockSigpipe() {
+      sigset_t set;
+      sigemptyset(&set);
+      sigaddset(&set, SIGPIPE);
+      sigset_t pending;
+      sigpending(&pending);
+      pending_ = sigismember(&pending, SIGPIPE);
+      pthread_sigmask(SIG_BLOCK, &set, &old_);
+    }
+    ~BlockSigpipe() {
+      sigset_t pending;
+      sigpending(&pending);
+      if (!pending_ && sigismember(&pending, SIGPIPE)) {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        struct timespec zero = {0, 0};
+        while (sigtimedwait(&set, nullptr, &zero) == -1 && errno == EINTR) {}
+      }
+      pthread_sigmask(SIG_SETMASK, &old_, nullptr);
+    }
+  };
+
+  int pidfdOpen(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+  }
+
+  void closePipe(int fds[2]) {
+    close(fds[0]);
+    close(fds[1]);
+  }
+}
+
+Subprocess::Subprocess(const std::vector<std::string>& args) {
+  if (args.empty()) {
+    THROW("No program given");
+  }
+  name_ = args[0];
+  std::vector<char*> argv;
+  for (const auto& arg : args) {
+    argv.push_back(const_cast<char*>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  // CLOEXEC so that children spawned concurrently by other threads don't
+  // inherit our ends, dup2 clears it on the child's 0, 1 and 2
+  int stdin_pipe[2], stdout_pipe[2], stderr_pipe[2];
+  if (0 != pipe2(stdin_pipe, O_CLOEXEC)) {
+    THROW("pipe failed: %s", St::errorString().c_str());
+  }
+  if (0 != pipe2(stdout_pipe, O_CLOEXEC)) {
+    closePipe(stdin_pipe);
+    THROW("pipe failed: %s", St::errorString().c_str());
+  }
+  if (0 != pipe2(stderr_pipe, O_CLOEXEC)) {
+    closePipe(stdin_pipe);
+    closePipe(stdout_pipe);
+    THROW("pipe failed: %s", St::errorString().c_str());
+  }
+  posix_spawn_file_actions_t actions;
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, stdin_pipe[0], 0);
+  posix_spawn_file_actions_adddup2(&actions, stdout_pipe[1], 1);
+  posix_spawn_file_actions_adddup2(&actions, stderr_pipe[1], 2);
+  // Worker threads may block signals and the sampler leaves SIGPROF
+  // ignored, neither should leak into the child
+  posix_spawnattr_t attr;
+  posix_spawnattr_init(&attr);
+  sigset_t mask;
+  sigemptyset(&mask);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  sigset_t defaults;
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  sigaddset(&defaults, SIGPROF);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK |
+      POSIX_SPAWN_SETSIGDEF);
+  int rc = posix_spawn(&pid_, argv[0], &actions, &attr, argv.data(), environ);
+  posix_spawn_file_actions_destroy(&actions);
+  posix_spawnattr_destroy(&attr);
+  close(stdin_pipe[0]);
+  close(stdout_pipe[1]);
+  close(stderr_pipe[1]);
+  in_ = stdin_pipe[1];
+  out_ = stdout_pipe[0];
+  err_ = stderr_pipe[0];
+  if (rc != 0) {
+    pid_ = -1;
+    closeFd(in_);
+    closeFd(out_);
+    closeFd(err_);
+    THROW("spawn %s failed: %s", name_.c_str(), St::errorString(rc).c_str());
+  }
+  for (int fd : {in_, out_, err_}) {
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  }
+  // without pidfd support (pre 5.3 kernels) advance polls waitpid instead
+  pidfd_ = pidfdOpen(pid_);
+  if (pidfd_ != -1) {
+    fcntl(pidfd_, F_SETFD, FD_CLOEXEC);
+  }
+}
+
+Subprocess::~Subprocess() {
+  closeFd(in_);
+  closeFd(out_);
+  closeFd(err_);
+  if (pid_ != -1) {
+    kill();
+  }
+  closeFd(pidfd_);
+}
+
+void Subprocess::closeFd(int& fd) {
+  if (fd != -1) {
+    close(fd);
+    fd = -1;
+  }
+}
+
+void Subprocess::onOutput(OutputFn out, OutputFn err) {
+  onOut_ = std::move(out);
+  onErr_ = std::move(err);
+}
+
+void Subprocess::setTimeout(TimeDelta timeout) {
+  deadline_ = TimePoint() + timeout;
+}
+
+int Subprocess::remainingMs() const {
+  if (!deadline_) {
+    return -1;
+  }
+  int64_t ns = (*deadline_ - TimePoint()).ns();
+  return ns <= 0 ? 0 : (int)((ns + 999999) / 1000000);
+}
+
+int Subprocess::pollTimeoutMs() const {
+  int timeout = remainingMs();
+  if (pollable()) {
+    return timeout;
+  }
+  return timeout == -1 ? kReapIntervalMs : std::min(timeout, kReapIntervalMs);
+}
+
+bool Subprocess::drain(int& fd, std::string& buf, const OutputFn& fn) {
+  char chunk[4096];
+  while (true) {
+    ssize_t sz = ::read(fd, chunk, sizeof(chunk));
+    if (sz > 0) {
+      if (fn) {
+        fn(std::string_view(chunk, sz));
+      } else {
+        buf.append(chunk, sz);
+      }
+    } else if (sz == 0) {
+      closeFd(fd);
+      return false;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return true;
+    } else if (errno != EINTR) {
+      THROW("read failed: %s", St::errorString().c_str());
+    }
+  }
+}
+
+void Subprocess::pump(bool wantWrite) {
+  struct pollfd fds[3];
+  nfds_t count = 0;
+  int* owners[3];
+  auto add = [&](int& fd, short events) {
+    if (fd != -1) {
+      fds[count] = pollfd{fd, events, 0};
+      owners[count++] = &fd;
+    }
+  };
+  add(out_, POLLIN);
+  add(err_, POLLIN);
+  if (wantWrite) {
+    add(in_, POLLOUT);
+  }
+  if (!count) {
+    return;
+  }
+  int ready = poll(fds, count, remainingMs());
+  if (ready < 0) {
+    if (errno == EINTR) {
+      return;
+    }
+    THROW("poll failed: %s", St::errorString().c_str());
+  }
+  if (ready == 0) {
+    kill();
+    THROW("%s timed out", name_.c_str());
+  }
+  for (nfds_t i = 0; i < count; ++i) {
+    if (!fds[i].revents || owners[i] == &in_) {
+      continue;
+    }
+    if (owners[i] == &out_) {
+      drain(out_, outBuf_, onOut_);
+    } else {
+      drain(err_, errBuf_, onErr_);
+    }
+  }
+}
+
+void Subprocess::write(std::string_view data) {
+  if (in_ == -1) {
+    THROW("stdin of %s is already closed", name_.c_str());
+  }
+  BlockSigpipe block;
+  while (!data.empty()) {
+    ssize_t sz = ::write(in_, data.data(), data.size());
+    if (sz >= 0) {
+      data.remove_prefix(sz);
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      // the child may be blocked writing to us, keep its output moving
+      pump(true);
+    } else if (errno != EINTR) {
+      THROW("Write to %s failed: %s", name_.c_str(),
+          St::errorString().c_str());
+    }
+  }
+}
+
+void Subprocess::setInput(std::string data) {
+  input_ = std::move(data);
+  inputOffset_ = 0;
+}
+
+void Subprocess::flushInput() {
+  if (in_ == -1) {
+    return;
+  }
+  BlockSigpipe block;
+  while (inputOffset_ < input_.size()) {
+    ssize_t sz = ::write(in_, input_.data() + inputOffset_,
+        input_.size() - inputOffset_);
+    if (sz >= 0) {
+      inputOffset_ += sz;
+    } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return;
+    } else if (errno != EINTR) {
+      // the child stopped reading, the rest of the input is dropped
+      break;
+    }
+  }
+  closeFd(in_);
+}
+
+bool Subprocess::reap(int flags) {
+  int wstatus;
+  pid_t r;
+  while ((r = waitpid(pid_, &wstatus, flags)) == -1 && errno == EINTR) {}
+  if (r == -1) {
+    THROW("Waitpid failed: %s", St::errorString().c_str());
+  }
+  if (r == 0) {
+    return false;
+  }
+  pid_ = -1;
+  if (WIFSIGNALED(wstatus)) {
+    status_ = 128 + WTERMSIG(wstatus);
+  } else {
+    status_ = WEXITSTATUS(wstatus);
+  }
+  return true;
+}
+
+size_t Subprocess::pollFds(struct pollfd* fds) {
+  size_t count = 0;
+  if (in_ != -1 && inputOffset_ < input_.size()) {
+    fds[count++] = pollfd{in_, POLLOUT, 0};
+  }
+  for (int fd : {out_, err_}) {
+    if (fd != -1) {
+      fds[count++] = pollfd{fd, POLLIN, 0};
+    }
+  }
+  if (pidfd_ != -1 && pid_ != -1) {
+    fds[count++] = pollfd{pidfd_, POLLIN, 0};
+  }
+  return count;
+}
+
+bool Subprocess::advance(const struct pollfd* fds, size_t count) {
+  for (size_t i = 0; i < count; ++i) {
+    if (!fds[i].revents) {
+      continue;
+    }
+    int fd = fds[i].fd;
+    if (fd == in_) {
+      flushInput();
+    } else if (fd == out_) {
+      drain(out_, outBuf_, onOut_);
+    } else if (fd == err_) {
+      drain(err_, errBuf_, onErr_);
+    } else if (fd == pidfd_) {
+      reap(WNOHANG);
+    }
+  }
+  if (pid_ != -1 && pidfd_ == -1) {
+    // no pidfd to poll, a grandchild may hold the pipes long after exit
+    reap(WNOHANG);
+  }
+  if (pid_ != -1) {
+    return false;
+  }
+  if (out_ != -1 && drain(out_, outBuf_, onOut_)) {
+    closeFd(out_);
+  }
+  if (err_ != -1 && drain(err_, errBuf_, onErr_)) {
+    closeFd(err_);
+  }
+  closeFd(in_);
+  return true;
+}
+
+void Subprocess::kill() {
+  if (pid_ == -1) {
+    return;
+  }
+  ::kill(pid_, SIGKILL);
+  try {
+    reap(0);
+  } catch (std::exception&) {
+    // waitpid failing (ECHILD) leaves nothing to wait for either
+    pid_ = -1;
+    status_ = 128 + SIGKILL;
+  }
+}
+
+int Subprocess::finish() {
+  if (inputOffset_ >= input_.size()) {
+    closeFd(in_);
+  }
+  flushInput();
+  struct pollfd fds[kMaxPollFds];
+  while (pid_ != -1) {
+    size_t count = pollFds(fds);
+    int ready = poll(fds, count, pollTimeoutMs());
+    if (ready < 0) {
+      if (errno != EINTR) {
+        THROW("poll failed: %s", St::errorString().c_str());
+      }
+      continue;
+    }
+    if (advance(fds, count)) {
+      break;
+    }
+    if (remainingMs() == 0) {
+      kill();
+      THROW("%s timed out", name_.c_str());
+    }
+  }
+  return status_;
+}
+
+void Subprocess::output(std::string& out, std::string& err) {
+  out = std::move(outBuf_);
+  err = std::move(errBuf_);
+  outBuf_.clear();
+  errBuf_.clear();
+}
+
+int Subprocess::finish(std::string& out, std::string& err) {
+  int status = finish();
+  output(out, err);
+  return status;
+}
@@ -1,12 +1,13 @@
 #pragma once
-#include <sstream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
 #include <functional>
-#include <unistd.h>
-#include <fcntl.h>
 #include <sys/types.h>
-#include <sys/wait.h>
-#include "exception.h"
-#include "string.h"
+#include <poll.h>
+#include "holper.h"
+#include "time.h"
 
 // TODO: find a better place for these
 class OnExit {
@@ -25,116 +26,78 @@ public:
 
 #define ON_EXIT const auto RANDOMNAME(onexit) = OnExitLine() << [&]()
 
+// Child process started with posix_spawn (vfork semantics, nothing runs in
+// the child between fork and exec) and tracked through a pidfd. stdout and
+// stderr are drained while stdin is written and while waiting for the
+// child, so a chatty child can't fill a pipe and stall both sides.
 class Subprocess {
+public:
+  using OutputFn = std::function<void(std::string_view)>;
+private:
   int in_ = -1, out_ = -1, err_ = -1;
-  pid_t pid_;
-  void readFromPipe(std::stringstream& ss, int fd) {
-    while(true) {
-      char buf[1024];
-      ssize_t sz = ::read(fd, buf, 1024);
-      if (sz < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
-        THROW("read failed: %s", St::errorString().c_str());
-      } else if (sz > 0) {
-        ss.write(buf, sz);
-      } else {
-        return;
-      }
-    }
-  }
+  pid_t pid_ = -1;
+  int pidfd_ = -1;
+  int status_ = -1;
+  std::string input_;
+  size_t inputOffset_ = 0;
+  std::string outBuf_, errBuf_;
+  OutputFn onOut_, onErr_;
+  std::optional<TimePoint> deadline_;
+  std::string name_;
+
+  void closeFd(int& fd);
+  // reads what is available, returns false once the pipe hit EOF
+  bool drain(int& fd, std::string& buf, const OutputFn& fn);
+  // polls the output pipes (and stdin when writable is wanted) once
+  void pump(bool wantWrite);
+  // writes what the pipe takes of setInput's data, closes stdin when done
+  void flushInput();
+  bool reap(int flags);
+  // remainingMs, capped at kReapIntervalMs without a pidfd
+  int pollTimeoutMs() const;
 public:
-  ~Subprocess() {
-    if (in_ != -1) {
-      close(in_);
-    }
-    if (out_ != -1) {
-      close(out_);
-    }
-    if (err_ != -1) {
-      close(err_);
-    }
-  }
-  // TODO: use context and get rid of throws
-  // TODO: support spawn&disown for things like spotify
-  Subprocess(const std::vector<std::string>& args) {
-    const char** ptrs = new const char*[args.size() + 1];
-    ON_EXIT { delete[] ptrs; };
-    for(size_t i=0; i<args.size(); ++i) {
-      ptrs[i] = args[i].c_str();
-    }
-    ptrs[args.size()] = NULL;
-    int stdin_pipe[2], stdout_pipe[2], stderr_pipe[2];
-    if (0 != pipe(stdin_pipe)) {
-      THROW("pipe failed: %s", St::errorString().c_str());
-    }
-    if (0 != pipe2(stdout_pipe, O_NONBLOCK)) {
-      close(stdin_pipe[0]);
-      close(stdin_pipe[1]);
-      THROW("pipe failed: %s", St::errorString().c_str());
-    }
-    if (0 != pipe2(stderr_pipe, O_NONBLOCK)) {
-      close(stdin_pipe[0]);
-      close(stdin_pipe[1]);
-      close(stdout_pipe[0]);
-      close(stdout_pipe[1]);
-      THROW("pipe failed: %s", St::errorString().c_str());
-    }
+  static const size_t kMaxPollFds = 4;
+  // Without a pidfd exit is only noticed by advance trying waitpid, it
+  // has to be called at least this often
+  static constexpr int kReapIntervalMs = 50;
+  Subprocess(const std::vector<std::string>& args);
+  Subprocess(const Subprocess&) = delete;
+  Subprocess& operator=(const Subprocess&) = delete;
+  ~Subprocess();
 
-    pid_ = fork();
-    if (pid_ < 0) {
-      close(stdin_pipe[0]);
-      close(stdin_pipe[1]);
-      close(stdout_pipe[0]);
-      close(stdout_pipe[1]);
-      close(stderr_pipe[0]);
-      close(stderr_pipe[1]);
-      THROW("fork failed: %s", St::errorString().c_str());
-    }
-    if (pid_ == 0) {
-      close(stdout_pipe[0]);
-      close(stderr_pipe[0]);
-      close(stdin_pipe[1]);
-      dup2(stdin_pipe[0], 0);
-      dup2(stdout_pipe[1], 1);
-      dup2(stderr_pipe[1], 2);
-      execv(ptrs[0], (char* const*)ptrs);
-      THROW("exec failed: %s", St::errorString().c_str());
-    }
-    close(stdin_pipe[0]);
-    close(stdout_pipe[1]);
-    close(stderr_pipe[1]);
-    in_ = stdin_pipe[1];
-    out_ = stdout_pipe[0];
-    err_ = stderr_pipe[0];
-  }
+  // Output goes to the callbacks as it arrives instead of being collected
+  // for finish. Either may be empty to keep collecting that stream.
+  void onOutput(OutputFn out, OutputFn err = {});
+  // The child is killed and finish/write throw once this runs out
+  void setTimeout(TimeDelta timeout);
 
-  void write(const std::string& data) {
-    size_t size = data.size();
-    size_t wsize = ::write(in_, data.c_str(), size);
-    if (size != wsize) {
-      THROW("Write attempt failed (%ld/%ld)", wsize, size);
-    }
-    fsync(in_);
-  }
+  // Written as the child reads it while finishing, stdin is closed after.
+  // Unlike write this never blocks, which the SubprocessManager needs.
+  void setInput(std::string data);
+  void write(std::string_view data);
+  // Closes stdin, drains output and reaps the child. Output still pending
+  // when it exits is read, but a daemonized grandchild holding the pipes
+  // open is not waited for. Returns the exit code, or 128 + signal number
+  // if it was killed by a signal.
+  int finish(std::string& out, std::string& err);
+  int finish();
 
-  void finish(std::string& out, std::string& err) {
-    close(in_);
-    in_ = -1;
-    std::stringstream oss, ess;
-    pid_t w;
-    int wstatus;
-    do {
-      w = waitpid(pid_, &wstatus, WUNTRACED | WCONTINUED);
-      if (w == -1) {
-        THROW("Waitpid failed: %s", St::errorString().c_str());
-      }
-    } while (!WIFEXITED(wstatus) && !WIFSIGNALED(wstatus));
-    readFromPipe(oss, out_);
-    readFromPipe(ess, err_);
-    close(out_);
-    out_ = -1;
-    close(err_);
-    err_ = -1;
-    out = oss.str();
-    err = ess.str();
-  }
+  // Non-blocking stepping for callers that poll many children at once.
+  // pollFds fills at most kMaxPollFds entries; advance handles their
+  // revents and returns true once the child has been reaped, at which
+  // point status() and output() are final.
+  size_t pollFds(struct pollfd* fds);
+  bool advance(const struct pollfd* fds, size_t count);
+  // Milliseconds until the timeout, -1 without one
+  int remainingMs() const;
+  // Whether exit can be waited for by polling, see pollFds
+  bool pollable() const { return pidfd_ != -1; }
+  // SIGKILLs and reaps the child. Never throws, the destructor and error
+  // paths rely on it.
+  void kill();
+  int status() const { return status_; }
+  void output(std::string& out, std::string& err);
+
+  pid_t pid() const { return pid_; }
+  const std::string& name() const { return name_; }
 };
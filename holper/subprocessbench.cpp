@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <vector>
+#include <string>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "subprocess.h"
+#include "time.h"
+
+// Compares the fork/waitpid path Subprocess used to take against the
+// posix_spawn one. The gap grows with the parent's resident memory since
+// fork copies page tables, so a ballast can be mapped to mimic the daemon.
+
+namespace {
+  const int kIterations = 500;
+
+  bool forkSpawn(const std::vector<std::string>& args) {
+    std::vector<char*> argv;
+    for (const auto& arg : args) {
+      argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid < 0) {
+      return false;
+    }
+    if (pid == 0) {
+      execv(argv[0], argv.data());
+      _exit(127);
+    }
+    int wstatus;
+    waitpid(pid, &wstatus, 0);
+    return WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0;
+  }
+
+  template <typename Fn>
+  void run(const char* name, Fn fn) {
+    TimePoint start;
+    size_t failures = 0;
+    for (int i = 0; i < kIterations; ++i) {
+      failures += fn() ? 0 : 1;
+    }
+    TimeDelta elapsed = TimePoint() - start;
+    printf("%-24s %s total, %.1fus per spawn (%lu failures)\n", name,
+        elapsed.str().c_str(), elapsed.value() * 1e6 / kIterations, failures);
+  }
+}
+
+int main(int argc, char** argv) {
+  size_t ballastMb = 0;
+  if (argc > 1 && 1 != sscanf(argv[1], "%lu", &ballastMb)) {
+    printf("Usage: %s [ballast MB]\n", argv[0]);
+    return 1;
+  }
+  std::vector<char> ballast(ballastMb << 20, 1);
+  std::vector<std::string> args = {"/usr/bin/true"};
+  run("fork", [&]() { return forkSpawn(args); });
+  run("posix_spawn", [&]() { return Subprocess(args).finish() == 0; });
+  return ballast.empty() ? 0 : ballast[ballast.size() - 1] - 1;
+}
@@ -0,0 +1,160 @@
+#include "subprocessmanager.h"
+#include "subprocess.h"
+#include "workpool.h"
+#include "context.h"
+#include "logger.h"
+#include "flightrecorder.h"
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+SubprocessManager::SubprocessManager(Context* context)
+    : ThreadBase("Subprocesses", context) {
+  int r = pthread_mutex_init(&mutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", StringUtils::errorString(r).c_str());
+  }
+  wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeFd_ == -1) {
+    THROW("eventfd failed: %s", StringUtils::errorString().c_str());
+  }
+  if (context_->metrics) {
+    running_ = context_->metrics->gauge("holper_subprocesses_running",
+        "Subprocesses waited on by the subprocess manager");
+  }
+}
+
+SubprocessManager::~SubprocessManager() {
+  close(wakeFd_);
+}
+
+void SubprocessManager::watch(Work* work,
+    std::shared_ptr<Subprocess> subprocess, Completion done) {
+  context_->logger->info("Request %d waits for %s (pid %d)",
+      work->requestId(), subprocess->name().c_str(), subprocess->pid());
+  work->detach([this, subprocess, done](std::unique_ptr<Work> owned) {
+    add(std::unique_ptr<Entry>(new Entry{std::move(owned), subprocess, done}));
+  });
+}
+
+void SubprocessManager::add(std::unique_ptr<Entry> entry) {
+  running_.add(1);
+  {
+    LockMutex lock(&mutex_);
+    incoming_.push_back(std::move(entry));
+  }
+  uint64_t one = 1;
+  if (::write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+    context_->logger->error("Waking subprocess manager failed: %s",
+        StringUtils::errorString().c_str());
+  }
+}
+
+void SubprocessManager::finish(Entry& entry, const char* error) {
+  FlightRecorder::RequestScope scope(entry.work->requestId());
+  Work* work = entry.work.get();
+  std::pair<rapidjson::Value, int> res;
+  if (error) {
+    res = std::make_pair(rapidjson::Value(error, work->allocator()), -1);
+  } else {
+    try {
+      std::string out, err;
+      entry.subprocess->output(out, err);
+      res = entry.done(work, entry.subprocess->status(), out, err);
+    } catch (std::exception& e) {
+      res = std::make_pair(rapidjson::Value(e.what(), work->allocator()), -1);
+    }
+  }
+  if (res.second != 0) {
+    context_->logger->info("Request %d failed: %s%s%s", work->requestId(),
+        Consts::TerminalColors::RED,
+        res.first.IsString() ? res.first.GetString() : "",
+        Consts::TerminalColors::DEFAULT);
+  }
+  running_.sub(1);
+  Work::complete(std::move(entry.work), std::move(res.first.Move()),
+      res.second);
+}
+
+int SubprocessManager::timeoutMs() const {
+  int timeout = -1;
+  for (const auto& entry : entries_) {
+    int remaining = entry->subprocess->remainingMs();
+    // without a pidfd advance has to try waitpid now and then
+    if (!entry->subprocess->pollable()) {
+      remaining = remaining == -1 ? Subprocess::kReapIntervalMs :
+        std::min(remaining, Subprocess::kReapIntervalMs);
+    }
+    if (remaining != -1 && (timeout == -1 || remaining < timeout)) {
+      timeout = remaining;
+    }
+  }
+  return timeout;
+}
+
+void SubprocessManager::run() {
+  std::vector<struct pollfd> fds;
+  std::vector<size_t> counts;
+  while (true) {
+    fds.clear();
+    counts.clear();
+    fds.push_back(pollfd{wakeFd_, POLLIN, 0});
+    for (auto& entry : entries_) {
+      size_t offset = fds.size();
+      fds.resize(offset + Subprocess::kMaxPollFds);
+      size_t count = entry->subprocess->pollFds(&fds[offset]);
+      fds.resize(offset + count);
+      counts.push_back(count);
+    }
+    int ready = poll(fds.data(), fds.size(), timeoutMs());
+    if (ready < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      THROW("poll failed: %s", StringUtils::errorString().c_str());
+    }
+    size_t offset = 1;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      Entry& entry = *entries_[i];
+      size_t count = counts[i];
+      const char* error = nullptr;
+      bool done = false;
+      try {
+        done = entry.subprocess->advance(&fds[offset], count);
+        if (!done && entry.subprocess->remainingMs() == 0) {
+          entry.subprocess->kill();
+          error = "timed out";
+          done = true;
+        }
+      } catch (std::exception& e) {
+        context_->logger->error("Subprocess %s of request %d: %s",
+            entry.subprocess->name().c_str(), entry.work->requestId(),
+            e.what());
+        entry.subprocess->kill();
+        error = "subprocess failed";
+        done = true;
+      }
+      offset += count;
+      if (done) {
+        std::string message;
+        if (error) {
+          message = entry.subprocess->name() + " " + error;
+        }
+        finish(entry, error ? message.c_str() : nullptr);
+        entries_[i].reset();
+      }
+    }
+    std::erase(entries_, nullptr);
+    if (fds[0].revents) {
+      uint64_t pending;
+      if (::read(wakeFd_, &pending, sizeof(pending)) < 0 && errno != EAGAIN) {
+        THROW("eventfd read failed: %s", StringUtils::errorString().c_str());
+      }
+      LockMutex lock(&mutex_);
+      for (auto& entry : incoming_) {
+        entries_.push_back(std::move(entry));
+      }
+      incoming_.clear();
+    }
+  }
+}
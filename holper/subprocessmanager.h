@@ -0,0 +1,45 @@
+#pragma once
+#include "thread.h"
+#include "metrics.h"
+#include "rapidjson/document.h"
+#include <memory>
+#include <vector>
+#include <functional>
+
+class Work;
+class Subprocess;
+
+// Waits on the pidfds and pipes of every subprocess started by an action
+// from a single thread, so that workers don't block while external tools
+// run. The owning request is finished once its child has been reaped.
+class SubprocessManager : public ThreadBase
+{
+public:
+  // Runs on the manager thread once the child exited, turns its status and
+  // output into the response. Throwing fails the request with the message.
+  typedef std::function<std::pair<rapidjson::Value, int>(Work* work,
+      int status, std::string& out, std::string& err)> Completion;
+private:
+  struct Entry {
+    std::unique_ptr<Work> work;
+    std::shared_ptr<Subprocess> subprocess;
+    Completion done;
+  };
+  pthread_mutex_t mutex_;
+  std::vector<std::unique_ptr<Entry>> incoming_;
+  std::vector<std::unique_ptr<Entry>> entries_;
+  int wakeFd_;
+  Metrics::Gauge running_;
+  void add(std::unique_ptr<Entry> entry);
+  void finish(Entry& entry, const char* error);
+  int timeoutMs() const;
+protected:
+  void run() override;
+public:
+  SubprocessManager(Context* context);
+  ~SubprocessManager();
+  // Called from an action's actOn. Detaches the work from the worker and
+  // finishes it through done when the subprocess is through.
+  void watch(Work* work, std::shared_ptr<Subprocess> subprocess,
+      Completion done);
+};
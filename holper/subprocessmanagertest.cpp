@@ -0,0 +1,90 @@
+#include <gtest/gtest.h>
+#include <condition_variable>
+#include <mutex>
+#include <map>
+#include "subprocessmanager.h"
+#include "subprocess.h"
+#include "workpool.h"
+#include "context.h"
+#include "logger.h"
+
+namespace {
+  struct Results {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::map<int, std::pair<std::string, int>> byRequest;
+    void add(std::unique_ptr<WorkResult> result) {
+      std::lock_guard<std::mutex> lock(mutex);
+      byRequest[result->work->requestId()] = std::make_pair(
+          result->result.IsString() ? result->result.GetString() : "",
+          result->code);
+      cond.notify_all();
+    }
+    bool wait(size_t count) {
+      std::unique_lock<std::mutex> lock(mutex);
+      return cond.wait_for(lock, std::chrono::seconds(10),
+          [&]() { return byRequest.size() >= count; });
+    }
+  };
+
+  // The manager thread has no way to stop, so it outlives the tests
+  SubprocessManager& manager() {
+    static SubprocessManager* manager = []() {
+      Context* context = new Context;
+      context->logger = std::make_shared<Logger>(Logger::MUSTFIX);
+      auto manager = new SubprocessManager(context);
+      manager->start();
+      return manager;
+    }();
+    return *manager;
+  }
+
+  // What a worker does with an action that hands its request off
+  void runDetached(SubprocessManager& manager, rapidjson::Document& doc,
+      Results& results, int id, std::vector<std::string> args,
+      std::string input, TimeDelta timeout) {
+    auto work = std::make_unique<Work>(id, nullptr, Parameters(),
+        doc.GetAllocator(), [&](std::unique_ptr<WorkResult> result) {
+          results.add(std::move(result));
+        });
+    auto sp = std::make_shared<Subprocess>(args);
+    sp->setInput(input);
+    sp->setTimeout(timeout);
+    manager.watch(work.get(), sp,
+        [&doc](Work*, int status, std::string& out, std::string&) {
+          return std::make_pair(
+              rapidjson::Value(out.c_str(), out.size(), doc.GetAllocator()),
+              status);
+        });
+    ASSERT_TRUE(Work::handOff(work));
+    ASSERT_FALSE(work);
+  }
+}
+
+TEST(SubprocessManagerTest, manyChildren) {
+  rapidjson::Document doc;
+  Results results;
+  const int kChildren = 32;
+  for (int i = 0; i < kChildren; ++i) {
+    runDetached(manager(), doc, results, i, {"/bin/sh", "-c",
+        "sleep 0.2; cat; exit " + std::to_string(i % 3)},
+        std::to_string(i), 5.0);
+  }
+  // all of them sleep concurrently on one thread
+  TimePoint start;
+  ASSERT_TRUE(results.wait(kChildren));
+  EXPECT_LT((TimePoint() - start).value(), 3);
+  for (int i = 0; i < kChildren; ++i) {
+    EXPECT_EQ(results.byRequest[i].first, std::to_string(i));
+    EXPECT_EQ(results.byRequest[i].second, i % 3);
+  }
+}
+
+TEST(SubprocessManagerTest, timeout) {
+  rapidjson::Document doc;
+  Results results;
+  runDetached(manager(), doc, results, 1, {"/bin/sleep", "10"}, "", 0.1);
+  ASSERT_TRUE(results.wait(1));
+  EXPECT_EQ(results.byRequest[1].second, -1);
+  EXPECT_EQ(results.byRequest[1].first, "/bin/sleep timed out");
+}
@@ -1,5 +1,6 @@
 #include <gtest/gtest.h>
 #include "subprocess.h"
+#include <sys/wait.h>
 
 TEST(SubprocessTest, output) {
   std::string str("test");
@@ -35,3 +36,100 @@ TEST(SubprocessTest, xsel) {
   EXPECT_EQ(out, str);
   EXPECT_TRUE(err.empty());
 }
+
+TEST(SubprocessTest, largeOutput) {
+  // more than a pipe buffer on both streams, used to hang in finish
+  Subprocess sp({"/bin/sh", "-c",
+      "head -c 1000000 /dev/zero; head -c 300000 /dev/zero >&2"});
+  std::string out, err;
+  EXPECT_EQ(sp.finish(out, err), 0);
+  EXPECT_EQ(out.size(), 1000000u);
+  EXPECT_EQ(err.size(), 300000u);
+}
+
+TEST(SubprocessTest, largeInput) {
+  std::string str(1 << 20, 'x');
+  Subprocess sp({"/usr/bin/cat"});
+  sp.write(str);
+  std::string out, err;
+  sp.finish(out, err);
+  EXPECT_EQ(out, str);
+}
+
+TEST(SubprocessTest, streaming) {
+  size_t lines = 0;
+  Subprocess sp({"/bin/sh", "-c", "seq 1 1000; echo oops >&2"});
+  sp.onOutput([&](std::string_view data) {
+    for (char ch : data) {
+      lines += ch == '\n';
+    }
+  });
+  std::string out, err;
+  sp.finish(out, err);
+  EXPECT_EQ(lines, 1000u);
+  EXPECT_TRUE(out.empty());
+  EXPECT_EQ(err, "oops\n");
+}
+
+TEST(SubprocessTest, exitCode) {
+  EXPECT_EQ(Subprocess({"/bin/sh", "-c", "exit 3"}).finish(), 3);
+  EXPECT_EQ(Subprocess({"/bin/sh", "-c", "kill -9 $$"}).finish(), 128 + 9);
+  EXPECT_ANY_THROW(Subprocess({"/nonexistent/binary"}));
+}
+
+TEST(SubprocessTest, timeout) {
+  Subprocess sp({"/bin/sh", "-c", "exec sleep 10"});
+  sp.setTimeout(0.1);
+  TimePoint start;
+  EXPECT_ANY_THROW(sp.finish());
+  EXPECT_LT((TimePoint() - start).value(), 5);
+}
+
+TEST(SubprocessTest, closedStdin) {
+  Subprocess sp({"/usr/bin/true"});
+  EXPECT_EQ(sp.finish(), 0);
+  EXPECT_ANY_THROW(sp.write("late"));
+  Subprocess sp2({"/bin/sh", "-c", "exec 0<&-; sleep 0.1"});
+  EXPECT_ANY_THROW(sp2.write(std::string(1 << 20, 'x')));
+}
+
+TEST(SubprocessTest, daemonizedChild) {
+  // the grandchild keeps stdout open, finish returns once the child exits
+  Subprocess sp({"/bin/sh", "-c", "echo parent; (sleep 5; echo late) &"});
+  TimePoint start;
+  std::string out, err;
+  EXPECT_EQ(sp.finish(out, err), 0);
+  EXPECT_EQ(out, "parent\n");
+  EXPECT_LT((TimePoint() - start).value(), 2);
+}
+
+TEST(SubprocessTest, stepping) {
+  std::string str(1 << 20, 'y');
+  Subprocess sp({"/usr/bin/cat"});
+  sp.setInput(str);
+  struct pollfd fds[Subprocess::kMaxPollFds];
+  size_t steps = 0;
+  while (true) {
+    size_t count = sp.pollFds(fds);
+    ASSERT_GT(count, 0u);
+    ASSERT_GT(poll(fds, count, 5000), 0);
+    ++steps;
+    if (sp.advance(fds, count)) {
+      break;
+    }
+  }
+  EXPECT_GT(steps, 1u);
+  EXPECT_EQ(sp.status(), 0);
+  std::string out, err;
+  sp.output(out, err);
+  EXPECT_EQ(out, str);
+}
+
+TEST(SubprocessTest, killReaped) {
+  // someone else reaped the child, kill must not throw from the destructor
+  Subprocess sp({"/usr/bin/true"});
+  int wstatus;
+  ASSERT_EQ(waitpid(sp.pid(), &wstatus, 0), sp.pid());
+  EXPECT_NO_THROW(sp.kill());
+  EXPECT_EQ(sp.pid(), -1);
+}
@@ -0,0 +1,238 @@
+#include "sysfs.h"
+#include "exception.h"
+#include "string.h"
+#include "context.h"
+#include "logger.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+namespace {
+  // Reads a small attribute, -1 if it can't be opened
+  ssize_t readAttribute(int fd, char* buf, size_t size) {
+    ssize_t len;
+    while ((len = pread(fd, buf, size - 1, 0)) < 0 && errno == EINTR) {}
+    if (len >= 0) {
+      buf[len] = '\0';
+    }
+    return len;
+  }
+
+  ssize_t readAttribute(const std::string& path, char* buf, size_t size) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+      return -1;
+    }
+    ssize_t len = readAttribute(fd, buf, size);
+    close(fd);
+    return len;
+  }
+
+  int backlightRank(const std::string& type) {
+    if (type == "firmware") {
+      return 0;
+    }
+    if (type == "platform") {
+      return 1;
+    }
+    return 2;
+  }
+}
+
+SysfsDevices::Device::~Device() {
+  if (fd_ != -1) {
+    close(fd_);
+  }
+}
+
+int SysfsDevices::Device::read() const {
+  char buf[32];
+  if (readAttribute(fd_, buf, sizeof(buf)) < 0) {
+    THROW("Could not read %s/brightness: %s", path_.c_str(),
+        St::errorString().c_str());
+  }
+  int value = atoi(buf);
+  value_.store(value, std::memory_order_relaxed);
+  return value;
+}
+
+int SysfsDevices::Device::value() const {
+  if (!watched_.load(std::memory_order_relaxed)) {
+    return read();
+  }
+  return value_.load(std::memory_order_relaxed);
+}
+
+void SysfsDevices::Device::write(int value) const {
+  if (!writable_) {
+    THROW("%s/brightness is not writable", path_.c_str());
+  }
+  char buf[16];
+  int len = snprintf(buf, sizeof(buf), "%d\n", std::clamp(value, 0, max_));
+  ssize_t r;
+  while ((r = pwrite(fd_, buf, len, 0)) < 0 && errno == EINTR) {}
+  if (r != len) {
+    THROW("Could not write %s/brightness: %s", path_.c_str(),
+        St::errorString().c_str());
+  }
+  // the driver may round, the watcher reads back what it settled on
+  value_.store(std::clamp(value, 0, max_), std::memory_order_relaxed);
+}
+
+SysfsDevices::SysfsDevices(const std::string& root) {
+  scan(root + "/backlight", BACKLIGHT);
+  scan(root + "/leds", LED);
+}
+
+void SysfsDevices::scan(const std::string& dir, Kind kind) {
+  DIR* d = opendir(dir.c_str());
+  if (!d) {
+    return;
+  }
+  std::vector<std::string> names;
+  while (struct dirent* entry = readdir(d)) {
+    if (entry->d_name[0] != '.') {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(d);
+  std::sort(names.begin(), names.end());
+  for (const auto& name : names) {
+    std::unique_ptr<Device> device(new Device);
+    device->name_ = name;
+    device->path_ = dir + "/" + name;
+    device->kind_ = kind;
+    char buf[32];
+    if (readAttribute(device->path_ + "/max_brightness", buf,
+          sizeof(buf)) <= 0) {
+      continue;
+    }
+    device->max_ = atoi(buf);
+    if (readAttribute(device->path_ + "/type", buf, sizeof(buf)) > 0) {
+      device->type_ = std::string(buf, strcspn(buf, "\n"));
+    }
+    std::string brightness = device->path_ + "/brightness";
+    device->fd_ = open(brightness.c_str(), O_RDWR | O_CLOEXEC);
+    device->writable_ = device->fd_ != -1;
+    if (device->fd_ == -1) {
+      // without a udev rule granting write access it can still be read
+      device->fd_ = open(brightness.c_str(), O_RDONLY | O_CLOEXEC);
+    }
+    if (device->fd_ == -1) {
+      continue;
+    }
+    device->read();
+    devices_.push_back(std::move(device));
+  }
+}
+
+const SysfsDevices::Device* SysfsDevices::find(std::string_view name) const {
+  for (const auto& device : devices_) {
+    if (device->name_ == name) {
+      return device.get();
+    }
+  }
+  return nullptr;
+}
+
+const SysfsDevices::Device* SysfsDevices::backlight() const {
+  const Device* best = nullptr;
+  for (const auto& device : devices_) {
+    if (device->kind_ == BACKLIGHT && (!best ||
+          backlightRank(device->type_) < backlightRank(best->type_))) {
+      best = device.get();
+    }
+  }
+  return best;
+}
+
+const SysfsDevices::Device* SysfsDevices::keyboardBacklight() const {
+  for (const auto& device : devices_) {
+    if (device->kind_ == LED &&
+        device->name_.find("kbd_backlight") != std::string::npos) {
+      return device.get();
+    }
+  }
+  return nullptr;
+}
+
+SysfsWatcher::SysfsWatcher(Context* context, SysfsDevices* devices)
+    : ThreadBase("SysfsWatcher", context), devices_(devices) {
+  inotify_ = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+  if (inotify_ < 0) {
+    THROW("inotify_init failed: %s", St::errorString().c_str());
+  }
+  for (const auto& device : devices_->devices()) {
+    bool watched = false;
+    for (const char* attribute : {"brightness", "actual_brightness",
+        "brightness_hw_changed"}) {
+      std::string path = device->path() + "/" + attribute;
+      int wd = inotify_add_watch(inotify_, path.c_str(),
+          IN_MODIFY | IN_CLOSE_WRITE);
+      if (wd >= 0) {
+        watches_[wd] = device.get();
+        watched = true;
+      }
+    }
+    if (!watched) {
+      context_->logger->warn("Cannot watch %s, it will be read every time",
+          device->path().c_str());
+    }
+    // read after the watch is in place so no change can slip in between
+    device->read();
+    device->watched_.store(watched, std::memory_order_relaxed);
+  }
+}
+
+SysfsWatcher::~SysfsWatcher() {
+  close(inotify_);
+}
+
+int SysfsWatcher::processEvents(int timeoutMs) {
+  struct pollfd fd = {inotify_, POLLIN, 0};
+  int ready = poll(&fd, 1, timeoutMs);
+  if (ready < 0 && errno != EINTR) {
+    THROW("poll failed: %s", St::errorString().c_str());
+  }
+  if (ready <= 0) {
+    return 0;
+  }
+  alignas(struct inotify_event) char buf[4096];
+  std::vector<const SysfsDevices::Device*> changed;
+  while (true) {
+    ssize_t len = ::read(inotify_, buf, sizeof(buf));
+    if (len <= 0) {
+      break;
+    }
+    for (char* ptr = buf; ptr < buf + len;) {
+      auto* event = (struct inotify_event*)ptr;
+      auto it = watches_.find(event->wd);
+      if (it != watches_.end() && std::find(changed.begin(), changed.end(),
+            it->second) == changed.end()) {
+        changed.push_back(it->second);
+      }
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  // a burst of events for one device costs a single read
+  for (const auto* device : changed) {
+    try {
+      device->read();
+    } catch (std::exception& e) {
+      context_->logger->error("%s", e.what());
+    }
+  }
+  return changed.size();
+}
+
+void SysfsWatcher::run() {
+  while (true) {
+    processEvents(-1);
+  }
+}
@@ -0,0 +1,80 @@
+#pragma once
+#include "thread.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Brightness controls found under /sys/class at startup. max_brightness is
+// read once and the brightness attribute stays open, so reading is one
+// pread and setting one pwrite.
+class SysfsDevices
+{
+public:
+  enum Kind {
+    BACKLIGHT,
+    LED,
+  };
+  class Device {
+    friend class SysfsDevices;
+    friend class SysfsWatcher;
+    std::string name_;
+    std::string path_;
+    std::string type_;
+    Kind kind_;
+    int max_ = 0;
+    int fd_ = -1;
+    bool writable_ = false;
+    mutable std::atomic<int> value_ = 0;
+    std::atomic<bool> watched_ = false;
+    Device() {}
+  public:
+    Device(const Device&) = delete;
+    ~Device();
+    const std::string& name() const { return name_; }
+    // Directory of the device, e.g. /sys/class/backlight/intel_backlight
+    const std::string& path() const { return path_; }
+    Kind kind() const { return kind_; }
+    int max() const { return max_; }
+    // Reads the attribute, also refreshing value()
+    int read() const;
+    // Served from memory while a SysfsWatcher keeps it current
+    int value() const;
+    // Clamped to [0, max]
+    void write(int value) const;
+  };
+private:
+  std::vector<std::unique_ptr<Device>> devices_;
+  void scan(const std::string& dir, Kind kind);
+public:
+  // root is /sys/class outside of tests
+  SysfsDevices(const std::string& root = "/sys/class");
+  const std::vector<std::unique_ptr<Device>>& devices() const {
+    return devices_;
+  }
+  const Device* find(std::string_view name) const;
+  // The panel backlight, firmware interfaces preferred over platform and
+  // raw ones as the kernel documentation suggests
+  const Device* backlight() const;
+  const Device* keyboardBacklight() const;
+};
+
+// Keeps SysfsDevices values current through inotify. Writes through the
+// VFS, by us or any other tool, show up as IN_MODIFY on brightness and
+// the backlight core notifies actual_brightness for hotkey changes.
+class SysfsWatcher : public ThreadBase
+{
+  SysfsDevices* devices_;
+  int inotify_;
+  std::map<int, const SysfsDevices::Device*> watches_;
+protected:
+  void run() override;
+public:
+  SysfsWatcher(Context* context, SysfsDevices* devices);
+  ~SysfsWatcher();
+  // Applies events arriving within timeoutMs, returns how many devices
+  // were refreshed. run() calls it forever.
+  int processEvents(int timeoutMs);
+};
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include <sys/stat.h>
+#include "sysfs.h"
+#include "filesystem.h"
+#include "context.h"
+#include "logger.h"
+
+namespace {
+  // A fake /sys/class with two backlights and two LEDs
+  class FakeSysfs {
+  public:
+    std::string root;
+    FakeSysfs() {
+      char dir[] = "/tmp/holpersysfsXXXXXX";
+      root = mkdtemp(dir);
+      mkdir((root + "/backlight").c_str(), 0755);
+      mkdir((root + "/leds").c_str(), 0755);
+      add("backlight/amdgpu_bl1", "raw", 255, 100);
+      add("backlight/acpi_video0", "firmware", 15, 7);
+      add("leds/input3::capslock", "", 1, 0);
+      add("leds/tpacpi::kbd_backlight", "", 2, 1);
+      mkdir((root + "/leds/broken").c_str(), 0755);
+    }
+    ~FakeSysfs() {
+      std::string cmd = "rm -rf " + root;
+      EXPECT_EQ(system(cmd.c_str()), 0);
+    }
+    void add(const std::string& name, const std::string& type, int max,
+        int value) {
+      std::string dir = root + "/" + name;
+      mkdir(dir.c_str(), 0755);
+      Fs::write(dir + "/max_brightness", std::to_string(max) + "\n");
+      Fs::write(dir + "/brightness", std::to_string(value) + "\n");
+      if (!type.empty()) {
+        Fs::write(dir + "/type", type + "\n");
+      }
+    }
+  };
+}
+
+TEST(SysfsDevicesTest, scan) {
+  FakeSysfs fake;
+  SysfsDevices sysfs(fake.root);
+  ASSERT_EQ(sysfs.devices().size(), 4u);
+  ASSERT_TRUE(sysfs.backlight());
+  EXPECT_EQ(sysfs.backlight()->name(), "acpi_video0");
+  EXPECT_EQ(sysfs.backlight()->max(), 15);
+  EXPECT_EQ(sysfs.backlight()->read(), 7);
+  ASSERT_TRUE(sysfs.keyboardBacklight());
+  EXPECT_EQ(sysfs.keyboardBacklight()->name(), "tpacpi::kbd_backlight");
+  EXPECT_EQ(sysfs.find("amdgpu_bl1")->kind(), SysfsDevices::BACKLIGHT);
+  EXPECT_EQ(sysfs.find("input3::capslock")->kind(), SysfsDevices::LED);
+  EXPECT_FALSE(sysfs.find("broken"));
+  EXPECT_TRUE(SysfsDevices(fake.root + "/missing").devices().empty());
+}
+
+TEST(SysfsDevicesTest, write) {
+  FakeSysfs fake;
+  SysfsDevices sysfs(fake.root);
+  const auto* device = sysfs.find("amdgpu_bl1");
+  device->write(42);
+  EXPECT_EQ(device->read(), 42);
+  device->write(1000);
+  EXPECT_EQ(device->read(), 255);
+  device->write(-5);
+  EXPECT_EQ(device->read(), 0);
+  chmod((fake.root + "/leds/input3::capslock/brightness").c_str(), 0444);
+  SysfsDevices readOnly(fake.root);
+  if (geteuid() != 0) {
+    EXPECT_THROW(readOnly.find("input3::capslock")->write(1), std::exception);
+  }
+  EXPECT_EQ(readOnly.find("input3::capslock")->read(), 0);
+}
+
+TEST(SysfsWatcherTest, externalChanges) {
+  FakeSysfs fake;
+  SysfsDevices sysfs(fake.root);
+  Context context;
+  context.logger = std::make_shared<Logger>(Logger::MUSTFIX);
+  SysfsWatcher watcher(&context, &sysfs);
+  const auto* device = sysfs.find("amdgpu_bl1");
+  EXPECT_EQ(device->value(), 100);
+  // another tool changes it
+  Fs::write(fake.root + "/backlight/amdgpu_bl1/brightness", "33\n");
+  EXPECT_EQ(watcher.processEvents(1000), 1);
+  EXPECT_EQ(device->value(), 33);
+  // our own writes are visible right away and read back after the event
+  device->write(12);
+  EXPECT_EQ(device->value(), 12);
+  EXPECT_EQ(watcher.processEvents(1000), 1);
+  EXPECT_EQ(device->value(), 12);
+  EXPECT_EQ(watcher.processEvents(0), 0);
+}
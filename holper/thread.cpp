@@ -2,6 +2,8 @@
 #include "holper.h"
 #include "logger.h"
 #include "context.h"
+#include "filesystem.h"
+#include <unistd.h>
 
 void* ThreadBase::startThread(void* thread_ptr) {
   ThreadBase* thread = reinterpret_cast<ThreadBase*>(thread_ptr);
@@ -10,3 +12,13 @@ void* ThreadBase::startThread(void* thread_ptr) {
   thread->run();
   return nullptr;
 }
+
+std::string ThreadBase::threadName(pid_t tid) {
+  char name[16] = {};
+  std::string path = St::fmt("/proc/self/task/%d/comm", tid);
+  if (access(path.c_str(), R_OK) != 0 ||
+      Fs::parse(path, "%15[^\n]", name) != 1) {
+    return St::fmt("thread %d", tid);
+  }
+  return name;
+}
@@ -1,5 +1,7 @@
 #pragma once
 #include <pthread.h>
+#include <sys/types.h>
+#include <cerrno>
 #include <semaphore.h>
 #include <queue>
 #include <string>
@@ -41,6 +43,8 @@ public:
     }
   }
   static void* startThread(void* thread_ptr);
+  // Name the kernel has for a thread of this process, as set by start()
+  static std::string threadName(pid_t tid);
 };
 
 template <typename T>
@@ -78,9 +82,11 @@ protected:
   void run() final override {
     init();
     while(true) {
-      int r = sem_wait(&messagesSemaphore_);
+      int r;
+      // signals, e.g. from the sampling profiler, can interrupt the wait
+      while ((r = sem_wait(&messagesSemaphore_)) != 0 && errno == EINTR) {}
       if (r != 0) {
-        THROW("Semaphore wait failed: %s", StringUtils::errorString(r));
+        THROW("Semaphore wait failed: %s", StringUtils::errorString().c_str());
       }
       std::unique_ptr<T> msg;
       {
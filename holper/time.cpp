@@ -1,4 +1,10 @@
 #include "time.h"
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <sstream>
+#include <utility>
+#include <vector>
 
 namespace {
   const std::vector<std::pair<int, std::string>> kTimeUnits = {
@@ -8,28 +14,31 @@ namespace {
     {60, "minute"},
     {1, "second"},
   };
-  std::string secondsToString(double val) {
-    std::stringstream ss;
-    if (val < 0.001) {
-      ss <<  val*1000000 << "ns";
-    } else if (val < 1.0) {
-      ss <<  val*1000 << "ms";
+  std::string nanosToString(int64_t ns) {
+    char buf[32];
+    int64_t abs = ns < 0 ? -ns : ns;
+    if (abs < 1000) {
+      snprintf(buf, sizeof(buf), "%ldns", (long)ns);
+    } else if (abs < 1000000) {
+      snprintf(buf, sizeof(buf), "%gus", ns / 1e3);
+    } else if (abs < 1000000000) {
+      snprintf(buf, sizeof(buf), "%gms", ns / 1e6);
     } else {
-      ss << val << "s";
+      snprintf(buf, sizeof(buf), "%gs", ns / 1e9);
     }
-    return ss.str();
+    return buf;
   }
 }
 
 std::string TimeDelta::str() const {
-  return secondsToString(value_);
+  return nanosToString(ns_);
 }
 
 template<>
 std::string TimePoint::str() const {
   std::stringstream ss;
-  double diff = (TimePoint() - *this).value();
-  int secs = (int)diff;
+  int64_t diff = (TimePoint() - *this).ns();
+  int64_t secs = diff / 1000000000;
   for (const auto& timeUnit : kTimeUnits) {
     if (secs >= timeUnit.first) {
       ss << (secs / timeUnit.first) << " " << timeUnit.second;
@@ -40,14 +49,36 @@ std::string TimePoint::str() const {
       secs %= timeUnit.first;
     }
   }
-  ss << secondsToString((diff - (int)diff));
+  ss << nanosToString(diff % 1000000000);
   return ss.str();
 }
+
 template <>
 std::string RealTimePoint::str() const {
   char buf[32];
-  struct tm tm;
-  localtime_r(&time_.tv_sec, &tm);
-  strftime(buf, 64, "%Y-%m-%d %H:%M:%S", &tm);
-  return std::string(buf);
+  size_t len = TimeFormat::localTime(ns_ / 1000000000, buf, sizeof(buf));
+  return std::string(buf, len);
+}
+
+size_t TimeFormat::localTime(time_t seconds, char* out, size_t size) {
+  struct Cache {
+    time_t seconds = -1;
+    char text[32];
+    size_t length = 0;
+  };
+  thread_local Cache cache;
+  if (cache.seconds != seconds) {
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+    cache.length = strftime(cache.text, sizeof(cache.text),
+        "%Y-%m-%d %H:%M:%S", &tm);
+    cache.seconds = seconds;
+  }
+  if (size == 0) {
+    return 0;
+  }
+  size_t len = std::min(cache.length, size - 1);
+  memcpy(out, cache.text, len);
+  out[len] = '\0';
+  return len;
 }
@@ -1,76 +1,108 @@
 #pragma once
 #include <time.h>
+#include <cstdint>
 #include <string>
-#include <vector>
-#include <sstream>
 
+// Durations and clock readings are whole nanoseconds. Doubles are only
+// used at the edges: constructing from and reporting seconds.
 class TimeDelta {
 private:
-  double value_;
+  int64_t ns_;
+  struct Ns {};
+  constexpr TimeDelta(int64_t ns, Ns) : ns_(ns) {}
 public:
-  TimeDelta(double value) : value_(value) {}
-  double value() const { return value_; }
+  constexpr TimeDelta() : ns_(0) {}
+  // Seconds
+  constexpr TimeDelta(double value)
+    : ns_((int64_t)(value * 1e9 + (value < 0 ? -0.5 : 0.5))) {}
+  static constexpr TimeDelta fromNs(int64_t ns) {
+    return TimeDelta(ns, Ns());
+  }
+  constexpr int64_t ns() const { return ns_; }
+  // Seconds
+  constexpr double value() const { return ns_ / 1e9; }
   std::string str() const;
-  TimeDelta operator-() const {
-    return TimeDelta(-value_);
+  constexpr TimeDelta operator-() const {
+    return fromNs(-ns_);
+  }
+  constexpr TimeDelta operator+(TimeDelta rhs) const {
+    return fromNs(ns_ + rhs.ns_);
+  }
+  constexpr TimeDelta operator-(TimeDelta rhs) const {
+    return fromNs(ns_ - rhs.ns_);
+  }
+  constexpr bool operator<(TimeDelta rhs) const {
+    return ns_ < rhs.ns_;
+  }
+  constexpr bool operator==(TimeDelta rhs) const {
+    return ns_ == rhs.ns_;
   }
 };
 
-template <clock_t Clock>
+template <clockid_t Clock>
 class TimePointBase {
 protected:
-  struct timespec time_;
+  int64_t ns_;
+  struct Ns {};
+  constexpr TimePointBase(int64_t ns, Ns) : ns_(ns) {}
 public:
   TimePointBase() {
-    clock_gettime(Clock, &time_);
+    struct timespec ts;
+    clock_gettime(Clock, &ts);
+    ns_ = ts.tv_sec * 1000000000ll + ts.tv_nsec;
+  }
+  constexpr TimePointBase(struct timespec ts)
+    : ns_(ts.tv_sec * 1000000000ll + ts.tv_nsec) {}
+  static constexpr TimePointBase<Clock> fromNs(int64_t ns) {
+    return TimePointBase<Clock>(ns, Ns());
   }
-  TimePointBase(const TimePointBase<Clock>& rhs) {
-    time_ = rhs.time_;
+  constexpr int64_t ns() const {
+    return ns_;
   }
-  TimePointBase(struct timespec ts) {
-    time_ = ts;
+  // Seconds since the clock's epoch
+  constexpr double value() const {
+    return ns_ / 1e9;
   }
-  double value() const {
-    return time_.tv_sec + 0.000000001 * time_.tv_nsec;
+  constexpr struct timespec timespec() const {
+    struct timespec ts = {};
+    ts.tv_sec = ns_ / 1000000000;
+    ts.tv_nsec = ns_ % 1000000000;
+    if (ts.tv_nsec < 0) {
+      ts.tv_nsec += 1000000000;
+      ts.tv_sec -= 1;
+    }
+    return ts;
   }
-  struct timespec timespec() {
-    return time_;
+  constexpr TimeDelta operator-(const TimePointBase<Clock>& rhs) const {
+    return TimeDelta::fromNs(ns_ - rhs.ns_);
   }
-  TimeDelta operator-(const TimePointBase<Clock>& rhs) const {
-    return TimeDelta(value() - rhs.value());
+  constexpr TimePointBase<Clock> operator+(TimeDelta rhs) const {
+    return fromNs(ns_ + rhs.ns());
   }
-  TimePointBase<Clock> operator=(const TimePointBase<Clock> rhs) {
-    time_ = rhs.time_;
-    return *this;
+  constexpr TimePointBase<Clock> operator-(TimeDelta rhs) const {
+    return fromNs(ns_ - rhs.ns());
   }
-  TimePointBase<Clock> operator+=(const TimeDelta rhs) {
-    (*this) = (*this) + rhs;
+  TimePointBase<Clock>& operator+=(TimeDelta rhs) {
+    ns_ += rhs.ns();
     return *this;
   }
-  TimePointBase<Clock> operator+(const TimeDelta rhs) const {
-    struct timespec ts;
-    ts.tv_sec = time_.tv_sec + (long)rhs.value();
-    ts.tv_nsec = time_.tv_nsec + (rhs.value() - (long)rhs.value()) * 1000000000.0;
-    if (ts.tv_nsec >= 1000000000) {
-      ts.tv_nsec -= 1000000000;
-      ts.tv_sec += 1;
-    } else if (ts.tv_nsec < 0) {
-      ts.tv_nsec += 1000000000;
-      ts.tv_sec -= 1;
-    }
-    return TimePointBase<Clock>(ts);
-  }
-  TimePointBase<Clock> operator-(double rhs) const {
-    return *this + (-rhs);
+  constexpr bool operator<(const TimePointBase<Clock>& rhs) const {
+    return ns_ < rhs.ns_;
   }
-  bool operator<(const TimePointBase<Clock>& rhs) const {
-    if (time_.tv_sec == rhs.time_.tv_sec) {
-      return time_.tv_nsec < rhs.time_.tv_nsec;
-    }
-    return time_.tv_sec < rhs.time_.tv_sec;
+  constexpr bool operator==(const TimePointBase<Clock>& rhs) const {
+    return ns_ == rhs.ns_;
   }
   std::string str() const;
 };
 
 typedef TimePointBase<CLOCK_MONOTONIC> TimePoint;
+// Only as precise as the scheduler tick, for frequent checks of timeouts
+typedef TimePointBase<CLOCK_MONOTONIC_COARSE> CoarseTimePoint;
 typedef TimePointBase<CLOCK_REALTIME> RealTimePoint;
+
+namespace TimeFormat {
+  // "YYYY-mm-dd HH:MM:SS" in local time, rendered at most once per second
+  // per thread. Writes up to size - 1 chars and a terminator, returns the
+  // length written.
+  size_t localTime(time_t seconds, char* out, size_t size);
+}
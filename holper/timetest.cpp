@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <cstring>
+#include "time.h"
+
+TEST(TimeTest, arithmetic) {
+  TimePoint start = TimePoint::fromNs(1500000000);
+  TimePoint later = start + 0.25;
+  EXPECT_EQ((later - start).ns(), 250000000);
+  EXPECT_EQ((start - later).ns(), -250000000);
+  EXPECT_TRUE(start < later);
+  later += TimeDelta::fromNs(1);
+  EXPECT_EQ(later.ns(), 1750000001);
+  EXPECT_EQ((later - TimeDelta(1.75)).ns(), 1);
+  struct timespec ts = later.timespec();
+  EXPECT_EQ(ts.tv_sec, 1);
+  EXPECT_EQ(ts.tv_nsec, 750000001);
+  EXPECT_EQ(TimePoint(ts), later);
+  EXPECT_EQ(TimeDelta(0.1).ns(), 100000000);
+  EXPECT_EQ(TimeDelta(-0.1).ns(), -100000000);
+  EXPECT_DOUBLE_EQ(TimeDelta::fromNs(1500).value(), 1.5e-6);
+}
+
+TEST(TimeTest, str) {
+  EXPECT_EQ(TimeDelta::fromNs(999).str(), "999ns");
+  EXPECT_EQ(TimeDelta::fromNs(1500).str(), "1.5us");
+  EXPECT_EQ(TimeDelta(0.25).str(), "250ms");
+  EXPECT_EQ(TimeDelta(2.5).str(), "2.5s");
+  std::string ago = (TimePoint() - 125.0).str();
+  EXPECT_EQ(ago.rfind("2 minutes 5 seconds ", 0), 0) << ago;
+}
+
+TEST(TimeTest, localTime) {
+  RealTimePoint now;
+  std::string st = now.str();
+  EXPECT_EQ(st.size(), strlen("2024-01-01 00:00:00"));
+  char buf[8];
+  EXPECT_EQ(TimeFormat::localTime(now.timespec().tv_sec, buf, sizeof(buf)),
+      sizeof(buf) - 1);
+  EXPECT_EQ(std::string(buf), st.substr(0, sizeof(buf) - 1));
+  // same second, served from the cache
+  EXPECT_EQ(RealTimePoint::fromNs(now.ns() - now.ns() % 1000000000).str(), st);
+}
@@ -0,0 +1,171 @@
+#include "trace.h"
+#include "thread.h"
+#include "string.h"
+#include <map>
+#include <unistd.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+
+TraceRecorder::TraceRecorder() {
+  int r = pthread_mutex_init(&mutex_, NULL);
+  if (r != 0) {
+    THROW("Mutex init failed: %s", StringUtils::errorString(r).c_str());
+  }
+}
+
+void TraceRecorder::start(size_t limit) {
+  LockMutex lock(&mutex_);
+  if (active_) {
+    THROW("A trace is already being captured");
+  }
+  traces_.clear();
+  unsaved_.reset();
+  traces_.reserve(std::min(limit, (size_t)1024));
+  limit_ = limit;
+  dropped_ = 0;
+  active_ = true;
+}
+
+void TraceRecorder::record(int requestId, const std::string& command,
+    const Profiler& profiler) {
+  LockMutex lock(&mutex_);
+  if (!active_) {
+    return;
+  }
+  if (traces_.size() >= limit_) {
+    dropped_ += 1;
+    return;
+  }
+  traces_.push_back(Trace{requestId, command, profiler});
+}
+
+TraceRecorder::Result TraceRecorder::stop() {
+  std::vector<Trace> traces;
+  size_t dropped;
+  {
+    LockMutex lock(&mutex_);
+    if (!active_) {
+      if (unsaved_) {
+        Result result = std::move(*unsaved_);
+        unsaved_.reset();
+        return result;
+      }
+      THROW("No trace is being captured");
+    }
+    active_ = false;
+    traces.swap(traces_);
+    dropped = dropped_;
+  }
+  return Result{traces.size(), dropped, render(traces)};
+}
+
+void TraceRecorder::keep(Result result) {
+  LockMutex lock(&mutex_);
+  unsaved_ = std::move(result);
+}
+
+namespace {
+double micros(const TimePoint& time) {
+  return time.ns() / 1e3;
+}
+}
+
+std::string TraceRecorder::render(const std::vector<Trace>& traces) {
+  typedef rapidjson::Writer<rapidjson::StringBuffer> Writer;
+  rapidjson::StringBuffer buf;
+  Writer writer(buf);
+  int pid = getpid();
+  auto common = [&](const char* name, const char* phase, pid_t tid) {
+    writer.Key("name");
+    writer.String(name);
+    writer.Key("ph");
+    writer.String(phase);
+    writer.Key("pid");
+    writer.Int(pid);
+    writer.Key("tid");
+    writer.Int(tid);
+  };
+  auto requestArgs = [&](int requestId) {
+    writer.Key("args");
+    writer.StartObject();
+    writer.Key("request");
+    writer.Int(requestId);
+    writer.EndObject();
+  };
+  std::map<pid_t, std::string> threads;
+  std::string name;
+  writer.StartObject();
+  writer.Key("displayTimeUnit");
+  writer.String("ns");
+  writer.Key("traceEvents");
+  writer.StartArray();
+  for (const auto& trace : traces) {
+    // Whole request as an async span, a marker for every event and a slice
+    // named after the event that ends it when both ends ran on one thread
+    name = St::fmt("Request %d: %s", trace.requestId, trace.command.c_str());
+    TimePoint last = trace.profiler.start();
+    pid_t lastTid = 0;
+    std::string eventName;
+    trace.profiler.forEach([&](const TimePoint& time, pid_t tid,
+          const char* prefix, const char* event) {
+      threads.emplace(tid, "");
+      eventName = std::string(prefix) + event;
+      if (lastTid == 0) {
+        writer.StartObject();
+        common(name.c_str(), "b", tid);
+        writer.Key("cat");
+        writer.String("request");
+        writer.Key("id");
+        writer.Int(trace.requestId);
+        writer.Key("ts");
+        writer.Double(micros(trace.profiler.start()));
+        requestArgs(trace.requestId);
+        writer.EndObject();
+      } else if (lastTid == tid) {
+        writer.StartObject();
+        common(eventName.c_str(), "X", tid);
+        writer.Key("ts");
+        writer.Double(micros(last));
+        writer.Key("dur");
+        writer.Double(micros(time) - micros(last));
+        requestArgs(trace.requestId);
+        writer.EndObject();
+      }
+      writer.StartObject();
+      common(eventName.c_str(), "i", tid);
+      writer.Key("s");
+      writer.String("t");
+      writer.Key("ts");
+      writer.Double(micros(time));
+      requestArgs(trace.requestId);
+      writer.EndObject();
+      last = time;
+      lastTid = tid;
+    });
+    if (lastTid != 0) {
+      writer.StartObject();
+      common(name.c_str(), "e", lastTid);
+      writer.Key("cat");
+      writer.String("request");
+      writer.Key("id");
+      writer.Int(trace.requestId);
+      writer.Key("ts");
+      writer.Double(micros(last));
+      writer.EndObject();
+    }
+  }
+  for (auto& [tid, threadname] : threads) {
+    threadname = ThreadBase::threadName(tid);
+    writer.StartObject();
+    common("thread_name", "M", tid);
+    writer.Key("args");
+    writer.StartObject();
+    writer.Key("name");
+    writer.String(threadname.c_str(), threadname.size());
+    writer.EndObject();
+    writer.EndObject();
+  }
+  writer.EndArray();
+  writer.EndObject();
+  return std::string(buf.GetString(), buf.GetSize());
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <optional>
+#include <string>
+#include <vector>
+#include <pthread.h>
+#include "profiler.h"
+
+// Keeps the profiles of requests finished between start() and stop() and
+// renders them as Chrome trace event JSON, which chrome://tracing and
+// Perfetto open as a per thread timeline.
+class TraceRecorder
+{
+  struct Trace {
+    int requestId;
+    std::string command;
+    Profiler profiler;
+  };
+  std::atomic<bool> active_ = false;
+  pthread_mutex_t mutex_;
+  std::vector<Trace> traces_;
+  size_t limit_ = 0;
+  size_t dropped_ = 0;
+public:
+  struct Result {
+    size_t requests;
+    size_t dropped;
+    std::string json;
+  };
+private:
+  std::optional<Result> unsaved_;
+public:
+  TraceRecorder();
+  bool active() const {
+    return active_.load(std::memory_order_relaxed);
+  }
+  // Keeps at most limit requests, later ones are counted as dropped
+  void start(size_t limit);
+  void record(int requestId, const std::string& command,
+      const Profiler& profiler);
+  // Without a capture running, returns the result handed to keep()
+  Result stop();
+  // Holds on to a result that could not be saved until the next stop()
+  // or start()
+  void keep(Result result);
+  static std::string render(const std::vector<Trace>& traces);
+};
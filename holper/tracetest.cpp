@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <rapidjson/document.h>
+#include "trace.h"
+
+TEST(TraceRecorderTest, render) {
+  TraceRecorder recorder;
+  EXPECT_FALSE(recorder.active());
+  EXPECT_THROW(recorder.stop(), std::exception);
+  recorder.start(1);
+  EXPECT_TRUE(recorder.active());
+  EXPECT_THROW(recorder.start(1), std::exception);
+
+  TimePoint start;
+  Profiler profiler(start);
+  profiler.event(Profiler::RECEIVED_BY_RESOLVER, start + 0.001);
+  profiler.event(Profiler::PAYLOAD_PARSED, start + 0.002);
+  Profiler work(start);
+  work.event(Profiler::RECEIVED_BY_WORKER, start + 0.003);
+  profiler.join(work, "Work.");
+  recorder.record(7, "info stats", profiler);
+  recorder.record(8, "info stats", profiler);
+  auto result = recorder.stop();
+  EXPECT_FALSE(recorder.active());
+  EXPECT_EQ(result.requests, 1);
+  EXPECT_EQ(result.dropped, 1);
+
+  rapidjson::Document doc;
+  doc.Parse(result.json.c_str());
+  ASSERT_TRUE(doc.IsObject());
+  std::map<std::string, int> phases;
+  std::vector<std::string> slices;
+  for (auto& event : doc["traceEvents"].GetArray()) {
+    phases[event["ph"].GetString()] += 1;
+    if (std::string(event["ph"].GetString()) == "X") {
+      slices.push_back(event["name"].GetString());
+      EXPECT_NEAR(event["dur"].GetDouble(), 1000, 1);
+    }
+  }
+  EXPECT_EQ(phases["b"], 1);
+  EXPECT_EQ(phases["e"], 1);
+  EXPECT_EQ(phases["i"], 3);
+  // all events were recorded on this thread
+  ASSERT_EQ(slices.size(), 2);
+  EXPECT_EQ(slices[0], "Payload json parsed");
+  EXPECT_EQ(slices[1], "Work.Received by WorkPoolWorker");
+  EXPECT_EQ(phases["M"], 1);
+}
+
+TEST(TraceRecorderTest, keep) {
+  TraceRecorder recorder;
+  recorder.start(10);
+  recorder.record(1, "info stats", Profiler());
+  auto result = recorder.stop();
+  EXPECT_EQ(result.requests, 1);
+  // writing it failed, the next stop gets it back
+  recorder.keep(std::move(result));
+  auto again = recorder.stop();
+  EXPECT_EQ(again.requests, 1);
+  EXPECT_FALSE(again.json.empty());
+  EXPECT_THROW(recorder.stop(), std::exception);
+  recorder.keep(std::move(again));
+  recorder.start(10);
+  recorder.stop();
+  EXPECT_THROW(recorder.stop(), std::exception);
+}
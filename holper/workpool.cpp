@@ -1,10 +1,12 @@
 #include "workpool.h"
 #include "holper.h"
 #include "logger.h"
+#include "flightrecorder.h"
 #include "string.h"
 #include "context.h"
 #include "commandmanager.h"
 #include "command.h"
+#include "metrics.h"
 #include <boost/property_tree/ptree.hpp>
 #include <boost/property_tree/json_parser.hpp>
 
@@ -13,7 +15,8 @@ WorkPoolWorker::WorkPoolWorker(int id, Context* context, WorkPool* workPool)
       workPool_(workPool), id_(id) {}
 
 std::pair<rapidjson::Value, int> WorkPoolWorker::runSingle(Work* work) {
-  work->profiler().event("Received by WorkPoolWorker");
+  FlightRecorder::RequestScope scope(work->requestId());
+  work->profiler().event(Profiler::RECEIVED_BY_WORKER);
   context_->logger->info("Will process request %d", work->requestId());
   auto action = work->command()->action();
   auto form_retval = [&] (const std::string& val, int code) {
@@ -22,14 +25,17 @@ std::pair<rapidjson::Value, int> WorkPoolWorker::runSingle(Work* work) {
         code);
   };
   if (action == nullptr) {
-    return form_retval(work->command()->help(), -1);
+    // help outlives the request, no need to copy it into the response
+    const std::string& help = work->command()->help();
+    return std::make_pair(
+        rapidjson::Value(rapidjson::StringRef(help.c_str(), help.size())),
+        -1);
   }
   rapidjson::Value res;
   try {
-    ParamSpec ps(work->parameters(), true);
-    action->spec(ps);
-    work->profiler().event("Validated with parameter spec");
-    if (auto reason = ps.failReason()) {
+    auto reason = work->command()->validator()->failReason(work->parameters());
+    work->profiler().event(Profiler::VALIDATED);
+    if (reason) {
       context_->logger->info(
         "Request %d would fail: %s%s%s",
         work->requestId(),
@@ -40,6 +46,7 @@ std::pair<rapidjson::Value, int> WorkPoolWorker::runSingle(Work* work) {
     }
     return std::make_pair(action->actOn(work), 0);
   } catch (std::exception& e) {
+    work->detach_ = nullptr;
     context_->logger->info(
       "Request %d failed: %s%s%s",
       work->requestId(),
@@ -53,41 +60,72 @@ std::pair<rapidjson::Value, int> WorkPoolWorker::runSingle(Work* work) {
 void WorkPoolWorker::run() {
   while (true) {
     auto work = workPool_->getWork();
+    workPool_->busyWorkers_.add(1);
     auto res = runSingle(work.get());
-    work->finish_(std::make_unique<WorkResult>(
-        std::move(work), std::move(res.first.Move()), res.second));
+    workPool_->busyWorkers_.sub(1);
+    if (Work::handOff(work)) {
+      continue;
+    }
+    Work::complete(std::move(work), std::move(res.first.Move()), res.second);
  }
 }
 
+bool Work::handOff(std::unique_ptr<Work>& work) {
+  if (!work->detach_) {
+    return false;
+  }
+  auto detach = std::move(work->detach_);
+  work->detach_ = nullptr;
+  detach(std::move(work));
+  return true;
+}
+
+void Work::complete(std::unique_ptr<Work> work, rapidjson::Value&& result,
+    int code) {
+  auto finish = work->finish_;
+  finish(std::make_unique<WorkResult>(std::move(work), std::move(result),
+      code));
+}
+
 void WorkPool::handleMessage(std::unique_ptr<Work> msg) {
-  msg->profiler().event("Received by WorkPool");
+  msg->profiler().event(Profiler::RECEIVED_BY_WORKPOOL);
   context_->logger->info("Received work for request %d", msg->requestId());
   auto work = std::make_unique<WorkInternal>(std::move(msg));
   {
     LockMutex lock(&workMutex_);
     works_.push(std::move(work));
   }
+  queueDepth_.add(1);
   sem_post(&workSemaphore_);
 }
 
 std::unique_ptr<Work> WorkPool::getWork() {
-  sem_wait(&workSemaphore_);
+  while (sem_wait(&workSemaphore_) != 0 && errno == EINTR) {}
   std::unique_ptr<WorkInternal> work;
   {
     LockMutex lock(&workMutex_);
     work = std::move(works_.front());
     works_.pop();
   }
+  queueDepth_.sub(1);
   // TODO: do some p50-p95 calculation for wait times
-  context_->logger->info(
-        "Request %d waited in queue for %s",
-      work->work->requestId(),
-      (TimePoint() - work->ctime).str().c_str());
+  // plain numbers, the flight recorder keeps them without formatting
+  context_->logger->info("Request %d waited in queue for %ldus",
+      work->work->requestId(), (TimePoint() - work->ctime).ns() / 1000);
   return std::move(work->work);
 }
 
 WorkPool::WorkPool(Context* context, size_t poolSize)
     : Thread("WorkPool", context) {
+  if (context_->metrics) {
+    queueDepth_ = context_->metrics->gauge("holper_workpool_queue_depth",
+        "Requests waiting for a worker");
+    busyWorkers_ = context_->metrics->gauge("holper_workpool_busy_workers",
+        "Workers running an action");
+    poolSize_ = context_->metrics->gauge("holper_workpool_workers",
+        "Worker threads in the pool");
+    poolSize_.add(poolSize);
+  }
   for (size_t i=0; i<poolSize; ++i) {
     auto worker = std::make_unique<WorkPoolWorker>((int)i, context_, this);
     worker->start();
@@ -6,6 +6,7 @@
 #include <string>
 #include <memory>
 #include "request.h"
+#include "metrics.h"
 
 class WorkPool;
 struct Work;
@@ -38,7 +39,9 @@ class Work
   const Parameters parameters_;
   rapidjson::Document doc_;
   typedef std::function<void(std::unique_ptr<WorkResult>)> FinishFunction;
+  typedef std::function<void(std::unique_ptr<Work>)> DetachFunction;
   FinishFunction finish_;
+  DetachFunction detach_;
   Profiler profiler_;
   rapidjson::Document::AllocatorType* allocator_;
   friend class WorkPoolWorker;
@@ -61,6 +64,17 @@ public:
     return profiler_;
   }
 
+  // Called from actOn to finish the request later instead of with the
+  // returned value. Once actOn returns the worker hands the work to fn and
+  // moves on, whoever ends up owning it calls complete.
+  void detach(DetachFunction fn) {
+    detach_ = std::move(fn);
+  }
+  // Passes the work on to the function given to detach, if there was one
+  static bool handOff(std::unique_ptr<Work>& work);
+  static void complete(std::unique_ptr<Work> work, rapidjson::Value&& result,
+      int code);
+
   Work(int id,
       const Command* cmd,
       Parameters&& params,
@@ -86,6 +100,10 @@ private:
   sem_t workSemaphore_;
   std::queue<std::unique_ptr<WorkInternal>> works_;
   std::list<std::unique_ptr<WorkPoolWorker>> workers_;
+  Metrics::Gauge queueDepth_;
+  Metrics::Gauge busyWorkers_;
+  Metrics::Gauge poolSize_;
+  friend class WorkPoolWorker;
 public:
   WorkPool(Context* context, size_t poolSize);
   void handleMessage(std::unique_ptr<Work> msg) override;
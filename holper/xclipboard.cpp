@@ -0,0 +1,555 @@
+#include "xclipboard.h"
+#include "context.h"
+#include "logger.h"
+#include "exception.h"
+#include "string.h"
+#include <X11/Xatom.h>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <set>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace {
+  // Transfers nobody moved forward for this long are dropped
+  const TimeDelta kStaleTransfer = 5.0;
+  const int kExpireIntervalMs = 1000;
+  // Large values are cut into chunks of at most this size, even when the
+  // server would take bigger requests
+  const size_t kMaxChunkSize = 1 << 18;
+
+  // The handlers are process wide, other connections keep whatever was
+  // installed before
+  pthread_mutex_t handlerMutex = PTHREAD_MUTEX_INITIALIZER;
+  bool handlersInstalled = false;
+  XErrorHandler previousHandler = nullptr;
+  XIOErrorHandler previousIOHandler = nullptr;
+  std::set<Display*> clipboardDisplays;
+
+  // The requestor of a transfer can go away at any time, the default
+  // handler would exit the daemon over the resulting BadWindow
+  int ignoreBadWindow(Display* display, XErrorEvent* event) {
+    XErrorHandler previous;
+    {
+      LockMutex lock(&handlerMutex);
+      if (event->error_code == BadWindow &&
+          clipboardDisplays.count(display)) {
+        return 0;
+      }
+      previous = previousHandler;
+    }
+    return previous ? previous(display, event) : 0;
+  }
+
+  // The default handler of libX11 before 1.7 exits by itself, the exit
+  // handler set in connect drops the connection instead
+  int ignoreIOError(Display* display) {
+    XIOErrorHandler previous;
+    {
+      LockMutex lock(&handlerMutex);
+      if (clipboardDisplays.count(display)) {
+        return 0;
+      }
+      previous = previousIOHandler;
+    }
+    return previous ? previous(display) : 0;
+  }
+
+  void handleErrorsOn(Display* display) {
+    LockMutex lock(&handlerMutex);
+    if (!handlersInstalled) {
+      previousHandler = XSetErrorHandler(ignoreBadWindow);
+      previousIOHandler = XSetIOErrorHandler(ignoreIOError);
+      handlersInstalled = true;
+    }
+    clipboardDisplays.insert(display);
+  }
+
+  void closeClipboardDisplay(Display* display) {
+    {
+      LockMutex lock(&handlerMutex);
+      clipboardDisplays.erase(display);
+    }
+    XCloseDisplay(display);
+  }
+}
+
+const char* XClipboard::selectionName(Selection selection) {
+  switch (selection) {
+    case PRIMARY:
+      return "primary";
+    case CLIPBOARD:
+      return "clipboard";
+    default:
+      return "unknown";
+  }
+}
+
+std::optional<XClipboard::Selection> XClipboard::selectionFromName(
+    std::string_view name) {
+  for (int i = 0; i < SELECTION_COUNT; ++i) {
+    if (name == selectionName((Selection)i)) {
+      return (Selection)i;
+    }
+  }
+  return std::nullopt;
+}
+
+XClipboard::Pending::Pending(Selection sel, bool s, std::string d)
+    : selection(sel), set(s), data(std::move(d)) {
+  sem_init(&done, 0, 0);
+}
+
+XClipboard::Pending::~Pending() {
+  sem_destroy(&done);
+}
+
+XClipboard::XClipboard(Context* context, const char* displayName)
+    : ThreadBase("XClipboard", context) {
+  // the service may start before the session exports DISPLAY
+  if (!displayName) {
+    displayName = getenv("DISPLAY");
+  }
+  displayName_ = displayName ? displayName : ":0";
+  wakeFd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeFd_ == -1) {
+    THROW("eventfd failed: %s", St::errorString().c_str());
+  }
+  int r = pthread_mutex_init(&mutex_, NULL);
+  if (r != 0) {
+    close(wakeFd_);
+    THROW("Mutex init failed: %s", St::errorString(r).c_str());
+  }
+}
+
+XClipboard::~XClipboard() {
+  close(wakeFd_);
+  if (display_) {
+    closeClipboardDisplay(display_);
+  }
+}
+
+bool XClipboard::connect(std::string& error) {
+  if (display_) {
+    return true;
+  }
+  display_ = XOpenDisplay(displayName_.c_str());
+  if (!display_) {
+    error = St::fmt("Cannot open display %s", displayName_.c_str());
+    return false;
+  }
+  handleErrorsOn(display_);
+  XSetIOErrorExitHandler(display_, connectionLost, this);
+  // a request is 4 byte units, leave room for the ChangeProperty header
+  long maxRequest = XExtendedMaxRequestSize(display_);
+  if (!maxRequest) {
+    maxRequest = XMaxRequestSize(display_);
+  }
+  chunkSize_ = std::min<size_t>(maxRequest * 4 - 100, kMaxChunkSize);
+  window_ = XCreateSimpleWindow(display_, DefaultRootWindow(display_),
+      0, 0, 1, 1, 0, 0, 0);
+  XSelectInput(display_, window_, PropertyChangeMask);
+  selections_[PRIMARY] = XA_PRIMARY;
+  selections_[CLIPBOARD] = XInternAtom(display_, "CLIPBOARD", False);
+  properties_[PRIMARY] = XInternAtom(display_, "HOLPER_PRIMARY", False);
+  properties_[CLIPBOARD] = XInternAtom(display_, "HOLPER_CLIPBOARD", False);
+  stampProperty_ = XInternAtom(display_, "HOLPER_TIMESTAMP", False);
+  targets_ = XInternAtom(display_, "TARGETS", False);
+  utf8_ = XInternAtom(display_, "UTF8_STRING", False);
+  text_ = XInternAtom(display_, "TEXT", False);
+  incr_ = XInternAtom(display_, "INCR", False);
+  XFlush(display_);
+  context_->logger->info("Clipboard connected to display %s",
+      displayName_.c_str());
+  return true;
+}
+
+void XClipboard::connectionLost(Display* UNUSED(display), void* userdata) {
+  // Runs instead of exit(), on the clipboard thread as nothing else uses
+  // the display. Later calls on it fail fast until run closes it.
+  reinterpret_cast<XClipboard*>(userdata)->lost_ = true;
+}
+
+void XClipboard::disconnect() {
+  std::string error = St::fmt("Lost the connection to display %s",
+      displayName_.c_str());
+  context_->logger->warn("%s", error.c_str());
+  for (int i = 0; i < SELECTION_COUNT; ++i) {
+    complete((Selection)i, &error);
+    ownedSince_[i] = 0;
+  }
+  for (auto& pending : waitingForStamp_) {
+    pending->error = error;
+    sem_post(&pending->done);
+  }
+  waitingForStamp_.clear();
+  outgoing_.clear();
+  {
+    LockMutex lock(&mutex_);
+    for (auto& owned : owned_) {
+      owned.reset();
+    }
+  }
+  closeClipboardDisplay(display_);
+  display_ = nullptr;
+  lost_ = false;
+}
+
+void XClipboard::request(std::shared_ptr<Pending> pending, TimeDelta timeout) {
+  struct timespec deadline = (RealTimePoint() + timeout).timespec();
+  {
+    LockMutex lock(&mutex_);
+    requests_.push_back(pending);
+  }
+  uint64_t one = 1;
+  if (::write(wakeFd_, &one, sizeof(one)) != sizeof(one)) {
+    THROW("Waking clipboard thread failed: %s", St::errorString().c_str());
+  }
+  int r;
+  while ((r = sem_timedwait(&pending->done, &deadline)) != 0 &&
+      errno == EINTR) {}
+  if (r != 0) {
+    THROW("%s %s timed out", pending->set ? "Setting" : "Reading",
+        selectionName(pending->selection));
+  }
+  if (pending->error) {
+    THROW("%s", pending->error->c_str());
+  }
+}
+
+void XClipboard::set(Selection selection, std::string data,
+    TimeDelta timeout) {
+  request(std::make_shared<Pending>(selection, true, std::move(data)),
+      timeout);
+}
+
+std::string XClipboard::get(Selection selection, TimeDelta timeout) {
+  if (auto data = owned(selection)) {
+    return *data;
+  }
+  auto pending = std::make_shared<Pending>(selection, false, "");
+  request(pending, timeout);
+  return std::move(pending->data);
+}
+
+bool XClipboard::owns(Selection selection) {
+  return owned(selection) != nullptr;
+}
+
+std::shared_ptr<const std::string> XClipboard::owned(Selection selection) {
+  LockMutex lock(&mutex_);
+  return owned_[selection];
+}
+
+std::optional<XClipboard::Selection> XClipboard::selectionOf(
+    Atom atom) const {
+  for (int i = 0; i < SELECTION_COUNT; ++i) {
+    if (selections_[i] == atom) {
+      return (Selection)i;
+    }
+  }
+  return std::nullopt;
+}
+
+void XClipboard::takeRequests() {
+  std::vector<std::shared_ptr<Pending>> requests;
+  {
+    LockMutex lock(&mutex_);
+    requests.swap(requests_);
+  }
+  std::string error;
+  if (!requests.empty() && !connect(error)) {
+    context_->logger->debug("Clipboard unavailable: %s", error.c_str());
+    for (auto& pending : requests) {
+      pending->error = error;
+      sem_post(&pending->done);
+    }
+    return;
+  }
+  for (auto& pending : requests) {
+    if (pending->set) {
+      // Ownership needs a real server timestamp, appending nothing to a
+      // property of our window gets one back in the PropertyNotify
+      if (waitingForStamp_.empty()) {
+        XChangeProperty(display_, window_, stampProperty_, XA_STRING, 8,
+            PropModeAppend, nullptr, 0);
+      }
+      waitingForStamp_.push_back(pending);
+      continue;
+    }
+    if (auto data = owned(pending->selection)) {
+      pending->data = *data;
+      sem_post(&pending->done);
+      continue;
+    }
+    Incoming& in = incoming_[pending->selection];
+    in.waiters.push_back(pending);
+    // concurrent reads of the same selection share one conversion
+    if (in.waiters.size() == 1) {
+      convert(pending->selection, utf8_);
+    }
+  }
+}
+
+void XClipboard::convert(Selection selection, Atom target) {
+  Incoming& in = incoming_[selection];
+  in.target = target;
+  in.incr = false;
+  in.data.clear();
+  in.lastActivity = TimePoint();
+  XDeleteProperty(display_, window_, properties_[selection]);
+  XConvertSelection(display_, selections_[selection], target,
+      properties_[selection], window_, CurrentTime);
+}
+
+void XClipboard::complete(Selection selection, const std::string* error) {
+  Incoming& in = incoming_[selection];
+  for (auto& pending : in.waiters) {
+    if (error) {
+      pending->error = *error;
+    } else {
+      pending->data = in.data;
+    }
+    sem_post(&pending->done);
+  }
+  in.waiters.clear();
+  in.incr = false;
+  in.data.clear();
+}
+
+void XClipboard::takeOwnership(Time time) {
+  for (auto& pending : waitingForStamp_) {
+    Selection selection = pending->selection;
+    {
+      LockMutex lock(&mutex_);
+      owned_[selection] = std::make_shared<const std::string>(pending->data);
+    }
+    XSetSelectionOwner(display_, selections_[selection], window_, time);
+    // XGetSelectionOwner is a round trip, no need to sync before it
+    if (XGetSelectionOwner(display_, selections_[selection]) != window_) {
+      LockMutex lock(&mutex_);
+      owned_[selection].reset();
+      pending->error = St::fmt("Could not take ownership of %s",
+          selectionName(selection));
+    } else {
+      ownedSince_[selection] = time;
+      context_->logger->info("Took ownership of %s with %lu bytes",
+          selectionName(selection), pending->data.size());
+    }
+    sem_post(&pending->done);
+  }
+  waitingForStamp_.clear();
+}
+
+void XClipboard::serve(const XSelectionRequestEvent& request) {
+  XSelectionEvent reply = {};
+  reply.type = SelectionNotify;
+  reply.display = request.display;
+  reply.requestor = request.requestor;
+  reply.selection = request.selection;
+  reply.target = request.target;
+  reply.time = request.time;
+  reply.property = None;
+  // obsolete clients leave the property to us
+  Atom property = request.property == None ? request.target :
+    request.property;
+  auto selection = selectionOf(request.selection);
+  std::shared_ptr<const std::string> data;
+  if (selection && (request.time == CurrentTime ||
+        request.time >= ownedSince_[*selection])) {
+    data = owned(*selection);
+  }
+  if (!data) {
+    // refused
+  } else if (request.target == targets_) {
+    Atom targets[] = {targets_, utf8_, XA_STRING, text_};
+    XChangeProperty(display_, request.requestor, property, XA_ATOM, 32,
+        PropModeReplace, (unsigned char*)targets,
+        sizeof(targets) / sizeof(targets[0]));
+    reply.property = property;
+  } else if (request.target == utf8_ || request.target == XA_STRING ||
+      request.target == text_) {
+    Atom type = request.target == text_ ? utf8_ : request.target;
+    if (data->size() > chunkSize_) {
+      // Announce the size, chunks follow each time the requestor deletes
+      // the property
+      XSelectInput(display_, request.requestor, PropertyChangeMask);
+      long size = data->size();
+      XChangeProperty(display_, request.requestor, property, incr_, 32,
+          PropModeReplace, (unsigned char*)&size, 1);
+      outgoing_.push_back(Outgoing{request.requestor, property, type, data,
+          0, TimePoint()});
+    } else {
+      XChangeProperty(display_, request.requestor, property, type, 8,
+          PropModeReplace, (const unsigned char*)data->data(),
+          data->size());
+    }
+    reply.property = property;
+  }
+  XSendEvent(display_, request.requestor, False, NoEventMask,
+      (XEvent*)&reply);
+}
+
+void XClipboard::sendChunk(Outgoing& out) {
+  // the final empty chunk tells the requestor the transfer is over
+  size_t size = std::min(chunkSize_, out.data->size() - out.offset);
+  XChangeProperty(display_, out.requestor, out.property, out.type, 8,
+      PropModeReplace, (const unsigned char*)out.data->data() + out.offset,
+      size);
+  out.offset += size;
+  out.lastActivity = TimePoint();
+}
+
+void XClipboard::receive(Selection selection) {
+  Incoming& in = incoming_[selection];
+  Atom type;
+  int format;
+  unsigned long items, after;
+  unsigned char* value = nullptr;
+  if (Success != XGetWindowProperty(display_, window_,
+        properties_[selection], 0, LONG_MAX / 4, True, AnyPropertyType,
+        &type, &format, &items, &after, &value)) {
+    std::string error = St::fmt("Reading %s failed", selectionName(selection));
+    complete(selection, &error);
+    return;
+  }
+  size_t bytes = items * (format / 8);
+  in.lastActivity = TimePoint();
+  if (type == incr_) {
+    // deleting the property (done by the read) asks for the first chunk
+    in.incr = true;
+  } else if (!in.incr) {
+    in.data.assign((const char*)value, bytes);
+    complete(selection, nullptr);
+  } else if (bytes) {
+    in.data.append((const char*)value, bytes);
+  } else {
+    complete(selection, nullptr);
+  }
+  if (value) {
+    XFree(value);
+  }
+}
+
+void XClipboard::handleEvent(XEvent& event) {
+  switch (event.type) {
+    case SelectionRequest:
+      serve(event.xselectionrequest);
+      break;
+    case SelectionClear:
+      if (auto selection = selectionOf(event.xselectionclear.selection)) {
+        // a clear from before we took it again is stale
+        if (event.xselectionclear.time != CurrentTime &&
+            event.xselectionclear.time < ownedSince_[*selection]) {
+          break;
+        }
+        context_->logger->info("Lost ownership of %s",
+            selectionName(*selection));
+        LockMutex lock(&mutex_);
+        owned_[*selection].reset();
+      }
+      break;
+    case SelectionNotify: {
+      auto selection = selectionOf(event.xselection.selection);
+      if (!selection || incoming_[*selection].waiters.empty()) {
+        break;
+      }
+      if (event.xselection.property != None) {
+        receive(*selection);
+      } else if (incoming_[*selection].target == utf8_) {
+        // older owners may only know STRING
+        convert(*selection, XA_STRING);
+      } else {
+        // nobody owns it or it isn't text, either way it reads as empty
+        complete(*selection, nullptr);
+      }
+      break;
+    }
+    case PropertyNotify: {
+      const XPropertyEvent& prop = event.xproperty;
+      if (prop.window == window_) {
+        if (prop.atom == stampProperty_ && prop.state == PropertyNewValue) {
+          takeOwnership(prop.time);
+          break;
+        }
+        for (int i = 0; i < SELECTION_COUNT; ++i) {
+          if (prop.atom == properties_[i] && prop.state == PropertyNewValue &&
+              incoming_[i].incr) {
+            receive((Selection)i);
+          }
+        }
+        break;
+      }
+      if (prop.state != PropertyDelete) {
+        break;
+      }
+      for (auto it = outgoing_.begin(); it != outgoing_.end(); ++it) {
+        if (it->requestor != prop.window || it->property != prop.atom) {
+          continue;
+        }
+        bool last = it->offset == it->data->size();
+        sendChunk(*it);
+        if (last) {
+          XSelectInput(display_, it->requestor, NoEventMask);
+          outgoing_.erase(it);
+        }
+        break;
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+void XClipboard::expire() {
+  TimePoint now;
+  for (int i = 0; i < SELECTION_COUNT; ++i) {
+    Incoming& in = incoming_[i];
+    if (!in.waiters.empty() && kStaleTransfer < now - in.lastActivity) {
+      std::string error = St::fmt("Owner of %s stopped answering",
+          selectionName((Selection)i));
+      complete((Selection)i, &error);
+    }
+  }
+  std::erase_if(outgoing_, [&](const Outgoing& out) {
+    return kStaleTransfer < now - out.lastActivity;
+  });
+}
+
+void XClipboard::run() {
+  while (true) {
+    if (display_) {
+      while (!lost_ && XPending(display_)) {
+        XEvent event;
+        XNextEvent(display_, &event);
+        handleEvent(event);
+      }
+      if (!lost_) {
+        XFlush(display_);
+      }
+    }
+    if (lost_) {
+      disconnect();
+    }
+    // poll skips the negative fd while disconnected
+    struct pollfd fds[2] = {
+      {display_ ? ConnectionNumber(display_) : -1, POLLIN, 0},
+      {wakeFd_, POLLIN, 0},
+    };
+    int ready = poll(fds, 2, kExpireIntervalMs);
+    if (ready < 0 && errno != EINTR) {
+      THROW("poll failed: %s", St::errorString().c_str());
+    }
+    if (fds[1].revents) {
+      uint64_t pending;
+      if (::read(wakeFd_, &pending, sizeof(pending)) < 0 && errno != EAGAIN) {
+        THROW("eventfd read failed: %s", St::errorString().c_str());
+      }
+      takeRequests();
+    }
+    expire();
+  }
+}
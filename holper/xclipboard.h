@@ -0,0 +1,108 @@
+#pragma once
+#include "thread.h"
+#include "time.h"
+#include <X11/Xlib.h>
+#include <semaphore.h>
+#include <list>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Owns the X selections on a dedicated thread with its own connection.
+// Values set here are served to other clients straight from memory, using
+// INCR transfers when they don't fit a single request, and reading a
+// selection someone else owns is a ConvertSelection round trip. Neither
+// spawns a process. The display is opened on first use and again after
+// the connection was lost, e.g. to a restarted X server.
+class XClipboard : public ThreadBase
+{
+public:
+  enum Selection {
+    PRIMARY,
+    CLIPBOARD,
+    SELECTION_COUNT
+  };
+  static const char* selectionName(Selection selection);
+  static std::optional<Selection> selectionFromName(std::string_view name);
+private:
+  struct Pending {
+    sem_t done;
+    Selection selection;
+    bool set;
+    std::string data;
+    std::optional<std::string> error;
+    Pending(Selection sel, bool s, std::string d);
+    ~Pending();
+  };
+  // A value being sent to a requestor in INCR chunks
+  struct Outgoing {
+    Window requestor;
+    Atom property;
+    Atom type;
+    std::shared_ptr<const std::string> data;
+    size_t offset;
+    TimePoint lastActivity;
+  };
+  // A value being read from another owner
+  struct Incoming {
+    std::vector<std::shared_ptr<Pending>> waiters;
+    Atom target = None;
+    bool incr = false;
+    std::string data;
+    TimePoint lastActivity;
+  };
+
+  std::string displayName_;
+  // only touched by the clipboard thread, null while disconnected
+  Display* display_ = nullptr;
+  // set by the IO error exit handler, the display is closed next loop
+  bool lost_ = false;
+  Window window_;
+  int wakeFd_;
+  size_t chunkSize_;
+  Atom selections_[SELECTION_COUNT];
+  Atom properties_[SELECTION_COUNT];
+  Atom stampProperty_, targets_, utf8_, text_, incr_;
+
+  pthread_mutex_t mutex_;
+  // guarded by mutex_
+  std::vector<std::shared_ptr<Pending>> requests_;
+  std::shared_ptr<const std::string> owned_[SELECTION_COUNT];
+
+  // only touched by the clipboard thread
+  std::vector<std::shared_ptr<Pending>> waitingForStamp_;
+  Time ownedSince_[SELECTION_COUNT] = {};
+  Incoming incoming_[SELECTION_COUNT];
+  std::list<Outgoing> outgoing_;
+
+  void request(std::shared_ptr<Pending> pending, TimeDelta timeout);
+  // Opens the display unless it is open, sets error on failure
+  bool connect(std::string& error);
+  // Fails everything in flight and closes the display
+  void disconnect();
+  static void connectionLost(Display* display, void* userdata);
+  void takeRequests();
+  void handleEvent(XEvent& event);
+  void takeOwnership(Time time);
+  void serve(const XSelectionRequestEvent& request);
+  void sendChunk(Outgoing& out);
+  void receive(Selection selection);
+  void convert(Selection selection, Atom target);
+  void complete(Selection selection, const std::string* error);
+  void expire();
+  std::optional<Selection> selectionOf(Atom atom) const;
+  std::shared_ptr<const std::string> owned(Selection selection);
+protected:
+  void run() override;
+public:
+  // Connects to displayName, or $DISPLAY (:0 when unset) if null, once
+  // the first request comes in
+  XClipboard(Context* context, const char* displayName = nullptr);
+  ~XClipboard();
+  // Both block until the X server has answered or timeout runs out
+  void set(Selection selection, std::string data, TimeDelta timeout = 1.0);
+  std::string get(Selection selection, TimeDelta timeout = 1.0);
+  bool owns(Selection selection);
+};
@@ -0,0 +1,53 @@
+#include <gtest/gtest.h>
+#include <cstdlib>
+#include "xclipboard.h"
+#include "context.h"
+#include "logger.h"
+
+// Needs an X server, e.g. xvfb-run ./test --gtest_filter='XClipboard*'
+
+namespace {
+  // Clipboard threads can't be stopped, they and their context are leaked
+  XClipboard* startClipboard() {
+    static Context* context = []() {
+      XInitThreads();
+      Context* context = new Context;
+      context->logger = std::make_shared<Logger>(Logger::MUSTFIX);
+      return context;
+    }();
+    auto clipboard = new XClipboard(context);
+    clipboard->start();
+    return clipboard;
+  }
+}
+
+TEST(XClipboardTest, names) {
+  EXPECT_EQ(XClipboard::selectionFromName("primary"), XClipboard::PRIMARY);
+  EXPECT_EQ(XClipboard::selectionFromName("clipboard"),
+      XClipboard::CLIPBOARD);
+  EXPECT_FALSE(XClipboard::selectionFromName("secondary"));
+}
+
+TEST(XClipboardTest, transfer) {
+  if (!getenv("DISPLAY")) {
+    GTEST_SKIP() << "no X server";
+  }
+  XClipboard* owner = startClipboard();
+  XClipboard* reader = startClipboard();
+  owner->set(XClipboard::CLIPBOARD, "small value");
+  EXPECT_TRUE(owner->owns(XClipboard::CLIPBOARD));
+  EXPECT_EQ(owner->get(XClipboard::CLIPBOARD), "small value");
+  // goes through the X server since the reader is another client
+  EXPECT_EQ(reader->get(XClipboard::CLIPBOARD), "small value");
+
+  // larger than a request, sent with INCR
+  std::string large(3 << 20, 'z');
+  large[12345] = 'a';
+  owner->set(XClipboard::PRIMARY, large);
+  EXPECT_EQ(reader->get(XClipboard::PRIMARY, 5.0), large);
+
+  // taking it over clears the previous owner
+  reader->set(XClipboard::CLIPBOARD, "taken");
+  EXPECT_EQ(owner->get(XClipboard::CLIPBOARD), "taken");
+  EXPECT_FALSE(owner->owns(XClipboard::CLIPBOARD));
+}